@@ -0,0 +1,216 @@
+#pragma once
+#include "../vmem.h"
+
+// Policies for arenas and containers which are known at compile time, so the hot paths compile down to constant masks
+// without any runtime checks. The arenas still wrap the C structs (`VMemArena`, `VMemAtomicArena`), so they can be
+// passed to the C API.
+
+// Decommit policies, used when an arena is reset.
+struct VDecommitNever {
+    static constexpr VMemSize keep_bytes(const VMemSize commited) {
+        return commited;
+    }
+};
+
+struct VDecommitAll {
+    static constexpr VMemSize keep_bytes(const VMemSize) {
+        return 0;
+    }
+};
+
+// Keep at most `KEEP_BYTES` commited, e.g. the usual size of a frame.
+template<VMemSize KEEP_BYTES>
+struct VDecommitKeep {
+    static constexpr VMemSize keep_bytes(const VMemSize commited) {
+        return commited < KEEP_BYTES ? commited : KEEP_BYTES;
+    }
+};
+
+// Compile-time arena configuration.
+// @param PAGE_SIZE_: the page size commits are aligned to. Must be a multiple of the real page size of `ALLOC_FLAGS_`,
+//  which is checked once at init.
+// @param COMMIT_GRANULARITY_: arenas commit ahead in multiples of this many bytes.
+// @param THREAD_SAFE_: use a lock-free `VMemAtomicArena`.
+// @param DECOMMIT_: one of the decommit policies above.
+template<
+    VMemSize PAGE_SIZE_ = 4096,
+    VMemSize COMMIT_GRANULARITY_ = VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY,
+    bool THREAD_SAFE_ = false,
+    typename DECOMMIT_ = VDecommitNever,
+    VMemAllocFlags ALLOC_FLAGS_ = VMemAllocFlag_None>
+struct VArenaPolicy {
+    static constexpr VMemSize PAGE_SIZE = PAGE_SIZE_;
+    static constexpr VMemSize COMMIT_GRANULARITY = COMMIT_GRANULARITY_;
+    static constexpr bool THREAD_SAFE = THREAD_SAFE_;
+    static constexpr VMemAllocFlags ALLOC_FLAGS = ALLOC_FLAGS_;
+    typedef DECOMMIT_ Decommit;
+
+    static_assert(PAGE_SIZE > 0 && (PAGE_SIZE & (PAGE_SIZE - 1)) == 0, "Page size has to be a power of 2");
+    static_assert(
+        COMMIT_GRANULARITY >= PAGE_SIZE && (COMMIT_GRANULARITY & (COMMIT_GRANULARITY - 1)) == 0,
+        "Commit granularity has to be a power of 2 multiple of the page size");
+
+    static constexpr VMemSize align_to_pages(const VMemSize num_bytes, const VMemArena& = {}) {
+        return (num_bytes + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+    }
+
+    static constexpr VMemSize align_to_commit_granularity(const VMemSize num_bytes, const VMemArena& = {}) {
+        return (num_bytes + (COMMIT_GRANULARITY - 1)) & ~(COMMIT_GRANULARITY - 1);
+    }
+
+    static constexpr VMemSize commit_granularity(const VMemArena&) {
+        return COMMIT_GRANULARITY;
+    }
+
+    // @returns false if the compile-time page size doesn't match the system.
+    static bool is_supported() {
+        const VMemSize page_size = vmem_get_page_size_for_flags(ALLOC_FLAGS);
+        return page_size != 0 && PAGE_SIZE % page_size == 0;
+    }
+};
+
+// Policy which reads everything from the arena at runtime, this is what the containers use by default.
+struct VArenaDynamicPolicy {
+    // 0 keeps the `commit_granularity` the arena was initialized with.
+    static constexpr VMemSize COMMIT_GRANULARITY = 0;
+    static constexpr bool THREAD_SAFE = false;
+    static constexpr VMemAllocFlags ALLOC_FLAGS = VMemAllocFlag_None;
+    typedef VDecommitNever Decommit;
+
+    static VMemSize align_to_pages(const VMemSize num_bytes, const VMemArena& arena) {
+        return vmem_arena_calc_bytes_used_for_size_ex(num_bytes, vmem_get_page_size_for_flags(arena.flags));
+    }
+
+    static VMemSize align_to_commit_granularity(const VMemSize num_bytes, const VMemArena& arena) {
+        const VMemSize page_size = vmem_get_page_size_for_flags(arena.flags);
+        const VMemSize granularity = arena.commit_granularity > page_size ? arena.commit_granularity : page_size;
+        return (num_bytes + (granularity - 1)) & ~(granularity - 1);
+    }
+
+    static VMemSize commit_granularity(const VMemArena& arena) {
+        return arena.commit_granularity;
+    }
+
+    static bool is_supported() {
+        return true;
+    }
+};
+
+// Common policies
+typedef VArenaPolicy<> VArenaPolicyDefault;
+typedef VArenaPolicy<4096, VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY, true> VArenaPolicyThreadSafe;
+// Scratch memory which is reset every frame and keeps 1MB commited.
+typedef VArenaPolicy<4096, VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY, false, VDecommitKeep<1024 * 1024>> VArenaPolicyFrame;
+typedef VArenaPolicy<2 * 1024 * 1024, 2 * 1024 * 1024, false, VDecommitNever, VMemAllocFlag_TransparentLargePages>
+    VArenaPolicyLargePages;
+
+// Arena with a compile-time policy. The fast path of `push` is an add, a mask and a compare.
+template<typename POLICY = VArenaPolicyDefault, bool THREAD_SAFE = POLICY::THREAD_SAFE>
+struct VArenaT {
+    VMemArena arena = {};
+
+    bool init(void* mem, const VMemSize size_bytes) {
+        arena = vmem_arena_init(mem, size_bytes);
+        if(POLICY::COMMIT_GRANULARITY) arena.commit_granularity = POLICY::COMMIT_GRANULARITY;
+        return vmem_arena_is_valid(&arena) && POLICY::is_supported();
+    }
+
+    bool init_alloc(const VMemSize size_bytes) {
+        if(!POLICY::is_supported()) return false;
+        arena = vmem_arena_init_alloc_ex(size_bytes, POLICY::ALLOC_FLAGS);
+        if(POLICY::COMMIT_GRANULARITY) arena.commit_granularity = POLICY::COMMIT_GRANULARITY;
+        return vmem_arena_is_valid(&arena);
+    }
+
+    void deinit_dealloc() {
+        vmem_arena_deinit_dealloc(&arena);
+    }
+
+    // @returns null when the arena is full.
+    template<VMemSize ALIGN = 16>
+    inline void* push(const VMemSize num_bytes) {
+        static_assert(ALIGN > 0 && (ALIGN & (ALIGN - 1)) == 0, "Alignment has to be a power of 2");
+        const uintptr_t base = (uintptr_t)arena.mem;
+        const VMemSize start = (VMemSize)(((base + arena.pos + (ALIGN - 1)) & ~(uintptr_t)(ALIGN - 1)) - base);
+        const VMemSize end = start + num_bytes;
+        if(end <= arena.commited) {
+            arena.pos = end;
+            return arena.mem + start;
+        }
+        return _push_slow(start, end);
+    }
+
+    template<typename T>
+    inline T* push_items(const VMemSize count) {
+        return (T*)push<alignof(T)>(count * sizeof(T));
+    }
+
+    // Free the last `num_bytes` bytes. Not checked.
+    inline void pop(const VMemSize num_bytes) {
+        arena.pos -= num_bytes;
+    }
+
+    // Free everything, and decommit the memory the decommit policy doesn't keep.
+    void reset() {
+        arena.pos = 0;
+        const VMemSize keep = POLICY::align_to_pages(POLICY::Decommit::keep_bytes(arena.commited), arena);
+        if(keep < arena.commited) vmem_arena_set_commited(&arena, keep);
+    }
+
+    void* _push_slow(const VMemSize start, const VMemSize end) {
+        if(end > arena.size_bytes) return nullptr;
+        VMemSize commited = POLICY::align_to_commit_granularity(end, arena);
+        if(commited > arena.size_bytes) commited = arena.size_bytes;
+        if(!vmem_arena_set_commited(&arena, commited)) return nullptr;
+        arena.pos = end;
+        return arena.mem + start;
+    }
+};
+
+// Thread-safe version, any number of threads can push at the same time. `reset` is not thread-safe.
+template<typename POLICY>
+struct VArenaT<POLICY, true> {
+    VMemAtomicArena arena = {};
+
+    bool init(void* mem, const VMemSize size_bytes) {
+        if(!POLICY::is_supported() || !vmem_atomic_arena_init(&arena, mem, size_bytes)) return false;
+        if(POLICY::COMMIT_GRANULARITY) arena.commit_granularity = POLICY::COMMIT_GRANULARITY;
+        return true;
+    }
+
+    bool init_alloc(const VMemSize size_bytes) {
+        if(!POLICY::is_supported() || !vmem_atomic_arena_init_alloc(&arena, size_bytes, POLICY::ALLOC_FLAGS)) {
+            return false;
+        }
+        if(POLICY::COMMIT_GRANULARITY) arena.commit_granularity = POLICY::COMMIT_GRANULARITY;
+        return true;
+    }
+
+    void deinit_dealloc() {
+        vmem_atomic_arena_deinit_dealloc(&arena);
+    }
+
+    template<VMemSize ALIGN = 16>
+    inline void* push(const VMemSize num_bytes) {
+        static_assert(ALIGN > 0 && (ALIGN & (ALIGN - 1)) == 0, "Alignment has to be a power of 2");
+        return vmem_atomic_arena_push(&arena, num_bytes, (int)ALIGN);
+    }
+
+    template<typename T>
+    inline T* push_items(const VMemSize count) {
+        return (T*)push<alignof(T)>(count * sizeof(T));
+    }
+
+    void reset() {
+        vmem_atomic_arena_reset(&arena);
+        // The policies align based on a `VMemArena`, so give the dynamic one a view with our flags.
+        VMemArena view = {};
+        view.flags = arena.flags;
+        const VMemSize keep = POLICY::align_to_pages(POLICY::Decommit::keep_bytes(arena.commited), view);
+        if(keep < arena.commited) {
+            const VMemSize commited = POLICY::align_to_pages(arena.commited, view);
+            if(commited > keep && !vmem_decommit_ex(arena.mem + keep, commited - keep, arena.commit_flags)) return;
+            arena.commited = keep;
+        }
+    }
+};
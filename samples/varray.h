@@ -1,21 +1,43 @@
 #pragma once
 #include "../vmem.h"
+#include "varena.h"
+#include <new>     // placement new
+#include <utility> // std::move, std::forward
 
-template<typename T>
+// Growable array in a virtual memory arena. Items never move in memory, so pointers to items stay valid.
+// Memory is commited geometrically (at least by `arena.commit_granularity` bytes), decommited when the array shrinks
+// with `resize`.
+// In the unbounded mode the reservation itself grows with `vmem_realloc` when it's full. That is cheap (page tables
+// are moved on Linux), but the items do move then, so pointers to items are only stable until the next grow.
+// `POLICY` can be a `VArenaPolicy` to align commits with compile-time masks. By default the page size is queried at
+// runtime.
+template<typename T, typename POLICY = VArenaDynamicPolicy>
 struct VArray {
     VMemArena arena = {};
     int len = 0;
+    // Number of items which fit into the commited memory.
+    int capacity = 0;
+    // Grow the reservation when it's full, instead of failing. Only for arrays initialized with `init_alloc`.
+    bool unbounded = false;
 
     void init(void* mem, VMemSize size_bytes) {
         arena = vmem_arena_init(mem, size_bytes);
+        len = 0;
+        capacity = 0;
     }
 
-    void init_alloc(const int max_items) {
-        arena = vmem_arena_init_alloc(max_items * sizeof(T));
+    // @param max_items: initial number of items in the reservation when `unbounded` is true.
+    void init_alloc(const int max_items, const bool unbounded = false) {
+        arena = vmem_arena_init_alloc_ex(max_items * sizeof(T), POLICY::ALLOC_FLAGS);
+        len = 0;
+        capacity = 0;
+        this->unbounded = unbounded;
     }
 
     void deinit_dealloc() {
+        clear();
         vmem_arena_deinit_dealloc(&arena);
+        capacity = 0;
     }
 
     bool is_valid() {
@@ -23,13 +45,29 @@ struct VArray {
     }
 
     inline bool is_in_bounds(const int index) {
-        return index >= 0 && index <= len;
+        return index >= 0 && index < len;
     }
 
     inline T* get_items() {
         return (T*)arena.mem;
     }
 
+    inline int max_items() {
+        return (int)(arena.size_bytes / sizeof(T));
+    }
+
+    T* begin() {
+        return get_items();
+    }
+
+    T* end() {
+        return get_items() + len;
+    }
+
+    T& operator[](const int index) {
+        return get_items()[index];
+    }
+
     T get(const int index) {
         if(is_in_bounds(index)) {
             return get_items()[index];
@@ -45,20 +83,123 @@ struct VArray {
         return false;
     }
 
+    // Make sure there is commited memory for at least `num_items` items.
+    bool reserve(const int num_items) {
+        if(num_items <= capacity) return true;
+        return _commit_bytes((VMemSize)num_items * sizeof(T)) && num_items <= capacity;
+    }
+
+    // Construct a new item at the end of the array.
+    // @returns index of the new item, or -1 when the array is full.
+    template<typename... ARGS>
+    int emplace(ARGS&&... args) {
+        if(len >= capacity && !_grow(len + 1)) return -1;
+        new(&get_items()[len]) T(std::forward<ARGS>(args)...);
+        return len++;
+    }
+
     int put(const T& value) {
-        vmem_arena_set_commited(&arena, len + 1);
+        return emplace(value);
+    }
+
+    int put(T&& value) {
+        return emplace(std::move(value));
+    }
+
+    // Add `count` default-constructed items at the end of the array.
+    // @returns pointer to the first new item, or null when the array doesn't have enough space.
+    T* push_n(const int count) {
+        if(len + count > capacity && !_grow(len + count)) return nullptr;
+        T* items = get_items() + len;
+        for(int i = 0; i < count; i++) {
+            new(&items[i]) T();
+        }
+        len += count;
+        return items;
+    }
+
+    // Copy `count` items to the end of the array.
+    // @returns index of the first new item, or -1 when the array doesn't have enough space.
+    int append(const T* values, const int count) {
+        if(len + count > capacity && !_grow(len + count)) return -1;
+        T* items = get_items() + len;
+        for(int i = 0; i < count; i++) {
+            new(&items[i]) T(values[i]);
+        }
         const int index = len;
-        len += 1;
-        get_items()[index] = value;
+        len += count;
         return index;
     }
 
+    // Change the number of items. New items are default-constructed.
+    // When the array shrinks, the memory which isn't needed anymore is decommited.
+    bool resize(const int new_len) {
+        if(new_len > len) {
+            return push_n(new_len - len) != nullptr;
+        }
+        T* items = get_items();
+        for(int i = new_len; i < len; i++) {
+            items[i].~T();
+        }
+        len = new_len;
+        if(vmem_arena_set_commited(&arena, (VMemSize)new_len * sizeof(T))) {
+            _update_capacity();
+        }
+        return true;
+    }
+
+    // Destroy all items. The memory stays commited.
+    void clear() {
+        T* items = get_items();
+        for(int i = 0; i < len; i++) {
+            items[i].~T();
+        }
+        len = 0;
+    }
+
     void swap_remove(const int index) {
         if(is_in_bounds(index)) {
             len -= 1;
             const int last = len;
             T* items = get_items();
-            items[index] = items[last];
+            if(index != last) {
+                items[index] = std::move(items[last]);
+            }
+            items[last].~T();
         }
     }
-};
\ No newline at end of file
+
+    // Commit at least enough memory for `num_items`, but grow geometrically to keep the number of commits low.
+    bool _grow(const int num_items) {
+        VMemSize commited = (VMemSize)num_items * sizeof(T);
+        if(commited < arena.commited * 2) commited = arena.commited * 2;
+        if(commited < POLICY::commit_granularity(arena)) commited = POLICY::commit_granularity(arena);
+        return _commit_bytes(commited) && num_items <= capacity;
+    }
+
+    bool _commit_bytes(VMemSize num_bytes) {
+        // Use all of the commited pages.
+        num_bytes = POLICY::align_to_pages(num_bytes, arena);
+        if(num_bytes > arena.size_bytes && !(unbounded && _grow_reservation(num_bytes))) num_bytes = arena.size_bytes;
+        if(num_bytes <= arena.commited) return false;
+        if(!vmem_arena_set_commited(&arena, num_bytes)) return false;
+        _update_capacity();
+        return true;
+    }
+
+    // Resize the reservation to at least `num_bytes`, doubling the size.
+    bool _grow_reservation(const VMemSize num_bytes) {
+        VMemSize size_bytes = arena.size_bytes * 2;
+        if(size_bytes < num_bytes) size_bytes = num_bytes;
+        size_bytes = vmem_align_forward(size_bytes, (int)vmem_get_allocation_granularity());
+        void* mem = vmem_realloc(arena.mem, arena.size_bytes, size_bytes);
+        if(mem == nullptr) return false;
+        arena.mem = (uint8_t*)mem;
+        arena.size_bytes = size_bytes;
+        return true;
+    }
+
+    void _update_capacity() {
+        capacity = (int)(arena.commited / sizeof(T));
+    }
+};
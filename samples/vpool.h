@@ -1,25 +1,140 @@
 #pragma once
 #include "../vmem.h"
+#include "varena.h"
+#include <new> // placement new
 
-template<typename INDEX, typename T>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit. `bits` cannot be 0.
+static inline int vpool__ctz64(const uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index = 0;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Pool of slots in virtual memory. Removed slots are reused with an intrusive free list.
+// Occupied slots are tracked in a bitset, so live items can be iterated without touching the free slots.
+// With `GENERATIONAL`, each slot also has a generation counter, so stale handles to removed items can be detected.
+// The bitset and the generations are separate arrays (SoA), so they don't pollute the cache lines of the items.
+// All the arrays live in the same virtual memory block.
+//
+// In trim mode (see `init`), slots are grouped into blocks of at least one page, each with its own free list.
+// `put` prefers partially filled blocks, and the pages of blocks which become completely free can be decommited
+// with `trim` (or right away with `auto_trim`). They are commited again when the block gets reused. This way the
+// commited memory shrinks after load spikes.
+//
+// `POLICY` can be a `VArenaPolicy` to align commits with compile-time masks, see `VArray`.
+template<typename INDEX, typename T, bool GENERATIONAL = false, typename POLICY = VArenaDynamicPolicy>
 struct VPool {
     static_assert(sizeof(T) >= sizeof(INDEX), "T has to be at least as large as INDEX");
     static constexpr INDEX INVALID_INDEX = (INDEX)-1;
 
+    // Reference to an item which knows when the item was removed.
+    struct Handle {
+        INDEX slot;
+        uint32_t generation;
+    };
+
+    static constexpr Handle INVALID_HANDLE = {INVALID_INDEX, 0};
+
+    enum BlockState : uint8_t {
+        BlockState_Full = 0,   // No free slots (or not used yet).
+        BlockState_Partial,    // In the partial block list.
+        BlockState_Empty,      // In the empty block list, all slots are free.
+        BlockState_Decommited, // In the empty block list, and the pages are decommited.
+    };
+
+    // Per-block bookkeeping for the trim mode.
+    struct Block {
+        INDEX first_free;
+        INDEX num_used;
+        // Links in the partial or empty block list.
+        INDEX next;
+        INDEX prev;
+        BlockState state;
+    };
+
     VMemArena arena = {};
+    // Bitset of occupied slots.
+    VMemArena occupied = {};
+    // Generation of each slot, only used with GENERATIONAL.
+    VMemArena generations = {};
     INDEX head_slot = 0;
     INDEX first_free_slot = INVALID_INDEX;
+    int num_live_slots = 0;
+    int max_slots = 0;
+    // Trim mode
+    VMemArena blocks = {};
+    bool trim_mode = false;
+    // Decommit the pages of blocks as soon as they are completely free.
+    bool auto_trim = false;
+    int slots_per_block = 0;
+    INDEX first_partial_block = INVALID_INDEX;
+    INDEX first_empty_block = INVALID_INDEX;
+    int num_decommited_blocks = 0;
+    // The whole memory block, when it's owned by the pool.
+    void* _alloc_mem = nullptr;
+    VMemSize _alloc_size = 0;
+
+    // Number of slots in one trim mode block. Each block covers at least one whole page.
+    static int calc_slots_per_block() {
+        const VMemSize page_size = vmem_get_page_size();
+        if(page_size % sizeof(T) == 0) return (int)(page_size / sizeof(T));
+        // The block doesn't start at a page boundary, so make it span 2 pages to fully contain at least one.
+        return (int)((2 * page_size + sizeof(T) - 1) / sizeof(T));
+    }
+
+    // Number of bytes needed for a pool with `num_slots` slots.
+    static VMemSize calc_size_bytes(const int num_slots, const bool trim = false) {
+        const VMemSize page_size = vmem_get_page_size();
+        VMemSize result = vmem_align_forward((VMemSize)num_slots * sizeof(T), page_size);
+        result += vmem_align_forward(((VMemSize)num_slots + 63) / 64 * sizeof(uint64_t), page_size);
+        if(GENERATIONAL) result += vmem_align_forward((VMemSize)num_slots * sizeof(uint32_t), page_size);
+        if(trim) {
+            const VMemSize num_blocks = ((VMemSize)num_slots + calc_slots_per_block() - 1) / calc_slots_per_block();
+            result += vmem_align_forward(num_blocks * sizeof(Block), page_size);
+        }
+        return result;
+    }
 
-    void init(void* mem, VMemSize size_bytes) {
-        arena = vmem_arena_init(mem, size_bytes);
+    // @param trim: enable the trim mode, see the `VPool` comment.
+    void init(void* mem, VMemSize size_bytes, const bool trim = false) {
+        // Find the number of slots which fit into the memory block, including the bitset and generations.
+        const VMemSize bytes_per_slot = sizeof(T) + (GENERATIONAL ? sizeof(uint32_t) : 0) + 1;
+        int num_slots = (int)(size_bytes / bytes_per_slot);
+        while(num_slots > 0 && calc_size_bytes(num_slots, trim) > size_bytes) {
+            num_slots -= (int)(vmem_get_page_size() / sizeof(T)) + 1;
+        }
+        if(num_slots <= 0) {
+            *this = VPool();
+            return;
+        }
+        _init_arrays((uint8_t*)mem, num_slots, trim);
     }
 
-    void init_alloc(const int max_slots) {
-        arena = vmem_arena_init_alloc(max_slots * sizeof(T));
+    // @param trim: enable the trim mode, see the `VPool` comment.
+    void init_alloc(const int num_slots, const bool trim = false) {
+        const VMemSize size = calc_size_bytes(num_slots, trim);
+        uint8_t* mem = (uint8_t*)vmem_alloc(size);
+        if(mem == nullptr) {
+            *this = VPool();
+            return;
+        }
+        _init_arrays(mem, num_slots, trim);
+        _alloc_mem = mem;
+        _alloc_size = size;
     }
 
     void deinit_dealloc() {
-        vmem_arena_deinit_dealloc(&arena);
+        for_each([](const int, T& item) { item.~T(); });
+        if(_alloc_mem) vmem_dealloc(_alloc_mem, _alloc_size);
+        *this = VPool();
     }
 
     bool is_valid() {
@@ -27,39 +142,293 @@ struct VPool {
     }
 
     inline bool is_in_bounds(const int slot) {
-        return slot >= 0 && slot <= head_slot;
+        return slot >= 0 && slot < (int)head_slot;
     }
 
     inline T* get_slots() {
         return (T*)arena.mem;
     }
 
-    T& get(const int slot) {
-        if(is_in_bounds(slot)) {
-            return get_slots()[slot];
+    inline uint64_t* get_occupied_bits() {
+        return (uint64_t*)occupied.mem;
+    }
+
+    inline uint32_t* get_generations() {
+        return (uint32_t*)generations.mem;
+    }
+
+    inline bool is_occupied(const int slot) {
+        return is_in_bounds(slot) && (get_occupied_bits()[slot / 64] & ((uint64_t)1 << (slot % 64))) != 0;
+    }
+
+    // @returns null if the slot isn't occupied.
+    T* get(const int slot) {
+        if(is_occupied(slot)) {
+            return &get_slots()[slot];
+        }
+        return nullptr;
+    }
+
+    // @returns null if the handle is stale (the item was removed).
+    T* get(const Handle handle) {
+        static_assert(GENERATIONAL, "Handles are only supported in generational pools");
+        if(is_occupied(handle.slot) && get_generations()[handle.slot] == handle.generation) {
+            return &get_slots()[handle.slot];
         }
-        return {};
+        return nullptr;
     }
 
     INDEX* _slot_index_ptr(const INDEX slot) {
         return (INDEX*)(&get_slots()[slot]);
     }
 
+    inline Block* get_blocks() {
+        return (Block*)blocks.mem;
+    }
+
+    // @returns the slot of the new item, or -1 when the pool is full.
     int put(const T& value) {
-        INDEX slot = first_free_slot;
+        INDEX slot = trim_mode ? _pop_block_free_slot() : first_free_slot;
         if(slot != INVALID_INDEX) {
-            first_free_slot = *_slot_index_ptr(first_free_slot);
+            if(!trim_mode) first_free_slot = *_slot_index_ptr(first_free_slot);
         } else {
             // The free list was empty, push a new entity onto the pool.
-            vmem_arena_set_commited(&arena, head_slot + 1);
+            if((int)head_slot >= max_slots || !_commit_slots((int)head_slot + 1)) return -1;
             slot = head_slot;
             head_slot++;
+            if(trim_mode) get_blocks()[slot / slots_per_block].num_used++;
         }
+        new(&get_slots()[slot]) T(value);
+        get_occupied_bits()[slot / 64] |= (uint64_t)1 << (slot % 64);
+        num_live_slots++;
         return slot;
     }
 
+    // @returns handle to the new item, or `INVALID_HANDLE` when the pool is full.
+    Handle put_handle(const T& value) {
+        static_assert(GENERATIONAL, "Handles are only supported in generational pools");
+        const int slot = put(value);
+        if(slot < 0) return INVALID_HANDLE;
+        Handle handle = {(INDEX)slot, get_generations()[slot]};
+        return handle;
+    }
+
     void remove(const int slot) {
+        if(!is_occupied(slot)) return;
+        get_slots()[slot].~T();
+        get_occupied_bits()[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+        // Invalidate all handles to this slot.
+        if(GENERATIONAL) get_generations()[slot]++;
+        num_live_slots--;
+        if(trim_mode) {
+            _push_block_free_slot((INDEX)slot);
+            return;
+        }
         *_slot_index_ptr(slot) = first_free_slot;
         first_free_slot = slot;
     }
-};
\ No newline at end of file
+
+    // Decommit the pages of all completely free blocks. Only works in trim mode.
+    // @returns number of decommited blocks.
+    int trim() {
+        int num_trimmed = 0;
+        for(INDEX block = first_empty_block; block != INVALID_INDEX; block = get_blocks()[block].next) {
+            if(get_blocks()[block].state == BlockState_Empty && _decommit_block(block)) num_trimmed++;
+        }
+        return num_trimmed;
+    }
+
+    // @returns false if the handle was already stale.
+    bool remove(const Handle handle) {
+        if(get(handle) == nullptr) return false;
+        remove(handle.slot);
+        return true;
+    }
+
+    // @returns the first occupied slot which is >= `slot`, or -1 if there isn't any.
+    int next_occupied_slot(const int slot) {
+        if(slot >= (int)head_slot) return -1;
+        const uint64_t* bits = get_occupied_bits();
+        const int num_words = ((int)head_slot + 63) / 64;
+        int word_index = slot / 64;
+        // Mask out the bits below `slot` in the first word.
+        uint64_t word = bits[word_index] & (~(uint64_t)0 << (slot % 64));
+        for(;;) {
+            if(word != 0) return word_index * 64 + vpool__ctz64(word);
+            word_index++;
+            if(word_index >= num_words) return -1;
+            word = bits[word_index];
+        }
+    }
+
+    // Call `fn(slot, item)` for each occupied slot, in order. Whole empty ranges of 64 slots are skipped at once.
+    template<typename FN>
+    void for_each(FN fn) {
+        const uint64_t* bits = get_occupied_bits();
+        const int num_words = ((int)head_slot + 63) / 64;
+        for(int word_index = 0; word_index < num_words; word_index++) {
+            uint64_t word = bits[word_index];
+            while(word != 0) {
+                const int slot = word_index * 64 + vpool__ctz64(word);
+                // Clear the lowest bit first, so `fn` can remove the item.
+                word &= word - 1;
+                fn(slot, get_slots()[slot]);
+            }
+        }
+    }
+
+    void _init_arrays(uint8_t* mem, const int num_slots, const bool trim) {
+        const VMemSize page_size = vmem_get_page_size();
+        const VMemSize slots_bytes = vmem_align_forward((VMemSize)num_slots * sizeof(T), page_size);
+        const VMemSize bits_bytes = vmem_align_forward(((VMemSize)num_slots + 63) / 64 * sizeof(uint64_t), page_size);
+        *this = VPool();
+        arena = vmem_arena_init(mem, slots_bytes);
+        occupied = vmem_arena_init(mem + slots_bytes, bits_bytes);
+        uint8_t* next = mem + slots_bytes + bits_bytes;
+        if(GENERATIONAL) {
+            const VMemSize generations_bytes = vmem_align_forward((VMemSize)num_slots * sizeof(uint32_t), page_size);
+            generations = vmem_arena_init(next, generations_bytes);
+            next += generations_bytes;
+        }
+        if(trim) {
+            trim_mode = true;
+            slots_per_block = calc_slots_per_block();
+            const VMemSize num_blocks = ((VMemSize)num_slots + slots_per_block - 1) / slots_per_block;
+            blocks = vmem_arena_init(next, vmem_align_forward(num_blocks * sizeof(Block), page_size));
+        }
+        max_slots = num_slots;
+    }
+
+    // Commit whole pages, so most puts don't have to call into the arena at all.
+    static bool _commit_bytes(VMemArena* a, const VMemSize num_bytes) {
+        if(num_bytes <= a->commited) return true;
+        VMemSize commited = POLICY::align_to_pages(num_bytes, *a);
+        if(commited > a->size_bytes) commited = a->size_bytes;
+        return vmem_arena_set_commited(a, commited) != 0;
+    }
+
+    bool _commit_slots(const int num_slots) {
+        // Note: new pages of the bitset and generations are zeroed by the system.
+        if(!_commit_bytes(&arena, (VMemSize)num_slots * sizeof(T))) return false;
+        if(!_commit_bytes(&occupied, ((VMemSize)num_slots + 63) / 64 * sizeof(uint64_t))) return false;
+        if(GENERATIONAL) {
+            if(!_commit_bytes(&generations, (VMemSize)num_slots * sizeof(uint32_t))) return false;
+        }
+        if(trim_mode) {
+            const VMemSize num_blocks = ((VMemSize)num_slots + slots_per_block - 1) / slots_per_block;
+            const VMemSize prev_commited = blocks.commited;
+            if(!_commit_bytes(&blocks, num_blocks * sizeof(Block))) return false;
+            // Initialize the new blocks.
+            for(VMemSize i = prev_commited / sizeof(Block); i < blocks.commited / sizeof(Block); i++) {
+                Block block = {INVALID_INDEX, 0, INVALID_INDEX, INVALID_INDEX, BlockState_Full};
+                get_blocks()[i] = block;
+            }
+        }
+        return true;
+    }
+
+    INDEX* _block_list_head(const BlockState state) {
+        return state == BlockState_Partial ? &first_partial_block : &first_empty_block;
+    }
+
+    void _block_list_remove(const INDEX block) {
+        Block* b = &get_blocks()[block];
+        if(b->prev != INVALID_INDEX) {
+            get_blocks()[b->prev].next = b->next;
+        } else {
+            *_block_list_head(b->state) = b->next;
+        }
+        if(b->next != INVALID_INDEX) get_blocks()[b->next].prev = b->prev;
+        b->next = INVALID_INDEX;
+        b->prev = INVALID_INDEX;
+        b->state = BlockState_Full;
+    }
+
+    void _block_list_push(const INDEX block, const BlockState state) {
+        Block* b = &get_blocks()[block];
+        INDEX* head = _block_list_head(state);
+        b->state = state;
+        b->prev = INVALID_INDEX;
+        b->next = *head;
+        if(*head != INVALID_INDEX) get_blocks()[*head].prev = block;
+        *head = block;
+    }
+
+    // Range of whole pages inside of a block. Pages shared with neighboring blocks are never decommited.
+    bool _block_pages(const INDEX block, uint8_t** out_ptr, VMemSize* out_size) {
+        const VMemSize page_size = vmem_get_page_size();
+        const uintptr_t begin = (uintptr_t)arena.mem + (VMemSize)block * slots_per_block * sizeof(T);
+        uintptr_t end = begin + (VMemSize)slots_per_block * sizeof(T);
+        const uintptr_t commited_end = (uintptr_t)arena.mem + vmem_arena_calc_bytes_used_for_size(arena.commited);
+        if(end > commited_end) end = commited_end;
+        const uintptr_t page_begin = vmem_align_forward_fast(begin, (int)page_size);
+        const uintptr_t page_end = vmem_align_backward_fast(end, (int)page_size);
+        if(page_begin >= page_end) return false;
+        *out_ptr = (uint8_t*)page_begin;
+        *out_size = (VMemSize)(page_end - page_begin);
+        return true;
+    }
+
+    bool _decommit_block(const INDEX block) {
+        uint8_t* ptr = nullptr;
+        VMemSize size = 0;
+        if(!_block_pages(block, &ptr, &size)) return false;
+        if(!vmem_decommit(ptr, size)) return false;
+        get_blocks()[block].state = BlockState_Decommited;
+        num_decommited_blocks++;
+        return true;
+    }
+
+    INDEX _pop_block_free_slot() {
+        if(first_partial_block == INVALID_INDEX) {
+            // Reuse a completely free block, only when there are no partially filled ones.
+            const INDEX block = first_empty_block;
+            if(block == INVALID_INDEX) return INVALID_INDEX;
+            Block* b = &get_blocks()[block];
+            if(b->state == BlockState_Decommited) {
+                uint8_t* ptr = nullptr;
+                VMemSize size = 0;
+                _block_pages(block, &ptr, &size);
+                if(!vmem_commit_ex(ptr, size, VMemProtect_ReadWrite, arena.commit_flags)) return INVALID_INDEX;
+                num_decommited_blocks--;
+            }
+            _block_list_remove(block);
+            // Rebuild the free list, the contents of decommited pages are gone.
+            const INDEX first = (INDEX)(block * slots_per_block);
+            INDEX last = (INDEX)(first + slots_per_block);
+            if(last > head_slot) last = head_slot;
+            b->first_free = INVALID_INDEX;
+            for(INDEX slot = last; slot > first; slot--) {
+                *_slot_index_ptr(slot - 1) = b->first_free;
+                b->first_free = slot - 1;
+            }
+            _block_list_push(block, BlockState_Partial);
+        }
+
+        const INDEX block = first_partial_block;
+        Block* b = &get_blocks()[block];
+        const INDEX slot = b->first_free;
+        b->first_free = *_slot_index_ptr(slot);
+        b->num_used++;
+        if(b->first_free == INVALID_INDEX) _block_list_remove(block);
+        return slot;
+    }
+
+    void _push_block_free_slot(const INDEX slot) {
+        const INDEX block = (INDEX)(slot / slots_per_block);
+        Block* b = &get_blocks()[block];
+        *_slot_index_ptr(slot) = b->first_free;
+        b->first_free = slot;
+        b->num_used--;
+        if(b->num_used == 0) {
+            if(b->state == BlockState_Partial) _block_list_remove(block);
+            _block_list_push(block, BlockState_Empty);
+            if(auto_trim) _decommit_block(block);
+        } else if(b->state == BlockState_Full) {
+            _block_list_push(block, BlockState_Partial);
+        }
+    }
+};
+
+template<typename INDEX, typename T, bool GENERATIONAL, typename POLICY>
+constexpr typename VPool<INDEX, T, GENERATIONAL, POLICY>::Handle VPool<INDEX, T, GENERATIONAL, POLICY>::INVALID_HANDLE;
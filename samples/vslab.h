@@ -0,0 +1,388 @@
+#pragma once
+#include "../vmem.h"
+#include <atomic>
+#include <mutex>
+#include <new> // placement new
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Index of the highest set bit. `bits` cannot be 0.
+static inline int vslab__log2(const uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index = 0;
+    _BitScanReverse64(&index, bits);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(bits);
+#endif
+}
+
+struct VSlabAllocator;
+
+// Per-thread state of a `VSlabAllocator`. Each thread allocates from its own slabs without any locks or atomics.
+struct VSlabThreadCache {
+    static constexpr int NUM_CLASSES = 40;
+    static constexpr int MAX_FREE_SLABS = 4;
+    static constexpr uint32_t INVALID_SLAB = (uint32_t)-1;
+
+    VSlabAllocator* allocator = nullptr;
+    // Slab the thread currently allocates from, per size class.
+    uint32_t current[NUM_CLASSES];
+    // List of the other slabs owned by this thread, per size class.
+    uint32_t first_owned[NUM_CLASSES];
+    // Empty slabs which stay commited for reuse.
+    uint32_t free_slabs[MAX_FREE_SLABS];
+    int num_free_slabs = 0;
+};
+
+// General purpose allocator for small objects, a `malloc`/`free` replacement built on virtual memory.
+// Allocations are rounded up to one of the segregated size classes (16B to 32KB), each class allocates from slabs of
+// `SLAB_SIZE` bytes. All slabs are carved from a single reservation, and they are only commited when they're used.
+// Empty slabs are decommited, except for a few cached ones per thread.
+//
+// Slabs are owned by threads (`VSlabThreadCache`), the owner allocates and frees without any synchronization, with
+// an intrusive free list per slab, like the free list in `VPool`. Frees from other threads are pushed onto a lock-free
+// remote free list of the slab, which the owner collects when the slab runs out of free objects.
+// Slabs of a thread which was released with `release_thread_cache` are adopted by other threads.
+// Allocations bigger than `MAX_SIZE` get their own `vmem_alloc` block.
+struct VSlabAllocator {
+    static constexpr VMemSize SLAB_SIZE = 256 * 1024;
+    static constexpr VMemSize MIN_SIZE = 16;
+    static constexpr VMemSize MAX_SIZE = 32 * 1024;
+    static constexpr int NUM_CLASSES = VSlabThreadCache::NUM_CLASSES;
+    static constexpr uint32_t INVALID_SLAB = VSlabThreadCache::INVALID_SLAB;
+    // Header of big allocations, keeps the returned pointer 16 byte aligned.
+    static constexpr VMemSize LARGE_HEADER_SIZE = 16;
+
+    struct Slab {
+        // Objects freed by other threads, collected by the owner.
+        std::atomic<void*> remote_free;
+        std::atomic<VSlabThreadCache*> owner;
+        // Intrusive list of free objects, only accessed by the owner.
+        void* local_free;
+        // Offset of the first object which was never allocated.
+        uint32_t bump;
+        // Number of allocated objects, including the ones in `remote_free`.
+        uint32_t num_used;
+        // Links in the owner's list, or in one of the global lists.
+        uint32_t next;
+        uint32_t prev;
+        uint8_t size_class;
+    };
+
+    // Memory of all the slabs.
+    VMemArena slabs = {};
+    // Array of `Slab`, one per slab in `slabs`. Commited as the slabs are used.
+    VMemArena metadata = {};
+    uint32_t num_slabs = 0;
+    uint32_t max_slabs = 0;
+    // Global lists, protected by `mutex`.
+    std::mutex mutex;
+    uint32_t first_free_slab = INVALID_SLAB;
+    uint32_t first_abandoned[NUM_CLASSES];
+    // Number of bytes in big allocations.
+    std::atomic<VMemSize> large_bytes;
+
+    // Size of objects in a size class. 16B steps up to 128B, then 4 classes per power of 2.
+    static VMemSize class_size(const int size_class) {
+        if(size_class < 8) return (VMemSize)(size_class + 1) * 16;
+        const int power = 7 + (size_class - 8) / 4;
+        return ((VMemSize)1 << power) + (VMemSize)((size_class - 8) % 4 + 1) * ((VMemSize)1 << (power - 2));
+    }
+
+    // @returns the smallest size class which fits `size`. `size` must be at most `MAX_SIZE`.
+    static int calc_size_class(VMemSize size) {
+        if(size <= 128) return size == 0 ? 0 : (int)((size + 15) / 16) - 1;
+        const int power = vslab__log2(size - 1);
+        return 8 + (power - 7) * 4 + (int)((size - 1 - ((VMemSize)1 << power)) >> (power - 2));
+    }
+
+    // @param reserve_bytes: size of the address space for all the slabs, rounded down to `SLAB_SIZE`.
+    bool init_alloc(const VMemSize reserve_bytes) {
+        max_slabs = (uint32_t)(reserve_bytes / SLAB_SIZE);
+        if(max_slabs == 0) return false;
+        slabs = vmem_arena_init_alloc((VMemSize)max_slabs * SLAB_SIZE);
+        metadata = vmem_arena_init_alloc((VMemSize)max_slabs * sizeof(Slab));
+        // Only the metadata is commited with the arena, slabs are commited one by one.
+        metadata.commit_granularity = 0;
+        num_slabs = 0;
+        first_free_slab = INVALID_SLAB;
+        for(int i = 0; i < NUM_CLASSES; i++) first_abandoned[i] = INVALID_SLAB;
+        large_bytes = 0;
+        return vmem_arena_is_valid(&slabs) && vmem_arena_is_valid(&metadata);
+    }
+
+    // Frees all the memory, except for big allocations. No thread can use the allocator anymore.
+    void deinit_dealloc() {
+        vmem_arena_deinit_dealloc(&slabs);
+        vmem_arena_deinit_dealloc(&metadata);
+        num_slabs = 0;
+        max_slabs = 0;
+    }
+
+    void init_thread_cache(VSlabThreadCache* cache) {
+        cache->allocator = this;
+        for(int i = 0; i < NUM_CLASSES; i++) {
+            cache->current[i] = INVALID_SLAB;
+            cache->first_owned[i] = INVALID_SLAB;
+        }
+        cache->num_free_slabs = 0;
+    }
+
+    // Give up the slabs a thread owns, e.g. when the thread exits. Empty slabs are decommited, and the others are
+    // adopted by threads which need a slab of the same size class.
+    void release_thread_cache(VSlabThreadCache* cache) {
+        for(int c = 0; c < NUM_CLASSES; c++) {
+            if(cache->current[c] != INVALID_SLAB) _list_push(&cache->first_owned[c], cache->current[c]);
+            cache->current[c] = INVALID_SLAB;
+            while(cache->first_owned[c] != INVALID_SLAB) {
+                const uint32_t index = cache->first_owned[c];
+                _list_remove(&cache->first_owned[c], index);
+                Slab* slab = _get_slab(index);
+                _collect_remote_free(slab);
+                slab->owner.store(nullptr, std::memory_order_release);
+                std::lock_guard<std::mutex> lock(mutex);
+                if(slab->num_used == 0) {
+                    _free_slab_locked(index);
+                } else {
+                    _list_push(&first_abandoned[c], index);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for(int i = 0; i < cache->num_free_slabs; i++) _free_slab_locked(cache->free_slabs[i]);
+        cache->num_free_slabs = 0;
+        cache->allocator = nullptr;
+    }
+
+    // @returns 16 byte aligned memory of at least `size` bytes, or null when the allocator is out of memory.
+    void* alloc(VSlabThreadCache* cache, const VMemSize size) {
+        if(size > MAX_SIZE) return _alloc_large(size);
+        const int size_class = calc_size_class(size);
+        for(;;) {
+            const uint32_t index = cache->current[size_class];
+            if(index != INVALID_SLAB) {
+                void* result = _pop_object(_get_slab(index), index);
+                if(result) return result;
+            }
+            const uint32_t next = _find_slab(cache, size_class);
+            if(next == INVALID_SLAB) return nullptr;
+            if(index != INVALID_SLAB) _list_push(&cache->first_owned[size_class], index);
+            cache->current[size_class] = next;
+        }
+    }
+
+    // Free memory allocated by any thread.
+    void dealloc(VSlabThreadCache* cache, void* ptr) {
+        if(ptr == nullptr) return;
+        if(!_is_slab_memory(ptr)) {
+            _dealloc_large(ptr);
+            return;
+        }
+        const uint32_t index = _slab_index(ptr);
+        Slab* slab = _get_slab(index);
+        if(slab->owner.load(std::memory_order_acquire) != cache) {
+            // Lock-free push onto the remote free list.
+            void* head = slab->remote_free.load(std::memory_order_relaxed);
+            do {
+                *(void**)ptr = head;
+            } while(!slab->remote_free.compare_exchange_weak(head, ptr, std::memory_order_release));
+            return;
+        }
+        *(void**)ptr = slab->local_free;
+        slab->local_free = ptr;
+        slab->num_used--;
+        if(slab->num_used == 0 && cache->current[slab->size_class] != index) {
+            _list_remove(&cache->first_owned[slab->size_class], index);
+            _release_slab(cache, index);
+        }
+    }
+
+    // Same as `alloc`, but uses a thread-local cache. Only one allocator per thread should use this.
+    // Call `release_thread_cache(get_thread_cache())` before the thread exits. Otherwise its slabs are never reused,
+    // and a cache of a new thread at the same address would be taken for their owner.
+    void* alloc(const VMemSize size) {
+        return alloc(get_thread_cache(), size);
+    }
+
+    void dealloc(void* ptr) {
+        dealloc(get_thread_cache(), ptr);
+    }
+
+    VSlabThreadCache* get_thread_cache() {
+        static thread_local VSlabThreadCache cache;
+        if(cache.allocator != this) init_thread_cache(&cache);
+        return &cache;
+    }
+
+    // @returns number of bytes which can be used in the allocation.
+    VMemSize usable_size(void* ptr) {
+        if(!_is_slab_memory(ptr)) return *(VMemSize*)((uint8_t*)ptr - LARGE_HEADER_SIZE) - LARGE_HEADER_SIZE;
+        return class_size(_get_slab(_slab_index(ptr))->size_class);
+    }
+
+    bool _is_slab_memory(const void* ptr) {
+        return (const uint8_t*)ptr >= slabs.mem && (const uint8_t*)ptr < slabs.mem + (VMemSize)max_slabs * SLAB_SIZE;
+    }
+
+    uint32_t _slab_index(const void* ptr) {
+        return (uint32_t)(((const uint8_t*)ptr - slabs.mem) / SLAB_SIZE);
+    }
+
+    Slab* _get_slab(const uint32_t index) {
+        return (Slab*)metadata.mem + index;
+    }
+
+    uint8_t* _get_slab_memory(const uint32_t index) {
+        return slabs.mem + (VMemSize)index * SLAB_SIZE;
+    }
+
+    void _list_push(uint32_t* first, const uint32_t index) {
+        Slab* slab = _get_slab(index);
+        slab->prev = INVALID_SLAB;
+        slab->next = *first;
+        if(*first != INVALID_SLAB) _get_slab(*first)->prev = index;
+        *first = index;
+    }
+
+    void _list_remove(uint32_t* first, const uint32_t index) {
+        Slab* slab = _get_slab(index);
+        if(slab->prev != INVALID_SLAB) {
+            _get_slab(slab->prev)->next = slab->next;
+        } else {
+            *first = slab->next;
+        }
+        if(slab->next != INVALID_SLAB) _get_slab(slab->next)->prev = slab->prev;
+    }
+
+    // Move the objects freed by other threads to the local free list.
+    // @returns number of collected objects.
+    uint32_t _collect_remote_free(Slab* slab) {
+        void* list = slab->remote_free.exchange(nullptr, std::memory_order_acquire);
+        uint32_t count = 0;
+        while(list) {
+            void* next = *(void**)list;
+            *(void**)list = slab->local_free;
+            slab->local_free = list;
+            list = next;
+            count++;
+        }
+        slab->num_used -= count;
+        return count;
+    }
+
+    void* _pop_object(Slab* slab, const uint32_t index) {
+        if(slab->local_free == nullptr && slab->remote_free.load(std::memory_order_relaxed) != nullptr) {
+            _collect_remote_free(slab);
+        }
+        void* result = slab->local_free;
+        if(result) {
+            slab->local_free = *(void**)result;
+        } else {
+            const VMemSize size = class_size(slab->size_class);
+            if(slab->bump + size > SLAB_SIZE) return nullptr;
+            result = _get_slab_memory(index) + slab->bump;
+            slab->bump += (uint32_t)size;
+        }
+        slab->num_used++;
+        return result;
+    }
+
+    // Find a slab with free objects for `size_class`: an owned slab which got remote frees, an abandoned slab, or a new
+    // one.
+    uint32_t _find_slab(VSlabThreadCache* cache, const int size_class) {
+        // Only look at a few slabs, so allocation stays O(1) even with many full slabs.
+        uint32_t index = cache->first_owned[size_class];
+        for(int i = 0; i < 4 && index != INVALID_SLAB; i++) {
+            Slab* slab = _get_slab(index);
+            const uint32_t next = slab->next;
+            if(slab->remote_free.load(std::memory_order_relaxed) != nullptr) {
+                _collect_remote_free(slab);
+                _list_remove(&cache->first_owned[size_class], index);
+                return index;
+            }
+            index = next;
+        }
+
+        if(cache->num_free_slabs > 0) {
+            index = cache->free_slabs[--cache->num_free_slabs];
+        } else {
+            std::lock_guard<std::mutex> lock(mutex);
+            index = first_abandoned[size_class];
+            if(index != INVALID_SLAB) {
+                _list_remove(&first_abandoned[size_class], index);
+                Slab* slab = _get_slab(index);
+                slab->owner.store(cache, std::memory_order_release);
+                _collect_remote_free(slab);
+                return index;
+            }
+            index = _new_slab_locked();
+            if(index == INVALID_SLAB) return INVALID_SLAB;
+        }
+
+        Slab* slab = _get_slab(index);
+        slab->remote_free.store(nullptr, std::memory_order_relaxed);
+        slab->local_free = nullptr;
+        slab->bump = 0;
+        slab->num_used = 0;
+        slab->size_class = (uint8_t)size_class;
+        slab->owner.store(cache, std::memory_order_release);
+        return index;
+    }
+
+    // Take a slab from the global free list (recommits it) or from the unused part of the reservation.
+    uint32_t _new_slab_locked() {
+        uint32_t index = first_free_slab;
+        if(index != INVALID_SLAB) {
+            _list_remove(&first_free_slab, index);
+            if(!vmem_commit_ex(_get_slab_memory(index), SLAB_SIZE, VMemProtect_ReadWrite, slabs.commit_flags)) {
+                _list_push(&first_free_slab, index);
+                return INVALID_SLAB;
+            }
+            return index;
+        }
+        if(num_slabs >= max_slabs) return INVALID_SLAB;
+        if(!vmem_arena_set_commited(&slabs, (VMemSize)(num_slabs + 1) * SLAB_SIZE)) return INVALID_SLAB;
+        if(!vmem_arena_set_commited(&metadata, (VMemSize)(num_slabs + 1) * sizeof(Slab))) return INVALID_SLAB;
+        index = num_slabs++;
+        Slab* slab = new(_get_slab(index)) Slab();
+        slab->remote_free.store(nullptr, std::memory_order_relaxed);
+        slab->owner.store(nullptr, std::memory_order_relaxed);
+        return index;
+    }
+
+    // Decommit the slab and put it onto the global free list.
+    void _free_slab_locked(const uint32_t index) {
+        _get_slab(index)->owner.store(nullptr, std::memory_order_relaxed);
+        vmem_decommit(_get_slab_memory(index), SLAB_SIZE);
+        _list_push(&first_free_slab, index);
+    }
+
+    // Return an empty slab, the thread keeps a few commited ones.
+    void _release_slab(VSlabThreadCache* cache, const uint32_t index) {
+        if(cache->num_free_slabs < VSlabThreadCache::MAX_FREE_SLABS) {
+            cache->free_slabs[cache->num_free_slabs++] = index;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        _free_slab_locked(index);
+    }
+
+    void* _alloc_large(const VMemSize size) {
+        const VMemSize alloc_size = vmem_align_forward(size + LARGE_HEADER_SIZE, vmem_get_page_size());
+        uint8_t* mem = (uint8_t*)vmem_alloc_commited(alloc_size);
+        if(mem == nullptr) return nullptr;
+        *(VMemSize*)mem = alloc_size;
+        large_bytes += alloc_size;
+        return mem + LARGE_HEADER_SIZE;
+    }
+
+    void _dealloc_large(void* ptr) {
+        uint8_t* mem = (uint8_t*)ptr - LARGE_HEADER_SIZE;
+        const VMemSize alloc_size = *(VMemSize*)mem;
+        large_bytes -= alloc_size;
+        vmem_dealloc(mem, alloc_size);
+    }
+};
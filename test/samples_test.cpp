@@ -5,8 +5,12 @@
 #include "utest.h"
 
 #include "../samples/vpool.h"
+#include "../samples/varena.h"
 #include "../samples/varray.h"
+#include "../samples/vslab.h"
 #include <stdio.h>
+#include <thread>
+#include <vector>
 
 UTEST(vpool, common) {
     VPool<int, int> p = {};
@@ -44,6 +48,110 @@ UTEST(vpool, init_vmem) {
     vmem_dealloc(ptr, size);
 }
 
+UTEST(vpool, generational) {
+    VPool<uint32_t, float, true> p = {};
+    p.init_alloc(1024);
+    ASSERT_TRUE(p.is_valid());
+
+    auto a = p.put_handle(1.0f);
+    auto b = p.put_handle(2.0f);
+    ASSERT_EQ(*p.get(a), 1.0f);
+    ASSERT_EQ(*p.get(b), 2.0f);
+
+    ASSERT_TRUE(p.remove(a));
+    ASSERT_FALSE(p.get(a));
+    ASSERT_FALSE(p.remove(a));
+
+    // The slot is reused, but the old handle stays invalid.
+    auto c = p.put_handle(3.0f);
+    ASSERT_EQ(c.slot, a.slot);
+    ASSERT_NE(c.generation, a.generation);
+    ASSERT_FALSE(p.get(a));
+    ASSERT_EQ(*p.get(c), 3.0f);
+    ASSERT_EQ(p.num_live_slots, 2);
+
+    p.deinit_dealloc();
+    ASSERT_FALSE(p.is_valid());
+}
+
+UTEST(vpool, iterate) {
+    VPool<int, int> p = {};
+    p.init_alloc(10000);
+    for(int i = 0; i < 10000; i++) {
+        ASSERT_EQ(p.put(i), i);
+    }
+    ASSERT_EQ(p.put(0), -1);
+
+    // Leave only every 1000th slot alive.
+    for(int i = 0; i < 10000; i++) {
+        if(i % 1000 != 0) p.remove(i);
+    }
+    ASSERT_EQ(p.num_live_slots, 10);
+
+    int num_visited = 0;
+    p.for_each([&](const int slot, int& value) {
+        ASSERT_EQ(slot, value);
+        ASSERT_EQ(slot, num_visited * 1000);
+        num_visited++;
+    });
+    ASSERT_EQ(num_visited, 10);
+
+    ASSERT_EQ(p.next_occupied_slot(0), 0);
+    ASSERT_EQ(p.next_occupied_slot(1), 1000);
+    ASSERT_EQ(p.next_occupied_slot(9001), -1);
+    ASSERT_FALSE(p.get(1));
+    ASSERT_EQ(*p.get(2000), 2000);
+
+    p.deinit_dealloc();
+}
+
+UTEST(vpool, trim) {
+    struct Item {
+        int values[16];
+    };
+    VPool<int, Item> p = {};
+    p.init_alloc(100000, true);
+    ASSERT_TRUE(p.is_valid());
+    const int per_block = p.slots_per_block;
+    ASSERT_GT(per_block, 0);
+
+    const int num = per_block * 8;
+    for(int i = 0; i < num; i++) {
+        Item item = {};
+        item.values[0] = i;
+        ASSERT_EQ(p.put(item), i);
+    }
+
+    // Free the first 4 blocks completely and one slot in the last block.
+    for(int i = 0; i < per_block * 4; i++) {
+        p.remove(i);
+    }
+    p.remove(num - 1);
+    ASSERT_EQ(p.trim(), 4);
+    ASSERT_EQ(p.num_decommited_blocks, 4);
+
+    // Partially filled blocks are reused first.
+    Item item = {};
+    ASSERT_EQ(p.put(item), num - 1);
+    ASSERT_EQ(p.num_decommited_blocks, 4);
+
+    // Then the decommited blocks get recommited.
+    const int slot = p.put(item);
+    ASSERT_LT(slot, per_block * 4);
+    ASSERT_EQ(p.num_decommited_blocks, 3);
+    p.get(slot)->values[15] = 123;
+    for(int i = per_block * 4; i < num; i++) {
+        ASSERT_EQ(p.get(i)->values[0], i == num - 1 ? 0 : i);
+    }
+
+    p.auto_trim = true;
+    p.remove(slot);
+    ASSERT_EQ(p.num_decommited_blocks, 4);
+    ASSERT_EQ(p.num_live_slots, per_block * 4);
+
+    p.deinit_dealloc();
+}
+
 UTEST(varray, common) {
     VArray<float> arr = {};
     arr.init_alloc(1024 * 32);
@@ -64,6 +172,309 @@ UTEST(varray, common) {
     ASSERT_FALSE(arr.is_valid());
 }
 
+UTEST(varray, many) {
+    VArray<int> arr = {};
+    arr.init_alloc(1024 * 1024);
+    ASSERT_TRUE(arr.is_valid());
+
+    for(int i = 0; i < 1024 * 1024; i++) {
+        ASSERT_EQ(arr.put(i), i);
+    }
+    // The array is full.
+    ASSERT_EQ(arr.put(0), -1);
+    ASSERT_EQ(arr.len, 1024 * 1024);
+    ASSERT_EQ(arr.capacity, 1024 * 1024);
+
+    int expected = 0;
+    for(int value : arr) {
+        ASSERT_EQ(value, expected);
+        expected++;
+    }
+
+    arr.deinit_dealloc();
+}
+
+UTEST(varray, batch) {
+    VArray<int> arr = {};
+    arr.init_alloc(1024 * 32);
+    ASSERT_TRUE(arr.reserve(1000));
+    ASSERT_GE(arr.capacity, 1000);
+    const int capacity = arr.capacity;
+
+    const int values[] = {1, 2, 3, 4};
+    ASSERT_EQ(arr.append(values, 4), 0);
+    int* items = arr.push_n(10);
+    ASSERT_TRUE(items);
+    ASSERT_EQ(items[9], 0);
+    ASSERT_EQ(arr.len, 14);
+    ASSERT_EQ(arr[3], 4);
+    // Nothing had to be commited.
+    ASSERT_EQ(arr.capacity, capacity);
+
+    ASSERT_TRUE(arr.resize(1024 * 16));
+    ASSERT_EQ(arr.len, 1024 * 16);
+    ASSERT_EQ(arr[1024 * 16 - 1], 0);
+
+    // Shrinking decommits the memory.
+    ASSERT_TRUE(arr.resize(2));
+    ASSERT_EQ(arr.len, 2);
+    ASSERT_EQ(arr[1], 2);
+    ASSERT_LT(arr.capacity, 1024 * 16);
+
+    ASSERT_FALSE(arr.reserve(1024 * 32 + 1));
+    arr.deinit_dealloc();
+}
+
+struct TestMoveOnly {
+    int* counter = nullptr;
+
+    TestMoveOnly() = default;
+
+    explicit TestMoveOnly(int* c) : counter(c) {
+    }
+
+    TestMoveOnly(const TestMoveOnly&) = delete;
+    TestMoveOnly& operator=(const TestMoveOnly&) = delete;
+
+    TestMoveOnly(TestMoveOnly&& other) : counter(other.counter) {
+        other.counter = nullptr;
+    }
+
+    TestMoveOnly& operator=(TestMoveOnly&& other) {
+        if(counter) (*counter)--;
+        counter = other.counter;
+        other.counter = nullptr;
+        return *this;
+    }
+
+    ~TestMoveOnly() {
+        if(counter) (*counter)--;
+    }
+};
+
+UTEST(varray, move_only) {
+    int counter = 0;
+    VArray<TestMoveOnly> arr = {};
+    arr.init_alloc(1024);
+
+    for(int i = 0; i < 100; i++) {
+        counter++;
+        ASSERT_EQ(arr.emplace(&counter), i);
+    }
+    counter++;
+    arr.put(TestMoveOnly(&counter));
+    ASSERT_EQ(counter, 101);
+
+    arr.swap_remove(0);
+    ASSERT_EQ(counter, 100);
+    ASSERT_EQ(arr.len, 100);
+    ASSERT_TRUE(arr[0].counter == &counter);
+
+    arr.resize(10);
+    ASSERT_EQ(counter, 10);
+    arr.deinit_dealloc();
+    ASSERT_EQ(counter, 0);
+}
+
+UTEST(varray, unbounded) {
+    VArray<int> arr = {};
+    arr.init_alloc(16, true);
+    const VMemSize initial_size = arr.arena.size_bytes;
+    for(int i = 0; i < 1000000; i++) {
+        ASSERT_EQ(arr.put(i), i);
+    }
+    ASSERT_GT(arr.arena.size_bytes, initial_size);
+    for(int i = 0; i < 1000000; i++) {
+        ASSERT_EQ(arr[i], i);
+    }
+    arr.deinit_dealloc();
+
+    // Bounded arrays still fail when full.
+    VArray<int> bounded = {};
+    bounded.init_alloc(16);
+    int num_added = 0;
+    while(bounded.put(num_added) != -1) num_added++;
+    ASSERT_EQ(num_added, bounded.max_items());
+    bounded.deinit_dealloc();
+}
+
+UTEST(varena, policy) {
+    typedef VArenaPolicy<4096, 64 * 1024, false, VDecommitKeep<8192>> Policy;
+    static_assert(Policy::align_to_pages(1) == 4096, "");
+    static_assert(Policy::align_to_commit_granularity(64 * 1024 + 1) == 128 * 1024, "");
+
+    VArenaT<Policy> arena = {};
+    ASSERT_TRUE(arena.init_alloc(1024 * 1024));
+    int* items = arena.push_items<int>(1000);
+    ASSERT_TRUE(items != nullptr);
+    ASSERT_TRUE((uintptr_t)items % alignof(int) == 0);
+    for(int i = 0; i < 1000; i++) items[i] = i;
+    ASSERT_EQ(arena.arena.commited, 64 * 1024);
+
+    // Interop with the C API
+    uint8_t* byte = (uint8_t*)vmem_arena_push(&arena.arena, 1, 1);
+    ASSERT_TRUE(byte == (uint8_t*)items + 1000 * sizeof(int));
+    ASSERT_TRUE(((uintptr_t)arena.push<64>(100 * 1024) & 63) == 0);
+    ASSERT_EQ(arena.arena.commited, 128 * 1024);
+    ASSERT_TRUE(arena.push(1024 * 1024) == nullptr);
+
+    arena.reset();
+    ASSERT_EQ(arena.arena.pos, 0);
+    ASSERT_EQ(arena.arena.commited, 8192);
+    arena.deinit_dealloc();
+
+    VArray<int, Policy> arr = {};
+    arr.init_alloc(1024 * 1024);
+    for(int i = 0; i < 100000; i++) ASSERT_EQ(arr.put(i), i);
+    ASSERT_TRUE(arr.arena.commited % 4096 == 0);
+    arr.deinit_dealloc();
+
+    VPool<int, int, false, Policy> pool = {};
+    pool.init_alloc(100000);
+    for(int i = 0; i < 100000; i++) ASSERT_EQ(pool.put(i), i);
+    pool.remove(5);
+    ASSERT_EQ(pool.put(5), 5);
+    ASSERT_TRUE(pool.arena.commited % 4096 == 0);
+    pool.deinit_dealloc();
+}
+
+UTEST(varena, dynamic_policy) {
+    VArenaT<VArenaDynamicPolicy> arena = {};
+    ASSERT_TRUE(arena.init_alloc(1024 * 1024));
+    arena.arena.commit_granularity = 16 * 1024;
+    ASSERT_TRUE(arena.push(1) != nullptr);
+    ASSERT_EQ(arena.arena.commited, 16 * 1024);
+    ASSERT_TRUE(arena.push(16 * 1024) != nullptr);
+    ASSERT_EQ(arena.arena.commited, 32 * 1024);
+    arena.reset();
+    ASSERT_EQ(arena.arena.pos, 0);
+    arena.deinit_dealloc();
+
+    VArenaT<VArenaDynamicPolicy, true> atomic_arena = {};
+    ASSERT_TRUE(atomic_arena.init_alloc(1024 * 1024));
+    ASSERT_NE(atomic_arena.arena.commit_granularity, 0);
+    ASSERT_TRUE(atomic_arena.push(1) != nullptr);
+    ASSERT_GE(atomic_arena.arena.commited, 1);
+    const VMemSize commited = atomic_arena.arena.commited;
+    atomic_arena.reset();
+    ASSERT_EQ(atomic_arena.arena.pos, 0);
+    ASSERT_EQ(atomic_arena.arena.commited, commited);
+    atomic_arena.deinit_dealloc();
+}
+
+UTEST(varena, thread_safe) {
+    typedef VArenaPolicy<4096, 64 * 1024, true, VDecommitAll> Policy;
+    VArenaT<Policy> arena = {};
+    ASSERT_TRUE(arena.init_alloc(64 * 1024 * 1024));
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&arena]() {
+            for(int i = 0; i < 10000; i++) {
+                uint64_t* item = arena.push_items<uint64_t>(4);
+                item[0] = item[3] = (uint64_t)i;
+            }
+        });
+    }
+    for(std::thread& thread : threads) thread.join();
+    ASSERT_GE(arena.arena.pos, 4 * 10000 * 4 * sizeof(uint64_t));
+    arena.reset();
+    ASSERT_EQ(arena.arena.pos, 0);
+    ASSERT_EQ(arena.arena.commited, 0);
+    arena.deinit_dealloc();
+}
+
+UTEST(vslab, size_classes) {
+    int prev_class = 0;
+    for(VMemSize size = 1; size <= VSlabAllocator::MAX_SIZE; size++) {
+        const int size_class = VSlabAllocator::calc_size_class(size);
+        ASSERT_LT(size_class, VSlabAllocator::NUM_CLASSES);
+        ASSERT_GE(VSlabAllocator::class_size(size_class), size);
+        if(size_class > 0) ASSERT_LT(VSlabAllocator::class_size(size_class - 1), size);
+        ASSERT_GE(size_class, prev_class);
+        prev_class = size_class;
+    }
+    ASSERT_EQ(VSlabAllocator::class_size(VSlabAllocator::NUM_CLASSES - 1), VSlabAllocator::MAX_SIZE);
+}
+
+UTEST(vslab, common) {
+    VSlabAllocator slab;
+    ASSERT_TRUE(slab.init_alloc(256 * VSlabAllocator::SLAB_SIZE));
+    VSlabThreadCache cache;
+    slab.init_thread_cache(&cache);
+
+    std::vector<uint8_t*> ptrs;
+    for(int i = 0; i < 10000; i++) {
+        const VMemSize size = 1 + (VMemSize)(i * 7919) % 2000;
+        uint8_t* ptr = (uint8_t*)slab.alloc(&cache, size);
+        ASSERT_TRUE(ptr);
+        ASSERT_TRUE(vmem_is_aligned((uintptr_t)ptr, 16));
+        ASSERT_GE(slab.usable_size(ptr), size);
+        memset(ptr, (int)(i & 0xff), size);
+        ptrs.push_back(ptr);
+    }
+    for(int i = 0; i < 10000; i++) {
+        ASSERT_EQ(ptrs[i][0], (uint8_t)(i & 0xff));
+        slab.dealloc(&cache, ptrs[i]);
+    }
+
+    // The slabs are reused.
+    const uint32_t num_slabs = slab.num_slabs;
+    for(int i = 0; i < 10000; i++) ptrs[i] = (uint8_t*)slab.alloc(&cache, 1 + (VMemSize)(i * 7919) % 2000);
+    ASSERT_EQ(slab.num_slabs, num_slabs);
+    for(int i = 0; i < 10000; i++) slab.dealloc(&cache, ptrs[i]);
+
+    void* large = slab.alloc(&cache, 1024 * 1024);
+    ASSERT_TRUE(large);
+    ASSERT_GE(slab.usable_size(large), 1024 * 1024);
+    memset(large, 1, 1024 * 1024);
+    slab.dealloc(&cache, large);
+    ASSERT_EQ(slab.large_bytes.load(), 0);
+
+    slab.release_thread_cache(&cache);
+    slab.deinit_dealloc();
+}
+
+UTEST(vslab, remote_free) {
+    VSlabAllocator slab;
+    ASSERT_TRUE(slab.init_alloc(1024 * VSlabAllocator::SLAB_SIZE));
+    const int num_threads = 4;
+    const int num_allocs = 20000;
+    std::vector<std::vector<void*>> ptrs(num_threads);
+
+    for(int round = 0; round < 3; round++) {
+        // Each thread allocates, then frees the allocations of the next thread.
+        std::vector<std::thread> threads;
+        for(int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                for(int i = 0; i < num_allocs; i++) {
+                    int* ptr = (int*)slab.alloc(16 + (VMemSize)(i % 64) * 8);
+                    *ptr = t;
+                    ptrs[t].push_back(ptr);
+                }
+                slab.release_thread_cache(slab.get_thread_cache());
+            });
+        }
+        for(std::thread& thread : threads) thread.join();
+        threads.clear();
+        for(int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                std::vector<void*>& other = ptrs[(t + 1) % num_threads];
+                for(void* ptr : other) {
+                    if(*(int*)ptr != (t + 1) % num_threads) abort();
+                    slab.dealloc(ptr);
+                }
+                other.clear();
+                slab.release_thread_cache(slab.get_thread_cache());
+            });
+        }
+        for(std::thread& thread : threads) thread.join();
+    }
+    // Abandoned and freed slabs were reused in later rounds.
+    const uint32_t max_slabs_per_round = num_threads * (num_allocs * 300 / VSlabAllocator::SLAB_SIZE + 64);
+    ASSERT_LT(slab.num_slabs, 2 * max_slabs_per_round);
+    slab.deinit_dealloc();
+}
+
 UTEST_STATE();
 
 int main(const int argc, const char* argv[]) {
@@ -0,0 +1,279 @@
+// Benchmarks for the hot paths of vmem.h and the samples.
+// Each benchmark records many samples and prints ns/op percentiles, and page faults per op where available.
+// Usage: vmem_bench [name filter]
+#define VMEM_IMPLEMENTATION
+#include "../vmem.h"
+
+#include "../samples/varray.h"
+#include "../samples/vpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+static const char* g_filter = nullptr;
+
+static uint64_t bench_now_ns() {
+    using namespace std::chrono;
+    return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Minor + major page faults of the process so far. 0 when not supported.
+static uint64_t bench_page_faults() {
+#if defined(__linux__)
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)(usage.ru_minflt + usage.ru_majflt);
+#else
+    return 0;
+#endif
+}
+
+static bool bench_enabled(const char* name) {
+    return g_filter == nullptr || strstr(name, g_filter) != nullptr;
+}
+
+static void bench_print_header() {
+    printf(
+        "%-44s %10s %10s %10s %10s %10s %10s\n",
+        "benchmark",
+        "ops",
+        "p50 ns",
+        "p90 ns",
+        "p99 ns",
+        "max ns",
+        "faults/op");
+}
+
+// Print percentiles of `samples`, where each sample is the average ns/op of `batch` operations.
+static void bench_report(const char* name, std::vector<double>& samples, const int batch, const uint64_t faults) {
+    std::sort(samples.begin(), samples.end());
+    const size_t n = samples.size();
+    const double num_ops = (double)n * batch;
+    printf(
+        "%-44s %10.0f %10.1f %10.1f %10.1f %10.1f %10.3f\n",
+        name,
+        num_ops,
+        samples[n / 2],
+        samples[n * 90 / 100],
+        samples[n * 99 / 100],
+        samples[n - 1],
+        (double)faults / num_ops);
+}
+
+// Run `op(i)` `num_samples * batch` times. Operations which are too fast to time one by one are timed in batches.
+template<typename OP>
+static void bench_run(const char* name, const int num_samples, const int batch, OP op) {
+    if(!bench_enabled(name)) return;
+    std::vector<double> samples;
+    samples.reserve(num_samples);
+    const uint64_t faults_begin = bench_page_faults();
+    int i = 0;
+    for(int sample = 0; sample < num_samples; sample++) {
+        const uint64_t begin = bench_now_ns();
+        for(int j = 0; j < batch; j++, i++) {
+            op(i);
+        }
+        samples.push_back((double)(bench_now_ns() - begin) / batch);
+    }
+    bench_report(name, samples, batch, bench_page_faults() - faults_begin);
+}
+
+static void bench_reserve() {
+    const VMemSize size = 1024 * 1024;
+    bench_run("reserve + release 1MB", 10000, 1, [&](int) {
+        void* ptr = vmem_alloc(size);
+        vmem_dealloc(ptr, size);
+    });
+}
+
+static void bench_commit() {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = 64 * 1024 * 1024;
+    uint8_t* ptr = (uint8_t*)vmem_alloc(size);
+    const int num_pages = (int)(size / page_size);
+
+    bench_run("commit page", num_pages, 1, [&](int i) { vmem_commit(ptr + i * page_size, page_size); });
+    bench_run("decommit page", num_pages, 1, [&](int i) { vmem_decommit(ptr + i * page_size, page_size); });
+    bench_run("commit page keep protect", num_pages, 1, [&](int i) {
+        vmem_commit_ex(ptr + i * page_size, page_size, VMemProtect_ReadWrite, VMemCommitFlag_KeepProtect);
+    });
+    bench_run("commit + first touch page", num_pages, 1, [&](int i) {
+        vmem_commit(ptr + i * page_size, page_size);
+        ptr[i * page_size] = 1;
+    });
+    bench_run("decommit touched page", num_pages, 1, [&](int i) { vmem_decommit(ptr + i * page_size, page_size); });
+    bench_run("commit populate page", num_pages / 4, 1, [&](int i) {
+        vmem_commit_ex(ptr + i * page_size, page_size, VMemProtect_ReadWrite, VMemCommitFlag_Populate);
+    });
+    bench_run("lazy decommit populated page", num_pages / 4, 1, [&](int i) {
+        vmem_decommit_ex(ptr + i * page_size, page_size, VMemCommitFlag_LazyDecommit);
+    });
+
+    vmem_dealloc(ptr, size);
+}
+
+static void bench_arena() {
+    VMemArena arena = vmem_arena_init_alloc(1024 * 1024 * 1024);
+    bench_run("arena push 64B", 100000, 64, [&](int) { vmem_arena_push(&arena, 64, 16); });
+    vmem_arena_deinit_dealloc(&arena);
+
+    VMemAtomicArena atomic = {};
+    vmem_atomic_arena_init_alloc(&atomic, 1024 * 1024 * 1024, VMemAllocFlag_None);
+    bench_run("atomic arena push 64B", 100000, 64, [&](int) { vmem_atomic_arena_push(&atomic, 64, 16); });
+    vmem_atomic_arena_reset(&atomic);
+    bench_run("thread arena push 64B", 100000, 64, [&](int) { vmem_thread_arena_push(&atomic, 64, 16); });
+    vmem_atomic_arena_deinit_dealloc(&atomic);
+}
+
+static void bench_samples() {
+    {
+        VArray<int> arr = {};
+        arr.init_alloc(64 * 1024 * 1024);
+        bench_run("VArray put int", 100000, 64, [&](int i) { arr.put(i); });
+        arr.deinit_dealloc();
+    }
+    {
+        VPool<int, int> pool = {};
+        pool.init_alloc(1024 * 1024);
+        for(int i = 0; i < 1024; i++) pool.put(i);
+        bench_run("VPool put + remove", 100000, 64, [&](int i) { pool.remove(pool.put(i)); });
+        pool.deinit_dealloc();
+    }
+}
+
+// Total throughput of `num_threads` threads doing `num_ops` operations each, `op(thread_index, i)`.
+template<typename OP>
+static void bench_threads(const char* name, const int num_threads, const int num_ops, OP op) {
+    if(!bench_enabled(name)) return;
+    std::atomic<int> ready(0);
+    std::vector<std::thread> threads;
+    const uint64_t faults_begin = bench_page_faults();
+    std::vector<double> samples(num_threads);
+    for(int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            ready++;
+            while(ready.load() < num_threads) {
+            }
+            const uint64_t thread_begin = bench_now_ns();
+            for(int i = 0; i < num_ops; i++) {
+                op(t, i);
+            }
+            samples[t] = (double)(bench_now_ns() - thread_begin) / num_ops;
+        });
+    }
+    const uint64_t begin = bench_now_ns();
+    for(std::thread& thread : threads) thread.join();
+    const double total_ns = (double)(bench_now_ns() - begin);
+
+    char label[128];
+    snprintf(label, sizeof(label), "%s x%d", name, num_threads);
+    // Percentiles over the threads, shows how fair the contention is.
+    bench_report(label, samples, num_ops, bench_page_faults() - faults_begin);
+    printf("%-44s %10.1f Mops/s\n", "", (double)num_threads * num_ops / total_ns * 1000.0);
+}
+
+static void bench_contention() {
+    const int max_threads = (int)std::max(std::min(std::thread::hardware_concurrency(), 16u), 1u);
+    for(int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        VMemAtomicArena atomic = {};
+        vmem_atomic_arena_init_alloc(&atomic, (VMemSize)4 * 1024 * 1024 * 1024, VMemAllocFlag_None);
+        bench_threads("contention atomic arena push 64B", num_threads, 200000, [&](int, int) {
+            vmem_atomic_arena_push(&atomic, 64, 16);
+        });
+        vmem_atomic_arena_reset(&atomic);
+        bench_threads("contention thread arena push 64B", num_threads, 200000, [&](int, int) {
+            vmem_thread_arena_push(&atomic, 64, 16);
+        });
+        vmem_atomic_arena_deinit_dealloc(&atomic);
+
+        const VMemSize page_size = vmem_get_page_size();
+        const VMemSize size_per_thread = 16 * 1024 * 1024;
+        uint8_t* mem = (uint8_t*)vmem_alloc(size_per_thread * num_threads);
+        const int pages_per_thread = (int)(size_per_thread / page_size);
+        bench_threads("contention commit + touch page", num_threads, pages_per_thread, [&](int t, int i) {
+            uint8_t* page = mem + size_per_thread * t + i * page_size;
+            vmem_commit(page, page_size);
+            *page = 1;
+        });
+        bench_threads("contention commit + touch + decommit", num_threads, pages_per_thread, [&](int t, int i) {
+            uint8_t* page = mem + size_per_thread * t + i * page_size;
+            vmem_commit(page, page_size);
+            *page = 1;
+            vmem_decommit(page, page_size);
+        });
+
+        // Same, but the decommits are batched by a worker thread.
+        VMemWorker worker = {};
+        vmem_worker_init(&worker, 4096, VMemCommitFlag_None);
+        std::thread worker_thread([&]() { vmem_worker_run(&worker); });
+        bench_threads("contention touch + worker decommit", num_threads, pages_per_thread, [&](int t, int i) {
+            uint8_t* page = mem + size_per_thread * t + i * page_size;
+            vmem_commit(page, page_size);
+            *page = 1;
+            vmem_worker_submit(&worker, page, page_size, VMemBatchOp_Decommit, VMemProtect_NoAccess);
+        });
+        vmem_worker_flush(&worker);
+        vmem_worker_stop(&worker);
+        worker_thread.join();
+        vmem_worker_deinit(&worker);
+        vmem_dealloc(mem, size_per_thread * num_threads);
+
+        // Each thread has its own pool, only the page faults and commits are shared.
+        std::vector<VPool<int, int>> pools(num_threads);
+        for(VPool<int, int>& pool : pools) pool.init_alloc(1024 * 1024);
+        bench_threads("contention VPool put + remove", num_threads, 200000, [&](int t, int i) {
+            VPool<int, int>& pool = pools[t];
+            pool.remove(pool.put(i));
+        });
+        for(VPool<int, int>& pool : pools) pool.deinit_dealloc();
+    }
+}
+
+// Touch a big block of memory with small pages vs large pages. Large pages need far fewer faults and TLB entries.
+static void bench_page_sizes() {
+    const VMemSize size = 256 * 1024 * 1024;
+    const VMemAllocFlags flags[] = {
+        VMemAllocFlag_None,
+        VMemAllocFlag_TransparentLargePages,
+        VMemAllocFlag_LargePages,
+    };
+    const char* names[] = {
+        "touch 256MB, 1MB per op, small pages",
+        "touch 256MB, 1MB per op, transparent large",
+        "touch 256MB, 1MB per op, large pages",
+    };
+    for(int f = 0; f < 3; f++) {
+        if(!bench_enabled(names[f])) continue;
+        uint8_t* mem = (uint8_t*)vmem_alloc_ex(size, VMemProtect_ReadWrite, flags[f]);
+        if(mem == nullptr) {
+            printf("%-44s not supported: %s\n", names[f], vmem_get_error_message());
+            continue;
+        }
+        vmem_commit_ex(mem, size, VMemProtect_ReadWrite, VMemCommitFlag_KeepProtect);
+        const VMemSize chunk = 1024 * 1024;
+        bench_run(names[f], (int)(size / chunk), 1, [&](int i) { memset(mem + i * chunk, 1, chunk); });
+        vmem_dealloc(mem, size);
+    }
+}
+
+int main(const int argc, const char* argv[]) {
+    vmem_init();
+    if(argc > 1) g_filter = argv[1];
+    bench_print_header();
+    bench_reserve();
+    bench_commit();
+    bench_arena();
+    bench_samples();
+    bench_contention();
+    bench_page_sizes();
+    return 0;
+}
@@ -3,6 +3,57 @@
 #include "../vmem.h"
 #include "utest.h"
 #include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define TEST_THREAD_FUNC(name) DWORD WINAPI name(LPVOID user)
+#else
+#include <pthread.h>
+#define TEST_THREAD_FUNC(name) void* name(void* user)
+#endif
+
+#define TEST_MAX_THREADS 64
+
+// Run the function on `num_threads` threads, and wait for all of them to finish.
+#if defined(_WIN32)
+static void test_run_threads(LPTHREAD_START_ROUTINE func, const int num_threads, void* user) {
+    HANDLE threads[TEST_MAX_THREADS];
+    for(int i = 0; i < num_threads; i++) threads[i] = CreateThread(NULL, 0, func, user, 0, NULL);
+    WaitForMultipleObjects(num_threads, threads, TRUE, INFINITE);
+    for(int i = 0; i < num_threads; i++) CloseHandle(threads[i]);
+}
+
+// Background thread, which runs until `test_join_thread`.
+typedef HANDLE TestThread;
+
+static TestThread test_start_thread(LPTHREAD_START_ROUTINE func, void* user) {
+    return CreateThread(NULL, 0, func, user, 0, NULL);
+}
+
+static void test_join_thread(TestThread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void test_run_threads(void* (*func)(void*), const int num_threads, void* user) {
+    pthread_t threads[TEST_MAX_THREADS];
+    for(int i = 0; i < num_threads; i++) pthread_create(&threads[i], NULL, func, user);
+    for(int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+}
+
+// Background thread, which runs until `test_join_thread`.
+typedef pthread_t TestThread;
+
+static TestThread test_start_thread(void* (*func)(void*), void* user) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, func, user);
+    return thread;
+}
+
+static void test_join_thread(TestThread thread) {
+    pthread_join(thread, NULL);
+}
+#endif
 
 #define EXPECT_ERROR_WITH_VMEM_MSG(x) \
     EXPECT_FALSE(x);                  \
@@ -22,6 +73,10 @@ UTEST(vmem, error_messages) {
     EXPECT_ERROR_WITH_VMEM_MSG(vmem_dealloc((void*)1, 0));
     EXPECT_ERROR_WITH_VMEM_MSG(vmem_dealloc((void*)1, 1));
 
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_alloc_ring_buffer(0));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_alloc_ring_buffer(vmem_get_allocation_granularity() + 1));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_dealloc_ring_buffer(0, 0));
+
     EXPECT_ERROR_WITH_VMEM_MSG(vmem_lock(0, 0));
     EXPECT_ERROR_WITH_VMEM_MSG(vmem_lock(0, 123));
     EXPECT_ERROR_WITH_VMEM_MSG(vmem_lock((void*)1, 0));
@@ -154,6 +209,34 @@ UTEST(vmem, many_small_recommits_perf) {
     ASSERT_TRUE(vmem_dealloc(ptr, MANY));
 }
 
+// Same as `many_small_recommits_perf`, but the memory is known to be ReadWrite, so the commits don't need a syscall on
+// Linux.
+UTEST(vmem, many_small_recommits_keep_protect_perf) {
+    void* ptr = vmem_alloc(MANY);
+    ASSERT_TRUE(ptr);
+    for(int i = 1; i < MANY; i++) {
+        ASSERT_TRUE(vmem_commit_ex(ptr, i, VMemProtect_ReadWrite, VMemCommitFlag_KeepProtect));
+    }
+    ASSERT_TRUE(vmem_dealloc(ptr, MANY));
+}
+
+UTEST(vmem, commit_populate) {
+    const VMemSize size = vmem_get_page_size() * 16;
+    uint8_t* ptr = (uint8_t*)vmem_alloc_commited_ex(size, VMemCommitFlag_Populate);
+    ASSERT_TRUE(ptr);
+    for(VMemSize i = 0; i < size; i += vmem_get_page_size()) {
+        ASSERT_EQ(ptr[i], 0);
+    }
+    ptr[size - 1] = 1;
+
+    // Populating must not change the memory contents.
+    ASSERT_TRUE(vmem_commit_ex(ptr, size, VMemProtect_ReadWrite, VMemCommitFlag_Populate));
+    ASSERT_EQ(ptr[size - 1], 1);
+    ASSERT_TRUE(vmem_commit_ex(ptr, size, VMemProtect_Read, VMemCommitFlag_Populate));
+    ASSERT_EQ(ptr[size - 1], 1);
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+}
+
 UTEST(vmem, page_commits_perf) {
     const int num_pages = 1000;
     const int size = num_pages * vmem_get_page_size();
@@ -193,6 +276,216 @@ UTEST(vmem, arena_common) {
     ASSERT_FALSE(vmem_arena_is_valid(&arena));
 }
 
+UTEST(vmem, arena_push) {
+    VMemArena arena = vmem_arena_init_alloc(1024 * 1024);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    arena.commit_granularity = 64 * 1024;
+
+    uint8_t* a = (uint8_t*)vmem_arena_push(&arena, 3, 1);
+    ASSERT_TRUE(a == arena.mem);
+    ASSERT_EQ(arena.pos, 3);
+    // The first push commits a whole granule ahead.
+    ASSERT_EQ(arena.commited, 64 * 1024);
+
+    uint64_t* b = (uint64_t*)vmem_arena_push(&arena, sizeof(uint64_t) * 4, 8);
+    ASSERT_TRUE(vmem_is_aligned((uintptr_t)b, 8));
+    ASSERT_EQ(arena.pos, 8 + sizeof(uint64_t) * 4);
+    b[3] = 123;
+
+    {
+        VMemArenaScope scope = vmem_arena_scope_begin(&arena);
+        uint8_t* big = (uint8_t*)vmem_arena_push(&arena, 100 * 1024, 4096);
+        ASSERT_TRUE(big);
+        ASSERT_TRUE(vmem_is_aligned((uintptr_t)big, 4096));
+        big[100 * 1024 - 1] = 1;
+        ASSERT_EQ(arena.commited, 128 * 1024);
+        vmem_arena_scope_end(scope);
+        ASSERT_EQ(arena.pos, 8 + sizeof(uint64_t) * 4);
+        ASSERT_EQ(arena.commited, 128 * 1024);
+    }
+
+    ASSERT_TRUE(vmem_arena_pop(&arena, sizeof(uint64_t) * 4));
+    ASSERT_EQ(arena.pos, 8);
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_arena_pop(&arena, 9));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_arena_push(&arena, 1, 3));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_arena_push(&arena, arena.size_bytes, 1));
+
+    // The last push can use the whole arena, even if it isn't a multiple of the commit granularity.
+    ASSERT_TRUE(vmem_arena_push(&arena, arena.size_bytes - arena.pos, 1));
+    ASSERT_EQ(arena.pos, arena.size_bytes);
+    ASSERT_EQ(arena.commited, arena.size_bytes);
+
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, 0));
+    ASSERT_EQ(arena.pos, 0);
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, arena_push_perf) {
+    VMemArena arena = vmem_arena_init_alloc(MANY * 16);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    for(int i = 0; i < MANY; i++) {
+        ASSERT_TRUE(vmem_arena_push(&arena, 16, 8));
+    }
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, atomic_arena) {
+    VMemAtomicArena arena = {0};
+    ASSERT_TRUE(vmem_atomic_arena_init_alloc(&arena, 1024 * 1024, VMemAllocFlag_None));
+
+    uint8_t* a = (uint8_t*)vmem_atomic_arena_push(&arena, 3, 1);
+    ASSERT_TRUE(a == arena.mem);
+    uint64_t* b = (uint64_t*)vmem_atomic_arena_push(&arena, sizeof(uint64_t), 8);
+    ASSERT_TRUE(vmem_is_aligned((uintptr_t)b, 8));
+    *b = 123;
+    ASSERT_EQ(arena.commited, VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY);
+
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_atomic_arena_push(&arena, 1, 3));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_atomic_arena_push(&arena, arena.size_bytes, 1));
+
+    ASSERT_TRUE(vmem_atomic_arena_reset(&arena));
+    ASSERT_TRUE(vmem_atomic_arena_push(&arena, arena.size_bytes, 1) == arena.mem);
+    ASSERT_EQ(arena.commited, arena.size_bytes);
+    ASSERT_TRUE(vmem_atomic_arena_deinit_dealloc(&arena));
+}
+
+#define TEST_ATOMIC_ARENA_THREADS 8
+#define TEST_ATOMIC_ARENA_PUSHES 10000
+
+static TEST_THREAD_FUNC(test_atomic_arena_thread) {
+    VMemAtomicArena* arena = (VMemAtomicArena*)user;
+    for(int i = 0; i < TEST_ATOMIC_ARENA_PUSHES; i++) {
+        uint64_t* item = (uint64_t*)vmem_atomic_arena_push(arena, sizeof(uint64_t) * 2, 16);
+        if(!item) break;
+        // Both words must be writable and owned by this thread only.
+        item[0] = (uint64_t)(uintptr_t)item;
+        item[1] = ~item[0];
+    }
+    return 0;
+}
+
+UTEST(vmem, atomic_arena_threads) {
+    VMemAtomicArena arena = {0};
+    const VMemSize item_size = sizeof(uint64_t) * 2 + 15;
+    const VMemSize size = TEST_ATOMIC_ARENA_THREADS * TEST_ATOMIC_ARENA_PUSHES * item_size;
+    ASSERT_TRUE(vmem_atomic_arena_init_alloc(&arena, size, VMemAllocFlag_None));
+    arena.commit_granularity = vmem_get_page_size();
+
+    test_run_threads(test_atomic_arena_thread, TEST_ATOMIC_ARENA_THREADS, &arena);
+    ASSERT_EQ(arena.pos, size);
+
+    // Walk all the items, they have to be intact.
+    int num_items = 0;
+    for(VMemSize offset = 0; offset < size; offset += 16) {
+        const uint64_t* item = (const uint64_t*)(arena.mem + offset);
+        if(item[0] == (uint64_t)(uintptr_t)item) {
+            ASSERT_EQ(item[1], ~item[0]);
+            num_items++;
+        }
+    }
+    ASSERT_EQ(num_items, TEST_ATOMIC_ARENA_THREADS * TEST_ATOMIC_ARENA_PUSHES);
+    ASSERT_TRUE(vmem_atomic_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, thread_cache) {
+    VMemAtomicArena shared = {0};
+    ASSERT_TRUE(vmem_atomic_arena_init_alloc(&shared, VMEM_THREAD_CACHE_CHUNK_SIZE * 8, VMemAllocFlag_None));
+    VMemThreadCache cache = {0};
+
+    uint8_t* a = (uint8_t*)vmem_thread_cache_push(&cache, &shared, 3, 1);
+    ASSERT_TRUE(a == shared.mem);
+    ASSERT_EQ(shared.pos, VMEM_THREAD_CACHE_CHUNK_SIZE + 63);
+    uint64_t* b = (uint64_t*)vmem_thread_cache_push(&cache, &shared, sizeof(uint64_t), 8);
+    ASSERT_TRUE((uint8_t*)b == a + 8);
+    *b = 123;
+    // No new chunk was needed.
+    ASSERT_EQ(shared.pos, VMEM_THREAD_CACHE_CHUNK_SIZE + 63);
+
+    // Big allocations go directly to the shared arena.
+    ASSERT_TRUE(vmem_thread_cache_push(&cache, &shared, VMEM_THREAD_CACHE_CHUNK_SIZE, 1));
+    ASSERT_EQ(cache.chunk, a);
+
+    // Resetting the shared arena invalidates the chunk.
+    ASSERT_TRUE(vmem_atomic_arena_reset(&shared));
+    ASSERT_TRUE(vmem_thread_cache_push(&cache, &shared, 1, 1) == shared.mem);
+
+    // So does a new arena at the same address with the same reset count.
+    uint8_t* mem = shared.mem;
+    const VMemSize size = shared.size_bytes;
+    ASSERT_TRUE(vmem_atomic_arena_init(&shared, mem, size));
+    shared.reset_count = cache.reset_count;
+    ASSERT_TRUE(vmem_thread_cache_push(&cache, &shared, 1, 1) == mem);
+    ASSERT_EQ(shared.pos, VMEM_THREAD_CACHE_CHUNK_SIZE + 63);
+    ASSERT_TRUE(vmem_dealloc(mem, size));
+}
+
+#define TEST_THREAD_CACHE_PUSHES 100000
+
+static TEST_THREAD_FUNC(test_thread_arena_thread) {
+    VMemAtomicArena* shared = (VMemAtomicArena*)user;
+    for(int i = 0; i < TEST_THREAD_CACHE_PUSHES; i++) {
+        uint64_t* item = (uint64_t*)vmem_thread_arena_push(shared, sizeof(uint64_t) * 2, 16);
+        if(!item) break;
+        item[0] = (uint64_t)(uintptr_t)item;
+        item[1] = ~item[0];
+    }
+    return 0;
+}
+
+UTEST(vmem, thread_arena_threads) {
+    VMemAtomicArena shared = {0};
+    // Each thread wastes at most one chunk.
+    const VMemSize size = TEST_ATOMIC_ARENA_THREADS * TEST_THREAD_CACHE_PUSHES * 16 +
+                          TEST_ATOMIC_ARENA_THREADS * (VMEM_THREAD_CACHE_CHUNK_SIZE + 64);
+    ASSERT_TRUE(vmem_atomic_arena_init_alloc(&shared, size, VMemAllocFlag_None));
+
+    test_run_threads(test_thread_arena_thread, TEST_ATOMIC_ARENA_THREADS, &shared);
+
+    int num_items = 0;
+    for(VMemSize offset = 0; offset + 16 <= size; offset += 16) {
+        const uint64_t* item = (const uint64_t*)(shared.mem + offset);
+        if(offset + 16 > shared.commited) break;
+        if(item[0] == (uint64_t)(uintptr_t)item) {
+            ASSERT_EQ(item[1], ~item[0]);
+            num_items++;
+        }
+    }
+    ASSERT_EQ(num_items, TEST_ATOMIC_ARENA_THREADS * TEST_THREAD_CACHE_PUSHES);
+    ASSERT_TRUE(vmem_atomic_arena_deinit_dealloc(&shared));
+}
+
+UTEST(vmem, large_pages) {
+    const VMemSize large_page_size = vmem_get_large_page_size();
+    ASSERT_TRUE(large_page_size >= vmem_get_page_size());
+    ASSERT_TRUE(vmem_query_large_page_size() == large_page_size);
+    ASSERT_TRUE(vmem_get_page_size_for_flags(VMemAllocFlag_None) == vmem_get_page_size());
+
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_alloc_ex(large_page_size + 1, VMemProtect_ReadWrite, VMemAllocFlag_LargePages));
+
+    // Transparent large pages are only a hint, so this should work everywhere.
+    VMemArena arena = vmem_arena_init_alloc_ex(large_page_size * 4, VMemAllocFlag_TransparentLargePages);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, 1));
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, large_page_size + 1));
+    memset(arena.mem, 1, arena.commited);
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, 0));
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, arena.size_bytes));
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+
+#if !defined(_WIN32)
+    // On Linux this falls back to transparent huge pages if there are no hugetlb pages reserved.
+    // On Windows this needs SeLockMemoryPrivilege, so it isn't tested.
+    const VMemSize size = large_page_size * 2;
+    uint8_t* ptr = (uint8_t*)vmem_alloc_ex(size, VMemProtect_ReadWrite, VMemAllocFlag_LargePages);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_partially_commit_region_ex(ptr, size, 0, size, VMemAllocFlag_LargePages, VMemCommitFlag_None));
+    ptr[0] = 1;
+    ptr[size - 1] = 1;
+    ASSERT_TRUE(vmem_partially_commit_region_ex(ptr, size, size, 1, VMemAllocFlag_LargePages, VMemCommitFlag_None));
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+#endif
+}
+
 UTEST(vmem, usage_status) {
     VMemUsageStatus status = vmem_query_usage_status();
     ASSERT_GT(status.total_physical_bytes, 0);
@@ -256,9 +549,757 @@ UTEST(vmem, range_info) {
     ASSERT_TRUE(vmem_dealloc(ptr, size));
 }
 
+UTEST(vmem, resident_bytes) {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = 1024 * 1024;
+    uint8_t* ptr = (uint8_t*)vmem_alloc(size);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_commit(ptr, page_size * 16));
+    ASSERT_EQ(vmem_query_resident_bytes(ptr, size), 0);
+
+    for(int i = 0; i < 4; i++) {
+        ptr[i * page_size] = 1;
+    }
+    ASSERT_EQ(vmem_query_resident_bytes(ptr, size), page_size * 4);
+    ASSERT_EQ(vmem_query_resident_bytes(ptr + page_size, 1), page_size);
+
+    VMemRangeInfo info_buf[16] = {0};
+    const VMemSize info_len = vmem_query_range_info(ptr, size, &info_buf[0], 16);
+    ASSERT_GE(info_len, 1);
+    ASSERT_EQ(info_buf[0].is_commited, 1);
+    ASSERT_EQ(info_buf[0].resident_bytes, page_size * 4);
+
+    ASSERT_TRUE(vmem_decommit(ptr, page_size * 16));
+    ASSERT_EQ(vmem_query_resident_bytes(ptr, size), 0);
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+}
+
+UTEST(vmem, ring_buffer) {
+    const VMemSize size = vmem_get_allocation_granularity() * 4;
+    uint8_t* ring = (uint8_t*)vmem_alloc_ring_buffer(size);
+    ASSERT_TRUE(ring);
+    ASSERT_EQ(ring[0], 0);
+
+    // Write across the wrap point in one go.
+    const char message[] = "Hello, ring buffer!";
+    memcpy(ring + size - 5, message, sizeof(message));
+    ASSERT_EQ(memcmp(ring, message + 5, sizeof(message) - 5), 0);
+    ASSERT_EQ((int)ring[size - 5], (int)'H');
+
+    ring[size + 100] = 123;
+    ASSERT_EQ(ring[100], 123);
+
+    ASSERT_TRUE(vmem_dealloc_ring_buffer(ring, size));
+}
+
+UTEST(vmem, stack_pool) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemStackPool pool = {0};
+    ASSERT_TRUE(vmem_stack_pool_init_alloc(&pool, 64, 64 * 1024, 0));
+    ASSERT_EQ(pool.guard_size, page_size);
+    pool.keep_hot_bytes = page_size;
+
+    uint8_t* a = (uint8_t*)vmem_stack_pool_acquire(&pool);
+    uint8_t* b = (uint8_t*)vmem_stack_pool_acquire(&pool);
+    ASSERT_TRUE(a);
+    ASSERT_TRUE(b);
+    ASSERT_EQ(b, a + pool.stack_size + pool.guard_size);
+    a[0] = 1;
+    a[pool.stack_size - 1] = 2;
+    b[0] = 3;
+
+    // The guard page below the stack can't be accessed.
+    VMemRangeInfo info = {0};
+    ASSERT_EQ(vmem_query_range_info(b - page_size, page_size, &info, 1), 1);
+    ASSERT_EQ(info.protect, VMemProtect_NoAccess);
+
+    // Recycled stacks are reused first, the top stays, the deep part is decommited.
+    ASSERT_TRUE(vmem_stack_pool_release(&pool, a));
+    ASSERT_EQ(pool.num_used, 1);
+    uint8_t* c = (uint8_t*)vmem_stack_pool_acquire(&pool);
+    ASSERT_EQ(c, a);
+    ASSERT_EQ(c[pool.stack_size - 1], 2);
+    ASSERT_EQ(c[0], 0);
+    c[0] = 4;
+
+    EXPECT_FALSE(vmem_stack_pool_release(&pool, a + 1));
+    ASSERT_TRUE(vmem_stack_pool_release(&pool, b));
+    EXPECT_FALSE(vmem_stack_pool_release(&pool, b));
+    ASSERT_EQ(pool.num_used, 1);
+    ASSERT_TRUE(vmem_stack_pool_release(&pool, c));
+
+    for(int i = 0; i < 64; i++) {
+        ASSERT_TRUE(vmem_stack_pool_acquire(&pool));
+    }
+    EXPECT_FALSE(vmem_stack_pool_acquire(&pool));
+    ASSERT_TRUE(vmem_stack_pool_deinit_dealloc(&pool));
+}
+
+UTEST(vmem, lazy_decommit) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemArena arena = vmem_arena_init_alloc(1024 * 1024);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    arena.commit_flags |= VMemCommitFlag_LazyDecommit;
+
+    for(int frame = 0; frame < 16; frame++) {
+        ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size * 16));
+        memset(arena.mem, frame, page_size * 16);
+        ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size));
+        ASSERT_EQ(arena.mem[0], frame);
+    }
+
+    ASSERT_TRUE(vmem_decommit_ex(arena.mem, page_size, VMemCommitFlag_LazyDecommit));
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, arena_commit_policy) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemArena arena = vmem_arena_init_alloc(1024 * 1024);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    arena.commit_policy.low_water_percent = 50;
+    arena.commit_policy.shrink_delay = 3;
+    arena.commit_policy.min_commited = page_size * 2;
+
+    // Oscillating around a page boundary doesn't decommit anything.
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size * 8));
+    for(int i = 0; i < 10; i++) {
+        ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size * 7));
+        ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size * 8));
+    }
+    ASSERT_EQ(arena.commited, page_size * 8);
+    ASSERT_EQ(arena.num_avoided_decommits, 10);
+    ASSERT_EQ(arena.num_avoided_commits, 10);
+
+    // Usage below the low water mark only decommits after `shrink_delay` requests.
+    arena.pos = page_size * 8;
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size));
+    ASSERT_EQ(arena.pos, page_size);
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size));
+    ASSERT_EQ(arena.commited, page_size * 8);
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size));
+    ASSERT_EQ(arena.commited, page_size * 2);
+    ASSERT_EQ(arena.num_avoided_decommits, 12);
+
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, batch) {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = page_size * 64;
+    uint8_t* ptr = (uint8_t*)vmem_alloc_protect(size, VMemProtect_NoAccess);
+    ASSERT_TRUE(ptr);
+
+    // Scattered tiles, out of order, some of them touching.
+    VMemBatchEntry entries[6] = {0};
+    const int tiles[6] = {10, 2, 3, 40, 4, 11};
+    for(int i = 0; i < 6; i++) {
+        entries[i].ptr = ptr + tiles[i] * page_size;
+        entries[i].num_bytes = page_size;
+        entries[i].op = VMemBatchOp_Commit;
+        entries[i].protect = VMemProtect_ReadWrite;
+    }
+    ASSERT_EQ(vmem_batch(entries, 6, VMemCommitFlag_None), 6);
+    for(int i = 0; i < 6; i++) {
+        ASSERT_TRUE(entries[i].result);
+        ptr[tiles[i] * page_size] = 1;
+    }
+
+    VMemRangeInfo info[16] = {0};
+    ASSERT_EQ(vmem_query_range_info(ptr + page_size * 2, page_size * 3, info, 16), 1);
+    ASSERT_EQ(info[0].protect, VMemProtect_ReadWrite);
+
+    for(int i = 0; i < 6; i++) {
+        entries[i].op = VMemBatchOp_Decommit;
+    }
+    ASSERT_EQ(vmem_batch(entries, 6, VMemCommitFlag_None), 6);
+    ASSERT_EQ(vmem_query_resident_bytes(ptr, size), 0);
+
+#if defined(VMEM_STATS)
+    // A commit in the batch doesn't split the decommits into separate syscalls.
+    vmem_reset_stats();
+    ASSERT_EQ(vmem_batch(entries, 6, VMemCommitFlag_None), 6);
+    const VMemSize num_decommits = vmem_get_stats().num_calls[VMemEvent_Decommit];
+    VMemBatchEntry mixed[7] = {0};
+    memcpy(mixed, entries, sizeof(entries));
+    mixed[6].ptr = ptr + 20 * page_size;
+    mixed[6].num_bytes = page_size;
+    mixed[6].op = VMemBatchOp_Commit;
+    mixed[6].protect = VMemProtect_ReadWrite;
+    vmem_reset_stats();
+    ASSERT_EQ(vmem_batch(mixed, 7, VMemCommitFlag_None), 7);
+    const VMemStats stats = vmem_get_stats();
+    ASSERT_EQ(stats.num_calls[VMemEvent_Decommit], num_decommits);
+    ASSERT_EQ(stats.num_calls[VMemEvent_Commit], 1);
+#endif
+
+    // Invalid entries fail on their own.
+    entries[0].ptr = 0;
+    entries[0].op = VMemBatchOp_Protect;
+    entries[0].protect = VMemProtect_Read;
+    entries[1].op = VMemBatchOp_Commit;
+    ASSERT_EQ(vmem_batch(entries, 2, VMemCommitFlag_None), 1);
+    ASSERT_FALSE(entries[0].result);
+    ASSERT_TRUE(entries[1].result);
+
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+}
+
+#if defined(VMEM_STATS)
+static VMemSize test_num_events[VMemEvent_COUNT];
+
+static void test_event_callback(VMemEvent event, void* ptr, VMemSize num_bytes, void* user) {
+    VMEM_UNUSED(ptr);
+    VMEM_UNUSED(num_bytes);
+    VMEM_UNUSED(user);
+    test_num_events[event]++;
+}
+
+UTEST(vmem, stats) {
+    const VMemSize page_size = vmem_get_page_size();
+    vmem_reset_stats();
+    const VMemSize reserved = vmem_get_stats().reserved_bytes;
+    memset(test_num_events, 0, sizeof(test_num_events));
+    vmem_set_event_callback(test_event_callback, 0);
+
+    VMemArena arena = vmem_arena_init_alloc(1024 * 1024);
+    ASSERT_TRUE(vmem_arena_is_valid(&arena));
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size * 4));
+    ASSERT_TRUE(vmem_arena_set_commited(&arena, page_size));
+    ASSERT_EQ(arena.peak_commited, page_size * 4);
+
+    VMemStats stats = vmem_get_stats();
+    ASSERT_EQ(stats.reserved_bytes, reserved + 1024 * 1024);
+    ASSERT_EQ(stats.num_calls[VMemEvent_Alloc], 1);
+    ASSERT_EQ(stats.num_calls[VMemEvent_Commit], 1);
+    ASSERT_EQ(stats.num_calls[VMemEvent_Decommit], 1);
+    ASSERT_EQ(stats.commited_bytes, page_size * 4);
+    ASSERT_EQ(stats.decommited_bytes, page_size * 3);
+
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+    stats = vmem_get_stats();
+    ASSERT_EQ(stats.reserved_bytes, reserved);
+    ASSERT_EQ(test_num_events[VMemEvent_Alloc], 1);
+    ASSERT_EQ(test_num_events[VMemEvent_Commit], 1);
+    ASSERT_EQ(test_num_events[VMemEvent_Decommit], 1);
+    ASSERT_EQ(test_num_events[VMemEvent_Dealloc], 1);
+
+    // Commits which change the protection are still a single event.
+    void* ptr = vmem_alloc(page_size * 4);
+    ASSERT_TRUE(ptr);
+    vmem_reset_stats();
+    ASSERT_TRUE(vmem_commit(ptr, page_size * 4));
+    stats = vmem_get_stats();
+    ASSERT_EQ(stats.num_calls[VMemEvent_Commit], 1);
+    ASSERT_EQ(stats.num_calls[VMemEvent_Protect], 0);
+    ASSERT_TRUE(vmem_dealloc(ptr, page_size * 4));
+
+    // Ring buffers reserve both halves.
+    const VMemSize ring_size = vmem_get_allocation_granularity();
+    void* ring = vmem_alloc_ring_buffer(ring_size);
+    ASSERT_TRUE(ring);
+    ASSERT_EQ(vmem_get_stats().reserved_bytes, reserved + 2 * ring_size);
+    ASSERT_TRUE(vmem_dealloc_ring_buffer(ring, ring_size));
+    ASSERT_EQ(vmem_get_stats().reserved_bytes, reserved);
+
+    vmem_set_event_callback(0, 0);
+}
+#endif // defined(VMEM_STATS)
+
+UTEST(vmem, numa) {
+    const int num_nodes = vmem_query_numa_node_count();
+    ASSERT_GE(num_nodes, 1);
+    const VMemUsageStatus status = vmem_query_numa_node_usage_status(0);
+    ASSERT_GT(status.avail_physical_bytes, 0);
+
+    const VMemSize size = 4 * 1024 * 1024;
+    for(int node = VMemNumaNode_Interleave; node < num_nodes; node++) {
+        uint8_t* ptr = (uint8_t*)vmem_alloc_numa(size, VMemProtect_NoAccess, node);
+        ASSERT_TRUE(ptr);
+        ASSERT_TRUE(vmem_commit_numa(ptr, size, VMemProtect_ReadWrite, node));
+        memset(ptr, 1, size);
+        ASSERT_TRUE(vmem_dealloc(ptr, size));
+    }
+}
+
+UTEST(vmem, reservation) {
+    VMemReservation res = {0};
+    const VMemSize min_size = 64 * 1024;
+    ASSERT_TRUE(vmem_reservation_init_alloc(&res, 64 * min_size, min_size));
+    ASSERT_EQ(res.size_bytes, 64 * min_size);
+    ASSERT_TRUE(vmem_is_aligned((uintptr_t)res.mem, (int)min_size));
+
+    // Sizes are rounded up to power of 2 blocks, aligned to their size.
+    uint8_t* a = (uint8_t*)vmem_reservation_acquire(&res, 1);
+    uint8_t* b = (uint8_t*)vmem_reservation_acquire(&res, 3 * min_size);
+    ASSERT_TRUE(a);
+    ASSERT_TRUE(b);
+    ASSERT_EQ(vmem_reservation_block_size(&res, a), min_size);
+    ASSERT_EQ(vmem_reservation_block_size(&res, b), 4 * min_size);
+    ASSERT_TRUE(vmem_is_aligned((uintptr_t)(b - res.mem), (int)(4 * min_size)));
+    ASSERT_EQ(res.used_bytes, 5 * min_size);
+
+    // The whole range can't be acquired until everything is released and merged back.
+    ASSERT_FALSE(vmem_reservation_acquire(&res, 64 * min_size));
+    ASSERT_FALSE(vmem_reservation_release(&res, a + 1));
+    ASSERT_TRUE(vmem_reservation_release(&res, a));
+    ASSERT_TRUE(vmem_reservation_release(&res, b));
+    ASSERT_EQ(res.used_bytes, 0);
+    uint8_t* whole = (uint8_t*)vmem_reservation_acquire(&res, 64 * min_size);
+    ASSERT_EQ(whole, res.mem);
+    ASSERT_TRUE(vmem_reservation_release(&res, whole));
+
+    VMemArena arenas[16];
+    for(int i = 0; i < 16; i++) {
+        arenas[i] = vmem_arena_init_from_reservation(&res, 2 * min_size);
+        ASSERT_TRUE(vmem_arena_is_valid(&arenas[i]));
+        int* items = (int*)vmem_arena_push(&arenas[i], 1000 * sizeof(int), sizeof(int));
+        ASSERT_TRUE(items);
+        items[999] = i;
+    }
+    for(int i = 0; i < 16; i++) {
+        ASSERT_EQ(((int*)arenas[i].mem)[999], i);
+        ASSERT_TRUE(vmem_arena_deinit_release(&arenas[i], &res));
+    }
+    ASSERT_EQ(res.used_bytes, 0);
+    ASSERT_TRUE(vmem_reservation_deinit_dealloc(&res));
+}
+
+UTEST(vmem, arena_reset) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemArena arena = vmem_arena_init_alloc(1024 * page_size);
+    ASSERT_TRUE(vmem_arena_push(&arena, 100 * page_size, 1));
+    const VMemSize commited = arena.commited;
+
+    // Keeping more than is commited is just a rewind.
+    ASSERT_TRUE(vmem_arena_reset(&arena, arena.size_bytes));
+    ASSERT_EQ(arena.pos, 0);
+    ASSERT_EQ(arena.commited, commited);
+
+    ASSERT_TRUE(vmem_arena_reset(&arena, 10 * page_size));
+    ASSERT_EQ(arena.pos, 0);
+    ASSERT_EQ(arena.commited, 10 * page_size);
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+}
+
+UTEST(vmem, frame_arena) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemFrameArena frame_arena = {0};
+    ASSERT_TRUE(vmem_frame_arena_init_alloc(&frame_arena, 1024 * page_size, 16 * page_size));
+
+    int* prev_items = 0;
+    for(int frame = 0; frame < 8; frame++) {
+        ASSERT_TRUE(vmem_frame_arena_swap(&frame_arena));
+        // Data of the previous frame survives one swap.
+        if(prev_items) ASSERT_EQ(prev_items[0], frame - 1);
+        ASSERT_EQ(vmem_frame_arena_current(&frame_arena)->pos, 0);
+        ASSERT_LE(vmem_frame_arena_current(&frame_arena)->commited, 64 * 1024 + 16 * page_size);
+
+        // Large spike every few frames.
+        const VMemSize size = frame % 3 == 0 ? 200 * page_size : 64;
+        int* items = (int*)vmem_arena_push(vmem_frame_arena_current(&frame_arena), size, sizeof(int));
+        ASSERT_TRUE(items);
+        items[0] = frame;
+        prev_items = items;
+        ASSERT_EQ(vmem_frame_arena_previous(&frame_arena)->mem, frame_arena.arenas[frame_arena.current ^ 1].mem);
+    }
+    ASSERT_TRUE(vmem_frame_arena_deinit_dealloc(&frame_arena));
+}
+
+UTEST(vmem, mapped_file) {
+    const char* path = "vmem_test_mapped_file.bin";
+    const VMemSize page_size = vmem_get_page_size();
+    {
+        VMemMappedFile file = {0};
+        const VMemMapFlags flags = VMemMapFlag_Create | VMemMapFlag_Truncate;
+        ASSERT_TRUE(vmem_map_file(&file, path, 1024 * 1024, VMemProtect_ReadWrite, flags));
+        ASSERT_EQ(file.file_size, 0);
+
+        // Growing the arena extends the file.
+        VMemArena arena = vmem_arena_init_mapped_file(&file);
+        int* items = (int*)vmem_arena_push(&arena, 1000 * sizeof(int), sizeof(int));
+        ASSERT_TRUE(items);
+        for(int i = 0; i < 1000; i++) items[i] = i;
+        ASSERT_GE(file.file_size, 1000 * sizeof(int));
+        ASSERT_LE(file.file_size, arena.commited + vmem_get_allocation_granularity());
+
+        // Shrinking the arena keeps the data in the file.
+        const VMemSize file_size = file.file_size;
+        ASSERT_TRUE(vmem_arena_set_commited(&arena, 0));
+        ASSERT_EQ(file.file_size, file_size);
+
+        ASSERT_TRUE(vmem_mapped_file_flush(&file, 0, 0, VMemFlushFlag_Async));
+        ASSERT_TRUE(vmem_mapped_file_flush(&file, 17, page_size, VMemFlushFlag_None));
+        ASSERT_TRUE(vmem_unmap_file(&file));
+        ASSERT_FALSE(vmem_mapped_file_grow(&file, 1));
+    }
+    {
+        VMemMappedFile file = {0};
+        ASSERT_TRUE(vmem_map_file(&file, path, 0, VMemProtect_Read, VMemMapFlag_None));
+        ASSERT_GE(file.file_size, 1000 * sizeof(int));
+        const int* items = (const int*)file.mem;
+        for(int i = 0; i < 1000; i++) ASSERT_EQ(items[i], i);
+        ASSERT_FALSE(vmem_mapped_file_grow(&file, file.file_size + 1));
+        ASSERT_TRUE(vmem_unmap_file(&file));
+    }
+    remove(path);
+}
+
+UTEST(vmem, realloc) {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = 16 * page_size;
+
+    // ReadWrite reservation, e.g. an arena.
+    uint8_t* ptr = (uint8_t*)vmem_alloc_protect(size, VMemProtect_ReadWrite);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_commit(ptr, size));
+    for(VMemSize i = 0; i < size; i++) ptr[i] = (uint8_t)i;
+    ptr = (uint8_t*)vmem_realloc(ptr, size, 1024 * size);
+    ASSERT_TRUE(ptr);
+    for(VMemSize i = 0; i < size; i++) ASSERT_EQ(ptr[i], (uint8_t)i);
+    ASSERT_TRUE(vmem_commit(ptr + size, 1023 * size));
+    ptr[1024 * size - 1] = 1;
+
+    // Shrinking keeps the address.
+    ASSERT_EQ(vmem_realloc(ptr, 1024 * size, size), ptr);
+    ASSERT_EQ(ptr[size - 1], (uint8_t)(size - 1));
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+
+    // Pages with different protection.
+    ptr = (uint8_t*)vmem_alloc(size);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_commit(ptr, page_size));
+    ASSERT_TRUE(vmem_commit(ptr + 4 * page_size, page_size));
+    ASSERT_TRUE(vmem_commit_protect(ptr + 8 * page_size, page_size, VMemProtect_Read));
+    ptr[0] = 1;
+    ptr[4 * page_size] = 2;
+    ptr = (uint8_t*)vmem_realloc(ptr, size, 4 * size);
+    ASSERT_TRUE(ptr);
+    ASSERT_EQ(ptr[0], 1);
+    ASSERT_EQ(ptr[4 * page_size], 2);
+    ASSERT_EQ(ptr[8 * page_size], 0);
+    VMemRangeInfo info = {0};
+    ASSERT_EQ(vmem_query_range_info(ptr + 8 * page_size, page_size, &info, 1), 1);
+    ASSERT_EQ(info.protect, VMemProtect_Read);
+    ASSERT_TRUE(vmem_commit(ptr + 3 * size, page_size));
+    ptr[3 * size] = 3;
+    ASSERT_TRUE(vmem_dealloc(ptr, 4 * size));
+}
+
+static volatile int test_lazy_init_mismatches = 0;
+
+static TEST_THREAD_FUNC(test_lazy_init_thread) {
+    VMEM_UNUSED(user);
+    if(vmem_get_page_size() != vmem_query_page_size() ||
+       vmem_get_allocation_granularity() != vmem_query_allocation_granularity()) {
+        test_lazy_init_mismatches = 1;
+    }
+    return 0;
+}
+
+// Note: `main` doesn't call `vmem_init`, everything is initialized on first use.
+UTEST(vmem, lazy_init) {
+    test_run_threads(test_lazy_init_thread, 8, NULL);
+    ASSERT_EQ(test_lazy_init_mismatches, 0);
+    ASSERT_EQ(vmem_arena_calc_bytes_used_for_size(1), vmem_get_page_size());
+}
+
+UTEST(vmem, commit_unchecked) {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = 16 * page_size;
+    uint8_t* ptr = (uint8_t*)vmem_alloc(size);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_commit_unchecked(ptr, size, VMemProtect_ReadWrite, VMemCommitFlag_None));
+    memset(ptr, 1, size);
+    ASSERT_TRUE(vmem_decommit_unchecked(ptr, 8 * page_size, VMemCommitFlag_None));
+    ASSERT_TRUE(vmem_decommit_unchecked(ptr + 8 * page_size, 8 * page_size, VMemCommitFlag_LazyDecommit));
+    ASSERT_TRUE(vmem_commit_unchecked(ptr, size, VMemProtect_ReadWrite, VMemCommitFlag_KeepProtect));
+    ptr[0] = 2;
+    ASSERT_EQ(ptr[0], 2);
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+}
+
+static VMemSize test_trim_callback(void* user) {
+    (*(int*)user)++;
+    return 0;
+}
+
+UTEST(vmem, memory_pressure) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemArena arena = vmem_arena_init_alloc(16 * 1024 * 1024);
+    arena.commit_flags |= VMemCommitFlag_LazyDecommit;
+    ASSERT_TRUE(vmem_arena_push(&arena, 1024 * 1024, 16));
+    ASSERT_TRUE(vmem_arena_pop(&arena, 1024 * 1024 - 100));
+    ASSERT_EQ(arena.commited, 1024 * 1024);
+
+    int num_calls = 0;
+    ASSERT_TRUE(vmem_register_arena(&arena));
+    ASSERT_TRUE(vmem_register_trim_callback(test_trim_callback, &num_calls));
+    ASSERT_EQ(vmem_trim_all(), 1024 * 1024 - page_size);
+    ASSERT_EQ(num_calls, 1);
+    ASSERT_EQ(arena.commited, 100);
+    ASSERT_EQ(vmem_trim_all(), 0);
+    ASSERT_TRUE(vmem_arena_push(&arena, 2 * page_size, 16));
+
+    ASSERT_TRUE(vmem_unregister_arena(&arena));
+    ASSERT_TRUE(vmem_unregister_trim_callback(test_trim_callback, &num_calls));
+    EXPECT_ERROR_WITH_VMEM_MSG(vmem_unregister_arena(&arena));
+    ASSERT_EQ(vmem_trim_all(), 0);
+    ASSERT_EQ(num_calls, 2);
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&arena));
+
+    VMemPressureMonitor monitor = {0};
+    if(vmem_pressure_monitor_init(&monitor, 100000)) {
+        ASSERT_NE(monitor.source, VMemPressureSource_None);
+        printf("\tPressure source: %d, pressure: %d\n", monitor.source, vmem_pressure_monitor_wait(&monitor, 0));
+        ASSERT_TRUE(vmem_pressure_monitor_deinit(&monitor));
+    } else {
+        printf("\tMemory pressure notifications aren't supported: %s\n", vmem_get_error_message());
+    }
+
+    const VMemUsageStatus status = vmem_query_usage_status();
+    printf(
+        "\tContainer limit: %zu MB, used: %zu MB\n",
+        (size_t)(status.limit_bytes >> 20),
+        (size_t)(status.limit_used_bytes >> 20));
+}
+
+UTEST(vmem, dirty_pages) {
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize size = 64 * page_size;
+    uint8_t* ptr = (uint8_t*)vmem_alloc_ex(size, VMemProtect_ReadWrite, VMemAllocFlag_WriteWatch);
+    ASSERT_TRUE(ptr);
+    ASSERT_TRUE(vmem_commit(ptr, size));
+    memset(ptr, 1, size);
+    ASSERT_TRUE(vmem_reset_dirty_pages(ptr, size));
+
+    void* pages[64];
+    VMemSize num_pages = 64;
+    ASSERT_TRUE(vmem_get_dirty_pages(ptr, size, pages, &num_pages, 0));
+    ASSERT_EQ(num_pages, 0);
+
+    ptr[page_size] = 2;
+    ptr[5 * page_size + 100] = 2;
+    ptr[63 * page_size] = 2;
+    num_pages = 64;
+    ASSERT_TRUE(vmem_get_dirty_pages(ptr, size, pages, &num_pages, 0));
+    ASSERT_EQ(num_pages, 3);
+    ASSERT_TRUE(pages[0] == ptr + page_size);
+    ASSERT_TRUE(pages[1] == ptr + 5 * page_size);
+    ASSERT_TRUE(pages[2] == ptr + 63 * page_size);
+
+    // Only as many pages as fit are returned.
+    num_pages = 2;
+    ASSERT_TRUE(vmem_get_dirty_pages(ptr, size, pages, &num_pages, 0));
+    ASSERT_EQ(num_pages, 2);
+
+    num_pages = 64;
+    ASSERT_TRUE(vmem_get_dirty_pages(ptr, size, pages, &num_pages, 1));
+    ASSERT_EQ(num_pages, 3);
+    num_pages = 64;
+    ASSERT_TRUE(vmem_get_dirty_pages(ptr, size, pages, &num_pages, 0));
+    ASSERT_EQ(num_pages, 0);
+    ASSERT_EQ(ptr[5 * page_size + 100], 2);
+
+    ASSERT_TRUE(vmem_dealloc(ptr, size));
+}
+
+UTEST(vmem, arena_clone_cow) {
+    VMemMappedFile file = {0};
+    ASSERT_TRUE(vmem_map_file(&file, 0, 1024 * 1024, VMemProtect_ReadWrite, VMemMapFlag_Anonymous));
+    VMemArena src = vmem_arena_init_mapped_file(&file);
+    int* items = (int*)vmem_arena_push(&src, 20000 * sizeof(int), sizeof(int));
+    ASSERT_TRUE(items);
+    for(int i = 0; i < 20000; i++) items[i] = i;
+
+    VMemArena clone = vmem_arena_clone_cow(&src);
+    ASSERT_TRUE(clone.mem);
+    ASSERT_EQ(clone.pos, src.pos);
+    ASSERT_GE(clone.cow_bytes, src.commited);
+    int* clone_items = (int*)clone.mem;
+    ASSERT_EQ(clone_items[12345], 12345);
+
+    // Writes to the clone are private.
+    clone_items[0] = -1;
+    clone_items[19999] = -1;
+    ASSERT_EQ(items[0], 0);
+    ASSERT_EQ(items[19999], 19999);
+    ASSERT_EQ(clone_items[1], 1);
+
+    // The clone grows and shrinks like a regular arena, the view stays mapped.
+    int* more = (int*)vmem_arena_push(&clone, 100000 * sizeof(int), sizeof(int));
+    ASSERT_TRUE(more);
+    memset(more, 1, 100000 * sizeof(int));
+    ASSERT_TRUE(vmem_arena_set_commited(&clone, 0));
+    ASSERT_TRUE(vmem_arena_push(&clone, 16, 16));
+    ASSERT_EQ(vmem_arena_trim(&clone), 0);
+
+    ASSERT_TRUE(vmem_arena_deinit_dealloc(&clone));
+    ASSERT_FALSE(vmem_arena_clone_cow(&clone).mem);
+    ASSERT_TRUE(vmem_unmap_file(&file));
+}
+
+UTEST(vmem, alloc_aligned) {
+    const VMemSize aligns[] = {vmem_get_page_size(), 64 * 1024, 2 * 1024 * 1024, 1024 * 1024 * 1024};
+    for(int i = 0; i < 4; i++) {
+        const VMemSize size = 3 * 1024 * 1024 + 100;
+        uint8_t* ptr = (uint8_t*)vmem_alloc_aligned(size, aligns[i], VMemProtect_ReadWrite);
+        ASSERT_TRUE(ptr);
+        ASSERT_TRUE(vmem_is_aligned((uintptr_t)ptr, aligns[i]));
+        ASSERT_TRUE(vmem_commit(ptr, size));
+        ptr[0] = 1;
+        ptr[size - 1] = 1;
+
+        // Nothing else is mapped, the arena works on it and the whole block can be freed.
+        VMemArena arena = vmem_arena_init(ptr, size);
+        ASSERT_TRUE(arena.mem);
+        ASSERT_TRUE(vmem_dealloc(ptr, size));
+    }
+    ASSERT_FALSE(vmem_alloc_aligned(1024, 3 * 4096, VMemProtect_ReadWrite));
+    ASSERT_FALSE(vmem_alloc_aligned(0, 4096, VMemProtect_ReadWrite));
+}
+
+static TEST_THREAD_FUNC(test_worker_run_thread) {
+    vmem_worker_run((VMemWorker*)user);
+    return 0;
+}
+
+typedef struct TestWorkerContext {
+    VMemWorker* worker;
+    // Each thread takes its pages from here.
+    VMemAtomicArena* pages;
+    int num_pages;
+} TestWorkerContext;
+
+// Commit and touch pages, and let the worker decommit them.
+static TEST_THREAD_FUNC(test_worker_thread) {
+    const TestWorkerContext* context = (const TestWorkerContext*)user;
+    const VMemSize page_size = vmem_get_page_size();
+    for(int i = 0; i < context->num_pages; i++) {
+        uint8_t* page = (uint8_t*)vmem_atomic_arena_push(context->pages, page_size, (int)page_size);
+        if(!page) break;
+        *page = 1;
+        vmem_worker_submit(context->worker, page, page_size, VMemBatchOp_Decommit, VMemProtect_NoAccess);
+    }
+    return 0;
+}
+
+UTEST(vmem, worker) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemWorker worker = {0};
+    ASSERT_FALSE(vmem_worker_init(&worker, 3, VMemCommitFlag_None));
+    ASSERT_TRUE(vmem_worker_init(&worker, 4, VMemCommitFlag_None));
+
+    // Without a running worker, a full queue applies the operations right away.
+    uint8_t* ptr = (uint8_t*)vmem_alloc(8 * page_size);
+    ASSERT_TRUE(ptr);
+    for(int i = 0; i < 5; i++) {
+        uint8_t* page = ptr + i * page_size;
+        ASSERT_TRUE(vmem_worker_submit(&worker, page, page_size, VMemBatchOp_Commit, VMemProtect_ReadWrite));
+    }
+    ASSERT_EQ(worker.num_overflows, 1);
+    ptr[4 * page_size] = 1;
+    ASSERT_EQ(vmem_worker_process(&worker), 4);
+    ASSERT_EQ(vmem_worker_process(&worker), 0);
+    ASSERT_EQ(worker.num_done, 4);
+    memset(ptr, 1, 4 * page_size);
+    ASSERT_TRUE(vmem_dealloc(ptr, 8 * page_size));
+    ASSERT_TRUE(vmem_worker_deinit(&worker));
+
+    // Many threads decommiting at the same time.
+    ASSERT_TRUE(vmem_worker_init(&worker, 256, VMemCommitFlag_None));
+    VMemAtomicArena pages = {0};
+    const int num_pages = 1000;
+    // Aligned pushes reserve one more page for the alignment.
+    ASSERT_TRUE(vmem_atomic_arena_init_alloc(&pages, 2 * 8 * num_pages * page_size, VMemAllocFlag_None));
+    TestWorkerContext context = {&worker, &pages, num_pages};
+    const TestThread thread = test_start_thread(test_worker_run_thread, &worker);
+    test_run_threads(test_worker_thread, 8, &context);
+    ASSERT_TRUE(vmem_worker_flush(&worker));
+    ASSERT_EQ(worker.num_done + worker.num_overflows, 8 * num_pages);
+    vmem_worker_stop(&worker);
+    test_join_thread(thread);
+    ASSERT_EQ(worker.num_failed, 0);
+    ASSERT_TRUE(vmem_atomic_arena_deinit_dealloc(&pages));
+    ASSERT_TRUE(vmem_worker_deinit(&worker));
+}
+
+#define TEST_SCALING_PAGES 2048
+
+typedef struct TestScalingContext {
+    VMemAtomicArena* pages;
+    // Null to decommit on the thread itself.
+    VMemWorker* worker;
+} TestScalingContext;
+
+// Grow a private arena page by page, like many threads filling their own containers.
+static TEST_THREAD_FUNC(test_scaling_arena_thread) {
+    VMEM_UNUSED(user);
+    const VMemSize page_size = vmem_get_page_size();
+    VMemArena arena = vmem_arena_init_alloc(TEST_SCALING_PAGES * page_size);
+    arena.commit_granularity = page_size;
+    for(int i = 0; i < TEST_SCALING_PAGES; i++) {
+        uint8_t* page = (uint8_t*)vmem_arena_push(&arena, page_size, (int)page_size);
+        if(!page) break;
+        *page = 1;
+    }
+    vmem_arena_deinit_dealloc(&arena);
+    return 0;
+}
+
+// Commit, touch and decommit pages as fast as possible.
+static TEST_THREAD_FUNC(test_scaling_decommit_thread) {
+    const TestScalingContext* context = (const TestScalingContext*)user;
+    const VMemSize page_size = vmem_get_page_size();
+    uint8_t* mem = (uint8_t*)vmem_atomic_arena_push(context->pages, TEST_SCALING_PAGES * page_size, (int)page_size);
+    if(!mem) return 0;
+    for(int i = 0; i < TEST_SCALING_PAGES; i++) {
+        uint8_t* page = mem + i * page_size;
+        vmem_commit(page, page_size);
+        *page = 1;
+        if(context->worker) {
+            vmem_worker_submit(context->worker, page, page_size, VMemBatchOp_Decommit, VMemProtect_NoAccess);
+        } else {
+            vmem_decommit(page, page_size);
+        }
+    }
+    return 0;
+}
+
+// Throughput against thread count. On Linux all of the commits and decommits take the process-wide mmap lock.
+UTEST(vmem, scaling_perf) {
+    const VMemSize page_size = vmem_get_page_size();
+    VMemWorker worker = {0};
+    ASSERT_TRUE(vmem_worker_init(&worker, 4096, VMemCommitFlag_None));
+    const TestThread thread = test_start_thread(test_worker_run_thread, &worker);
+    printf("\t%8s %16s %16s %16s\n", "threads", "arena Mpages/s", "decommit Mpg/s", "worker Mpg/s");
+    for(int num_threads = 1; num_threads <= 16; num_threads *= 2) {
+        double mpages_per_s[3];
+        for(int mode = 0; mode < 3; mode++) {
+            VMemAtomicArena pages = {0};
+            ASSERT_TRUE(vmem_atomic_arena_init_alloc(
+                &pages,
+                (VMemSize)num_threads * (TEST_SCALING_PAGES + 1) * page_size,
+                VMemAllocFlag_None));
+            TestScalingContext context = {&pages, mode == 2 ? &worker : NULL};
+            const utest_int64_t begin = utest_ns();
+            test_run_threads(
+                mode == 0 ? test_scaling_arena_thread : test_scaling_decommit_thread,
+                num_threads,
+                &context);
+            if(mode == 2) ASSERT_TRUE(vmem_worker_flush(&worker));
+            const double ns = (double)(utest_ns() - begin);
+            mpages_per_s[mode] = (double)num_threads * TEST_SCALING_PAGES / ns * 1000.0;
+            ASSERT_TRUE(vmem_atomic_arena_deinit_dealloc(&pages));
+        }
+        printf("\t%8d %16.2f %16.2f %16.2f\n", num_threads, mpages_per_s[0], mpages_per_s[1], mpages_per_s[2]);
+    }
+    vmem_worker_stop(&worker);
+    test_join_thread(thread);
+    ASSERT_TRUE(vmem_worker_deinit(&worker));
+}
+
 UTEST_STATE();
 
 int main(const int argc, const char* argv[]) {
-    vmem_init();
     return utest_main(argc, argv);
 }
@@ -14,7 +14,7 @@
 //           #include "vmem.h"
 //           #include ...
 //
-//      And then call `vmem_init` once, at the start of your program.
+//      Calling `vmem_init` at the start of your program is optional, everything is initialized lazily.
 //
 // License:
 //      See end of file for license information.
@@ -35,6 +35,16 @@
 //          disabled>`.
 //      VMEM_NO_ERROR_CHECKING
 //          Completely disables ***all*** error checking. This might be very unsafe.
+//      VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY
+//          Default `VMemArena.commit_granularity` of new arenas. 64KB by default.
+//      VMEM_THREAD_CACHE_CHUNK_SIZE
+//          Size of the chunks `VMemThreadCache` grabs from the shared arena. 256KB by default.
+//      VMEM_THREAD_LOCAL
+//          Thread-local storage specifier, used for error messages and the `vmem_thread_arena_push` cache.
+//      VMEM_MAX_TRIM_CALLBACKS
+//          Max number of callbacks registered with `vmem_register_trim_callback`. 256 by default.
+//      VMEM_STATS
+//          Enables `vmem_get_stats` and `vmem_set_event_callback`. Define it in all files which include `vmem.h`.
 //
 // Supported platforms:
 //      Windows
@@ -44,9 +54,14 @@
 //      Reserving, committing, decommiting and releasing memory
 //      Page protection levels
 //      Querying page size and allocation granularity
-//      Memory usage status (total physical memory, available physical memory)
+//      Large pages (hugetlb, transparent huge pages, MEM_LARGE_PAGES)
+//      Memory usage status (total physical memory, available physical memory, container limits)
+//      Memory pressure notifications and trimming of registered arenas
+//      Dirty page tracking
 //      Address math utilities - aligning forwards, backwards, checking alignment
 //      Arena allocation
+//      Lock-free atomic arena for multithreaded allocation
+//      Worker queue for deferred and batched commits and decommits
 
 #if !defined(VMEM_H_INCLUDED)
 #define VMEM_H_INCLUDED
@@ -97,19 +112,68 @@ typedef enum VMemProtect_ {
     VMemProtect_COUNT,
 } VMemProtect_;
 
+typedef uint32_t VMemAllocFlags;
+
+typedef enum VMemAllocFlags_ {
+    VMemAllocFlag_None = 0,
+    // Back the memory with large pages (usually 2MB, see `vmem_get_large_page_size`). This reduces TLB misses for big
+    // allocations. Size of the allocation must be a multiple of the large page size.
+    // On Linux this uses MAP_HUGETLB, and falls back to transparent huge pages when no hugetlb pages are available.
+    // On Windows this uses MEM_LARGE_PAGES. The whole block is commited and locked up-front, and the process needs to
+    // have the SeLockMemoryPrivilege enabled.
+    VMemAllocFlag_LargePages = 1 << 0,
+    // Same as `VMemAllocFlag_LargePages`, but uses 1GB pages on Linux. On Windows this uses the regular large pages.
+    VMemAllocFlag_HugePages = 1 << 1,
+    // Only advise the system to back the memory with transparent huge pages (MADV_HUGEPAGE). The memory is commited
+    // in large page steps, but there are no size requirements. Ignored on Windows.
+    VMemAllocFlag_TransparentLargePages = 1 << 2,
+    // Track which pages get written, see `vmem_get_dirty_pages`.
+    // Uses MEM_WRITE_WATCH on Windows. On Linux the range is registered for asynchronous userfaultfd write-protection
+    // (Linux 6.7+), older kernels fall back to the soft-dirty bits of the page table.
+    // Note: tracking doesn't survive `vmem_realloc` growing the block.
+    VMemAllocFlag_WriteWatch = 1 << 3,
+} VMemAllocFlags_;
+
+typedef uint32_t VMemCommitFlags;
+
+typedef enum VMemCommitFlags_ {
+    VMemCommitFlag_None = 0,
+    // The range already has the requested protection, e.g. it was reserved ReadWrite by `vmem_alloc` and never
+    // protected differently. On Linux pages are commited automatically on the first access, so with this flag the commit
+    // doesn't need to do any syscall (mprotect). Has no effect on Windows.
+    VMemCommitFlag_KeepProtect = 1 << 0,
+    // Populate (prefault) the pages right away, so the first access doesn't cause a page fault. Use this to move the
+    // cost of page faults out of hot code, e.g. to a loading screen.
+    // On Linux this uses MADV_POPULATE_WRITE/MADV_POPULATE_READ, on older kernels it touches every page (which isn't safe
+    // if other threads write to the range at the same time). On Windows this uses PrefetchVirtualMemory.
+    VMemCommitFlag_Populate = 1 << 1,
+    // Used when decommiting (see `vmem_decommit_ex`). Tell the system the contents aren't needed anymore, but let it
+    // reclaim the pages lazily, only under memory pressure. Memory which is reused soon doesn't take new page faults.
+    // Note: the contents of such pages are undefined (old data or zeros), they aren't guaranteed to be zeroed.
+    // Uses MADV_FREE on Linux (MADV_DONTNEED on kernels older than 4.5) and MEM_RESET on Windows, where the pages
+    // stay commited.
+    VMemCommitFlag_LazyDecommit = 1 << 2,
+} VMemCommitFlags_;
+
 // Global memory status.
 typedef struct VMemUsageStatus {
     VMemSize total_physical_bytes;
     VMemSize avail_physical_bytes;
+    // Memory limit of the container the process runs in, 0 when there is no limit. cgroup v2 `memory.max` on Linux,
+    // job object memory limit on Windows. The process gets killed (or allocations fail) when it's reached, even if
+    // there is still plenty of physical memory available.
+    VMemSize limit_bytes;
+    // Memory charged against `limit_bytes`, cgroup v2 `memory.current`. Always 0 on Windows.
+    VMemSize limit_used_bytes;
 } VMemUsageStatus;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Public API
 //
 
-// Call once at the start of your program.
-// This exists only to cache result of `vmem_query_page_size` so you can use faster `vmem_get_page_size`,
-// so this is completely optional. If you don't call this `vmem_get_page_size` will return 0.
+// Cache the results of `vmem_query_page_size`, `vmem_query_allocation_granularity` and `vmem_query_large_page_size`.
+// This is completely optional, the `vmem_get_*` functions call it on the first use. It's safe to call from any number
+// of threads at the same time.
 // Currently there isn't any deinit/shutdown code.
 VMEM_FUNC void vmem_init(void);
 
@@ -117,35 +181,110 @@ VMEM_FUNC void vmem_init(void);
 // @returns 0 on error, start address of the allocated memory block on success.
 VMEM_FUNC void* vmem_alloc_protect(VMemSize num_bytes, VMemProtect protect);
 
+// Same as `vmem_alloc_protect`, but with extra options, like large pages. See `VMemAllocFlags_`.
+// @returns 0 on error, start address of the allocated memory block on success.
+VMEM_FUNC void* vmem_alloc_ex(VMemSize num_bytes, VMemProtect protect, VMemAllocFlags flags);
+
+// Same as `vmem_alloc_protect`, but the address is aligned to `align`, e.g. 2MB so transparent huge pages can back the
+// whole block, or for address space sharding. Over-reserves by `align` and releases the head and tail, with `munmap` on
+// Linux, and by splitting a placeholder on Windows (or by retrying at the aligned address on older versions).
+// The result can be passed to `vmem_dealloc`, `vmem_arena_init` etc. like any other block.
+// @param align: any power of 2. Alignment up to the page size (allocation granularity on Windows) is always given.
+// @returns 0 on error, start address of the allocated memory block on success.
+VMEM_FUNC void* vmem_alloc_aligned(VMemSize num_bytes, VMemSize align, VMemProtect protect);
+
 // Dealloc (release, free) a block of virtual memory.
 // @param alloc_ptr: a pointer to the start of the memory block. Must be the result of `vmem_alloc`.
 // @param num_allocated_bytes: *must* be the value returned by `vmem_alloc`.
 //  It isn't used on windows, but it's required on unix platforms.
 VMEM_FUNC VMemResult vmem_dealloc(void* alloc_ptr, VMemSize num_allocated_bytes);
 
+// Resize a block allocated with `vmem_alloc`, keeping the contents, commits and protection of the pages.
+// Linux moves the page tables with `mremap(MREMAP_MAYMOVE)`, so no data is copied. Windows first tries to reserve the
+// address space right after the block, and only copies the commited pages to a new block if that fails.
+// New pages get the protection of the last page of the old block on Linux, on Windows they are reserved.
+// Note: on Windows shrinking only decommits the tail, the reservation stays the same.
+// @param new_size: when the block grows, the old pointer must not be used anymore.
+// @returns address of the resized block (can be the same as `ptr`), or 0 on error. The old block stays valid on error.
+VMEM_FUNC void* vmem_realloc(void* ptr, VMemSize old_size, VMemSize new_size);
+
+// Allocate a "magic" ring buffer: `num_bytes` of commited memory mapped twice, back to back. Bytes at
+// [ptr...ptr+num_bytes] and [ptr+num_bytes...ptr+2*num_bytes] are the same physical memory, so reads and writes which
+// cross the wrap point can be done with a single contiguous access. The memory is ReadWrite and zeroed.
+// Uses memfd + two `MAP_SHARED | MAP_FIXED` mappings on Linux, placeholders + `MapViewOfFile3` on Windows (Windows 10
+// 1803 and newer). Dealloc with `vmem_dealloc_ring_buffer`.
+// @param num_bytes: size of the buffer, must be a multiple of `vmem_get_allocation_granularity`.
+// @returns 0 on error, start address of the buffer on success. The address range is 2*num_bytes long.
+VMEM_FUNC void* vmem_alloc_ring_buffer(VMemSize num_bytes);
+
+// Dealloc a ring buffer allocated with `vmem_alloc_ring_buffer`.
+// @param num_bytes: *must* be the value passed to `vmem_alloc_ring_buffer`.
+VMEM_FUNC VMemResult vmem_dealloc_ring_buffer(void* ptr, VMemSize num_bytes);
+
 // Commit memory pages which contain one or more bytes in [ptr...ptr+num_bytes]. The pages will be mapped to physical
 // memory.
 // Decommit with `vmem_decommit`.
 // @param ptr: pointer to the pointer returned by `vmem_alloc` or shifted by [0...num_bytes].
 VMEM_FUNC VMemResult vmem_commit_protect(void* ptr, VMemSize num_bytes, VMemProtect protect);
 
+// Same as `vmem_commit_protect`, but with extra options. See `VMemCommitFlags_`.
+VMEM_FUNC VMemResult vmem_commit_ex(void* ptr, VMemSize num_bytes, VMemProtect protect, VMemCommitFlags flags);
+
 // Decommits the memory pages which contain one or more bytes in [ptr...ptr+num_bytes]. The pages will be unmapped from
 // physical memory.
 // @param ptr: pointer to the pointer returned by `vmem_alloc` or shifted by [0...num_bytes].
 // @param num_bytes: number of bytes to decommit.
 VMEM_FUNC VMemResult vmem_decommit(void* ptr, VMemSize num_bytes);
 
+// Same as `vmem_decommit`, but with extra options, e.g. `VMemCommitFlag_LazyDecommit`. Other flags are ignored.
+VMEM_FUNC VMemResult vmem_decommit_ex(void* ptr, VMemSize num_bytes, VMemCommitFlags flags);
+
 // Sets protection mode for the region of pages. All of the pages must be commited.
 VMEM_FUNC VMemResult vmem_protect(void* ptr, VMemSize num_bytes, VMemProtect protect);
 
-// @returns cached value from `vmem_query_page_size`. Returns 0 if you don't call `vmem_init`.
+// Same as `vmem_commit_ex`, but the arguments aren't validated, for hot paths which already did that.
+// `ptr` must not be null and `num_bytes` must not be 0. Errors from the system are still reported.
+VMEM_FUNC VMemResult vmem_commit_unchecked(void* ptr, VMemSize num_bytes, VMemProtect protect, VMemCommitFlags flags);
+
+// Same as `vmem_decommit_ex`, but the arguments aren't validated. See `vmem_commit_unchecked`.
+VMEM_FUNC VMemResult vmem_decommit_unchecked(void* ptr, VMemSize num_bytes, VMemCommitFlags flags);
+
+typedef uint8_t VMemBatchOp;
+
+typedef enum VMemBatchOp_ {
+    VMemBatchOp_Commit = 0, // `vmem_commit_ex` with `VMemBatchEntry.protect`.
+    VMemBatchOp_Decommit,   // `vmem_decommit_ex`.
+    VMemBatchOp_Protect,    // `vmem_protect` with `VMemBatchEntry.protect`.
+} VMemBatchOp_;
+
+// One operation for `vmem_batch`.
+typedef struct VMemBatchEntry {
+    void* ptr;
+    VMemSize num_bytes;
+    VMemBatchOp op;
+    VMemProtect protect;
+    // Written by `vmem_batch`.
+    VMemResult result;
+} VMemBatchEntry;
+
+// Commit, decommit or protect many scattered ranges with as few syscalls as possible.
+// The entries are sorted by operation and address, and touching or overlapping ranges with the same operation are
+// merged into a single call. On Linux decommits are issued with a single `process_madvise` when the kernel allows it.
+// When a merged call fails, its entries are retried one by one, so each entry gets its own result.
+// Note: the order of the operations isn't preserved, so ranges of different entries shouldn't overlap unless they do
+// the same thing. `entries` itself isn't reordered.
+// @param flags: passed to `vmem_commit_ex` and `vmem_decommit_ex`.
+// @returns number of entries which succeeded.
+VMEM_FUNC VMemSize vmem_batch(VMemBatchEntry* entries, VMemSize num_entries, VMemCommitFlags flags);
+
+// @returns cached value from `vmem_query_page_size`.
 VMEM_FUNC VMemSize vmem_get_page_size(void);
 
 // Query the page size from the system. Usually something like 4096 bytes.
 // @returns the page size in number bytes. Cannot fail.
 VMEM_FUNC VMemSize vmem_query_page_size(void);
 
-// @returns cached value from `vmem_query_allocation_granularity`. Returns 0 if you don't call `vmem_init`.
+// @returns cached value from `vmem_query_allocation_granularity`.
 VMEM_FUNC VMemSize vmem_get_allocation_granularity(void);
 
 // Query the allocation granularity (alignment of each allocation) from the system.
@@ -153,9 +292,47 @@ VMEM_FUNC VMemSize vmem_get_allocation_granularity(void);
 // @returns allocation granularity in bytes.
 VMEM_FUNC VMemSize vmem_query_allocation_granularity(void);
 
+// @returns cached value from `vmem_query_large_page_size`.
+VMEM_FUNC VMemSize vmem_get_large_page_size(void);
+
+// Query the large page size from the system. Usually 2MB.
+// @returns the large page size in bytes, or 0 if large pages aren't supported.
+VMEM_FUNC VMemSize vmem_query_large_page_size(void);
+
+// @returns size of the pages used by memory allocated with `flags`. This is the granularity in which such a memory
+// block gets commited and decommited.
+VMEM_FUNC VMemSize vmem_get_page_size_for_flags(VMemAllocFlags flags);
+
 // Query the memory usage status from the system.
 VMEM_FUNC VMemUsageStatus vmem_query_usage_status(void);
 
+// Special values for the `node` argument of the NUMA functions.
+typedef enum VMemNumaNode_ {
+    // Use the default policy of the system, usually the node of the thread which touches the page first.
+    VMemNumaNode_Default = -1,
+    // Spread the pages over all nodes, for data which is shared by threads on all nodes (e.g. read-mostly tables).
+    VMemNumaNode_Interleave = -2,
+} VMemNumaNode_;
+
+// @returns number of NUMA nodes in the system, 1 when NUMA isn't available.
+VMEM_FUNC int vmem_query_numa_node_count(void);
+
+// Physical memory of a single NUMA node.
+// Note: `total_physical_bytes` is 0 on Windows, there is no API to query it.
+VMEM_FUNC VMemUsageStatus vmem_query_numa_node_usage_status(int node);
+
+// Same as `vmem_alloc_protect`, but the memory is placed on the NUMA `node` when it's commited, no matter which
+// thread touches it first. `node` can also be one of `VMemNumaNode_`.
+// Uses mbind (MPOL_PREFERRED or MPOL_INTERLEAVE) on Linux and VirtualAllocExNuma on Windows.
+// Note: on Windows interleaving is only done by `vmem_commit_numa`.
+// Note: falls back to the default placement on single node systems and when mbind isn't available (kernels without
+// CONFIG_NUMA, or seccomp filters in containers).
+VMEM_FUNC void* vmem_alloc_numa(VMemSize num_bytes, VMemProtect protect, int node);
+
+// Same as `vmem_commit_protect`, but places the pages on the NUMA `node`. `node` can also be one of `VMemNumaNode_`.
+// On Windows interleaved memory is commited in 1MB chunks, round robin over the nodes which have processors.
+VMEM_FUNC VMemResult vmem_commit_numa(void* ptr, VMemSize num_bytes, VMemProtect protect, int node);
+
 // Locks the specified region of the process's virtual address space into physical memory, ensuring that subsequent
 // access to the region will not incur a page fault.
 // All pages in the specified region must be commited.
@@ -180,7 +357,15 @@ static VMEM_INLINE void* vmem_alloc(const VMemSize num_bytes) {
 // Allocates memory and commits all of it.
 static VMEM_INLINE void* vmem_alloc_commited(const VMemSize num_bytes) {
     void* ptr = vmem_alloc(num_bytes);
-    vmem_commit_protect(ptr, num_bytes, VMemProtect_ReadWrite);
+    if(ptr) vmem_commit_ex(ptr, num_bytes, VMemProtect_ReadWrite, VMemCommitFlag_KeepProtect);
+    return ptr;
+}
+
+// Allocates memory and commits all of it with `vmem_commit_ex`.
+// E.g. use `VMemCommitFlag_Populate` to prefault all of the pages up-front.
+static VMEM_INLINE void* vmem_alloc_commited_ex(const VMemSize num_bytes, const VMemCommitFlags flags) {
+    void* ptr = vmem_alloc(num_bytes);
+    if(ptr) vmem_commit_ex(ptr, num_bytes, VMemProtect_ReadWrite, flags | VMemCommitFlag_KeepProtect);
     return ptr;
 }
 
@@ -237,10 +422,98 @@ static inline VMemResult vmem_is_aligned_fast(const uintptr_t address, const int
 VMEM_FUNC VMemResult
 vmem_partially_commit_region(void* ptr, VMemSize num_bytes, VMemSize prev_commited, VMemSize commited);
 
+// Same as `vmem_partially_commit_region`, but for a region allocated with `vmem_alloc_ex`.
+// The pages are commited in steps of `vmem_get_page_size_for_flags(flags)` bytes, using `vmem_commit_ex` and
+// `vmem_decommit_ex` with `commit_flags`.
+VMEM_FUNC VMemResult vmem_partially_commit_region_ex(
+    void* ptr,
+    VMemSize num_bytes,
+    VMemSize prev_commited,
+    VMemSize commited,
+    VMemAllocFlags flags,
+    VMemCommitFlags commit_flags);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Mapped files
+//
+
+typedef uint32_t VMemMapFlags;
+
+typedef enum VMemMapFlag_ {
+    VMemMapFlag_None = 0,
+    // Create the file if it doesn't exist.
+    VMemMapFlag_Create = 1 << 0,
+    // Discard the existing contents of the file.
+    VMemMapFlag_Truncate = 1 << 1,
+    // Map anonymous shared memory instead of a file, `path` is ignored. It's a memfd on Linux and a pagefile backed
+    // section on Windows. Arenas on anonymous mappings can be cloned with `vmem_arena_clone_cow`.
+    VMemMapFlag_Anonymous = 1 << 2,
+} VMemMapFlag_;
+
+typedef uint32_t VMemFlushFlags;
+
+typedef enum VMemFlushFlag_ {
+    VMemFlushFlag_None = 0,
+    // Only start writing the pages to the file, don't wait for the writes to finish.
+    VMemFlushFlag_Async = 1 << 0,
+} VMemFlushFlag_;
+
+// File mapped into a reservation of address space, e.g. to persist data structures and reopen them without any copies
+// or parsing. The file can grow up to `size_bytes`, the memory past `file_size` must not be accessed.
+// Uses `mmap(MAP_SHARED)` and `ftruncate` on Linux and `CreateFileMapping` with placeholders on Windows. On Windows the
+// file grows in steps of allocation granularity, each step is a separate view.
+typedef struct VMemMappedFile {
+    uint8_t* mem;
+    // Size of the reservation, max size of the file.
+    VMemSize size_bytes;
+    // Current size of the file, the memory in [mem...mem+file_size] is usable.
+    VMemSize file_size;
+    VMemProtect protect;
+    // Flags the file was mapped with.
+    VMemMapFlags flags;
+    // File descriptor on Linux, file HANDLE on Windows. Section HANDLE for anonymous mappings on Windows.
+    intptr_t handle;
+} VMemMappedFile;
+
+// Open the file at `path` and map it to a new reservation of `size_bytes`.
+// @param size_bytes: max size the file can grow to. For read-only files it can be 0 to map just the current size.
+// @param protect: `VMemProtect_Read` or `VMemProtect_ReadWrite`.
+VMEM_FUNC VMemResult
+vmem_map_file(VMemMappedFile* file, const char* path, VMemSize size_bytes, VMemProtect protect, VMemMapFlags flags);
+
+// Unmap the file and close it. Modified pages are still written to the file, but not synchronously.
+VMEM_FUNC VMemResult vmem_unmap_file(VMemMappedFile* file);
+
+// Extend the file to at least `file_size` bytes, rounded up to page size (allocation granularity on Windows).
+// The new part is zeroed. Never shrinks the file.
+VMEM_FUNC VMemResult vmem_mapped_file_grow(VMemMappedFile* file, VMemSize file_size);
+
+// Write modified pages in [mem+offset...mem+offset+num_bytes] to the file.
+// Uses `msync` on Linux, `FlushViewOfFile` and `FlushFileBuffers` on Windows.
+// @param num_bytes: 0 flushes the whole file.
+VMEM_FUNC VMemResult
+vmem_mapped_file_flush(VMemMappedFile* file, VMemSize offset, VMemSize num_bytes, VMemFlushFlags flags);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Arena
 //
 
+// Default value of `VMemArena.commit_granularity`.
+#if !defined(VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY)
+#define VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY (64 * 1024)
+#endif
+
+// Hysteresis for arenas which shrink and grow back often, e.g. per-frame scratch arenas.
+// Without it, an arena which oscillates around a page boundary makes a commit and decommit syscall every time.
+typedef struct VMemCommitPolicy {
+    // Only decommit when the requested size is below this percentage of the commited memory, e.g. 50.
+    uint32_t low_water_percent;
+    // Only decommit after this many consecutive shrink requests below the low water mark.
+    uint32_t shrink_delay;
+    // Never decommit below this many bytes.
+    VMemSize min_commited;
+} VMemCommitPolicy;
+
 // Arena of virtual memory. Works like a resizable array, but doesn't need to be reallocated and copied.
 // Very useful for implementing memory allocators and containers.
 typedef struct VMemArena {
@@ -250,10 +523,46 @@ typedef struct VMemArena {
     VMemSize size_bytes;
     // Number of bytes from range [mem...mem+size_bytes] which are commited and usable.
     VMemSize commited;
+    // Flags the arena memory was allocated with. Determines the page size used for commits.
+    VMemAllocFlags flags;
+    // Number of bytes allocated with `vmem_arena_push`. Always less or equal to `commited`.
+    VMemSize pos;
+    // When `vmem_arena_push` runs out of commited memory, it commits ahead in multiples of this many bytes, so most
+    // pushes don't need any syscall. Must be a power of 2. 0 means page size.
+    VMemSize commit_granularity;
+    // Flags used when commiting the arena memory. `vmem_arena_init_alloc` sets `VMemCommitFlag_KeepProtect`, because it
+    // reserves the memory as ReadWrite, so growing the arena is free of syscalls on Linux.
+    // Set `VMemCommitFlag_LazyDecommit` for arenas which shrink and grow often (e.g. every frame), so the memory
+    // freed by `vmem_arena_set_commited` doesn't have to be faulted in again.
+    VMemCommitFlags commit_flags;
+    // When to actually decommit memory in `vmem_arena_set_commited`. Zeroed (disabled) by default.
+    VMemCommitPolicy commit_policy;
+    // Size last requested with `vmem_arena_set_commited`. Can be less than `commited`, when the policy kept memory.
+    VMemSize requested_commited;
+    // Number of consecutive shrink requests below the low water mark.
+    uint32_t num_low_shrinks;
+    // Number of times the commit policy avoided a commit or decommit.
+    VMemSize num_avoided_commits;
+    VMemSize num_avoided_decommits;
+    // Highest `commited` value, useful to find the arenas which use the most memory.
+    VMemSize peak_commited;
+    // File the arena memory is mapped from, see `vmem_arena_init_mapped_file`. Null for regular arenas.
+    VMemMappedFile* file;
+    // Size of the copy-on-write view at the start of a clone, see `vmem_arena_clone_cow`. 0 for other arenas.
+    // The view is never decommited, only the memory past it.
+    VMemSize cow_bytes;
 } VMemArena;
 
+// Saved arena position. Everything pushed after `vmem_arena_scope_begin` is freed by `vmem_arena_scope_end`.
+// Useful for temporary/scratch allocations.
+typedef struct VMemArenaScope {
+    VMemArena* arena;
+    VMemSize pos;
+} VMemArenaScope;
+
 // Initialize the arena with an existing memory block, which you manage on your own.
 // Note: when using this, use `vmem_dealloc` on your own, don't call `vmem_arena_deinit_dealloc`!
+// Note: if you know the memory was reserved as ReadWrite, set `VMemCommitFlag_KeepProtect` in `arena.commit_flags`.
 // @param mem: pointer returned by `vmem_alloc`, or shifted by N bytes (you can sub-allocate one memory allocation).
 VMEM_FUNC VMemArena vmem_arena_init(void* mem, VMemSize size_bytes);
 
@@ -261,15 +570,98 @@ VMEM_FUNC VMemArena vmem_arena_init(void* mem, VMemSize size_bytes);
 // Use `vmem_arena_deinit_dealloc` to free the memory.
 VMEM_FUNC VMemArena vmem_arena_init_alloc(VMemSize size_bytes);
 
-// De-initialize an arena initialized with `vmem_arena_init_alloc`.
+// Same as `vmem_arena_init_alloc`, but the memory is allocated with `vmem_alloc_ex`. E.g. use
+// `VMemAllocFlag_LargePages` for big arenas.
+VMEM_FUNC VMemArena vmem_arena_init_alloc_ex(VMemSize size_bytes, VMemAllocFlags flags);
+
+// Initialize an arena on a mapped file. `arena.commited` starts at the file size, so the existing contents are
+// usable right away, and commits extend the file instead. Shrinking the arena keeps the file size.
+// Note: `arena.pos` starts at 0, store your own header in the file if you need to persist positions.
+VMEM_FUNC VMemArena vmem_arena_init_mapped_file(VMemMappedFile* file);
+
+// Clone an arena on a mapped file without copying, e.g. for rollback or speculative simulation. The commited pages are
+// shared copy-on-write: the clone starts with the same contents and `pos`, and only the pages it writes to get copied.
+// Uses `mmap(MAP_PRIVATE)` on Linux and `MapViewOfFile3` with `PAGE_WRITECOPY` on Windows.
+// Note: don't modify the source while it has clones, clones can still see the changes on pages they didn't copy yet.
+// Usually the source holds the last confirmed state, and each speculative frame works on a fresh clone.
+// Use `vmem_arena_deinit_dealloc` to free the clone.
+// @param src: arena from `vmem_arena_init_mapped_file`, e.g. on a file mapped with `VMemMapFlag_Anonymous`.
+// @returns the clone, `mem` is 0 on error.
+VMEM_FUNC VMemArena vmem_arena_clone_cow(const VMemArena* src);
+
+// De-initialize an arena initialized with `vmem_arena_init_alloc` or `vmem_arena_clone_cow`.
 // Frees the arena memory using `vmem_dealloc`.
 VMEM_FUNC VMemResult vmem_arena_deinit_dealloc(VMemArena* arena);
 
 // Commit a specific number of bytes from the arena.
 // If `commited < arena.commited`, this will shrink the usable range.
 // If `commited > arena.commited`, this will expand the usable range.
+// If `commited < arena.pos`, the allocations past `commited` are freed.
+// Note: with `arena.commit_policy`, shrinking can keep the memory commited. `arena.commited` stays larger in that case.
 VMEM_FUNC VMemResult vmem_arena_set_commited(VMemArena* arena, VMemSize commited);
 
+// Allocate `num_bytes` from the arena. Commits more memory in `commit_granularity` steps when needed.
+// Note: the memory is only zeroed when it's commited for the first time, not when it's reused after a pop.
+// @param align: alignment of the returned address. Must be a power of 2 and greater than 0.
+// @returns pointer to the allocated memory, or 0 on error (e.g. when the arena is full).
+VMEM_FUNC void* vmem_arena_push(VMemArena* arena, VMemSize num_bytes, int align);
+
+// Free the last `num_bytes` bytes allocated with `vmem_arena_push`. The memory stays commited.
+VMEM_FUNC VMemResult vmem_arena_pop(VMemArena* arena, VMemSize num_bytes);
+
+// Free everything allocated from the arena in O(1). Only the commited memory past `keep_commited_bytes` is decommited,
+// so an arena which is reset every frame doesn't make any syscalls unless the frame used more than the budget.
+// Pass `arena->size_bytes` to keep all of the commited memory.
+VMEM_FUNC VMemResult vmem_arena_reset(VMemArena* arena, VMemSize keep_commited_bytes);
+
+// Decommit all of the commited memory past `arena->pos`, ignoring `arena->commit_policy` and lazy decommit.
+// Used to give memory back under memory pressure, see `vmem_register_arena`.
+// @returns number of decommited bytes.
+VMEM_FUNC VMemSize vmem_arena_trim(VMemArena* arena);
+
+// Save the current arena position.
+static VMEM_INLINE VMemArenaScope vmem_arena_scope_begin(VMemArena* arena) {
+    VMemArenaScope scope;
+    scope.arena = arena;
+    scope.pos = arena->pos;
+    return scope;
+}
+
+// Free everything allocated since `vmem_arena_scope_begin`. The memory stays commited.
+static VMEM_INLINE void vmem_arena_scope_end(const VMemArenaScope scope) {
+    if(scope.pos < scope.arena->pos) scope.arena->pos = scope.pos;
+}
+
+// Double-buffered arena for per-frame temporary allocations. Allocations from the previous frame stay valid for one
+// more frame, e.g. for data which is produced in one frame and consumed in the next one.
+typedef struct VMemFrameArena {
+    VMemArena arenas[2];
+    // Index of the arena of the current frame.
+    int current;
+    // Commited bytes each arena keeps when it's reset by `vmem_frame_arena_swap`.
+    VMemSize keep_commited_bytes;
+} VMemFrameArena;
+
+// Allocate two arenas of `size_bytes` each. They are commited with `VMemCommitFlag_LazyDecommit`, so the rare
+// decommits after a frame spike are cheap as well.
+VMEM_FUNC VMemResult
+vmem_frame_arena_init_alloc(VMemFrameArena* frame_arena, VMemSize size_bytes, VMemSize keep_commited_bytes);
+
+VMEM_FUNC VMemResult vmem_frame_arena_deinit_dealloc(VMemFrameArena* frame_arena);
+
+// Start a new frame: the previous frame arena becomes the current one and is reset with `vmem_arena_reset`.
+VMEM_FUNC VMemResult vmem_frame_arena_swap(VMemFrameArena* frame_arena);
+
+// Arena for allocations of the current frame.
+static VMEM_INLINE VMemArena* vmem_frame_arena_current(VMemFrameArena* frame_arena) {
+    return &frame_arena->arenas[frame_arena->current];
+}
+
+// Arena with the allocations of the previous frame. Valid until the next `vmem_frame_arena_swap`.
+static VMEM_INLINE VMemArena* vmem_frame_arena_previous(VMemFrameArena* frame_arena) {
+    return &frame_arena->arenas[frame_arena->current ^ 1];
+}
+
 // @returns true if the arena is valid (it was initialized with valid memory and size).
 static VMEM_INLINE VMemResult vmem_arena_is_valid(const VMemArena* arena) {
     if(arena) {
@@ -280,9 +672,405 @@ static VMEM_INLINE VMemResult vmem_arena_is_valid(const VMemArena* arena) {
 
 // @returns number of bytes which are physically used for a given size bytes (or commited bytes).
 static VMEM_INLINE VMemSize vmem_arena_calc_bytes_used_for_size(const VMemSize size_bytes) {
-    return vmem_align_forward(size_bytes, vmem_get_page_size());
+    return vmem_align_forward_fast(size_bytes, (int)vmem_get_page_size());
+}
+
+// @returns number of bytes which are physically used for a given size bytes, when commiting in `page_size` steps.
+// See `vmem_get_page_size_for_flags`.
+// @param page_size: must be a power of 2, it isn't checked.
+static VMEM_INLINE VMemSize vmem_arena_calc_bytes_used_for_size_ex(const VMemSize size_bytes, const VMemSize page_size) {
+    return vmem_align_forward_fast(size_bytes, (int)page_size);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Atomic arena
+//
+
+// Thread-safe version of `VMemArena`. Any number of threads can push at the same time, without any locks.
+// The position is bumped with an atomic fetch-add. When a push crosses the commit frontier, only one thread commits
+// more memory, and other threads which need the new memory wait for it.
+// Note: don't access the fields directly while other threads push onto the arena.
+typedef struct VMemAtomicArena {
+    // Base address of the memory arena. Aligned to page size.
+    uint8_t* mem;
+    // Total size/capacity of the arena.
+    VMemSize size_bytes;
+    // Flags the arena memory was allocated with. See `VMemArena.flags`.
+    VMemAllocFlags flags;
+    // Flags used when commiting the arena memory. See `VMemArena.commit_flags`.
+    VMemCommitFlags commit_flags;
+    // Commit memory ahead in multiples of this many bytes. Must be a power of 2. 0 means page size.
+    VMemSize commit_granularity;
+    // Keep the frequently written position on a separate cache line from the commit frontier.
+    uint8_t _pad0[64];
+    // Number of allocated bytes. Can be larger than size_bytes once the arena runs out of memory.
+    volatile VMemSize pos;
+    uint8_t _pad1[64];
+    // Number of bytes which are commited and usable.
+    volatile VMemSize commited;
+    // Non-zero while a thread is commiting more memory.
+    volatile VMemSize commit_lock;
+    // Incremented by `vmem_atomic_arena_reset`, so thread caches know their chunks are no longer valid.
+    volatile VMemSize reset_count;
+    // Unique per init, so thread caches don't reuse chunks of an old arena which was at the same address.
+    VMemSize id;
+} VMemAtomicArena;
+
+// Initialize the atomic arena with an existing memory block, which you manage on your own.
+// See `vmem_arena_init`.
+VMEM_FUNC VMemResult vmem_atomic_arena_init(VMemAtomicArena* arena, void* mem, VMemSize size_bytes);
+
+// Initialize an atomic arena and allocate memory of size `size_bytes` with `vmem_alloc_ex`.
+// Use `vmem_atomic_arena_deinit_dealloc` to free the memory.
+VMEM_FUNC VMemResult vmem_atomic_arena_init_alloc(VMemAtomicArena* arena, VMemSize size_bytes, VMemAllocFlags flags);
+
+// De-initialize an atomic arena initialized with `vmem_atomic_arena_init_alloc`. Not thread-safe.
+VMEM_FUNC VMemResult vmem_atomic_arena_deinit_dealloc(VMemAtomicArena* arena);
+
+// Allocate `num_bytes` from the arena. Thread-safe.
+// Note: when `align` is greater than 1, up to `align - 1` extra bytes are used for padding.
+// @param align: alignment of the returned address. Must be a power of 2 and greater than 0.
+// @returns pointer to the allocated memory, or 0 on error (e.g. when the arena is full).
+VMEM_FUNC void* vmem_atomic_arena_push(VMemAtomicArena* arena, VMemSize num_bytes, int align);
+
+// Free everything allocated from the arena. The memory stays commited.
+// Not thread-safe, no other thread can push onto the arena at the same time.
+VMEM_FUNC VMemResult vmem_atomic_arena_reset(VMemAtomicArena* arena);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Thread cache
+//
+
+// Size of the chunks which thread caches grab from the shared arena.
+#if !defined(VMEM_THREAD_CACHE_CHUNK_SIZE)
+#define VMEM_THREAD_CACHE_CHUNK_SIZE (256 * 1024)
+#endif
+
+// Thread-local chunk of a shared `VMemAtomicArena`.
+// The owning thread bump allocates from its chunk without any atomic operations, and only grabs a new chunk from the
+// shared arena when the current one is used up. So the shared arena is touched once per `VMEM_THREAD_CACHE_CHUNK_SIZE`
+// bytes, instead of on every push.
+// A cache must only be used by one thread at a time.
+typedef struct VMemThreadCache {
+    // The shared arena the current chunk comes from.
+    VMemAtomicArena* shared;
+    // `shared->id` and `shared->reset_count` at the time the chunk was grabbed.
+    VMemSize shared_id;
+    VMemSize reset_count;
+    uint8_t* chunk;
+    VMemSize chunk_size;
+    // Number of bytes allocated from the current chunk.
+    VMemSize pos;
+} VMemThreadCache;
+
+// Allocate `num_bytes` from the thread cache, grab a new chunk from `shared` when needed.
+// Allocations bigger than half of the chunk size are pushed onto the shared arena directly.
+// @param align: alignment of the returned address. Must be a power of 2 and greater than 0.
+// @returns pointer to the allocated memory, or 0 on error (e.g. when the shared arena is full).
+VMEM_FUNC void* vmem_thread_cache_push(VMemThreadCache* cache, VMemAtomicArena* shared, VMemSize num_bytes, int align);
+
+// Same as `vmem_thread_cache_push`, but uses a thread-local cache managed by the library (`VMEM_THREAD_LOCAL`).
+// The cache drops its chunk when it's used with a different shared arena, so this is best used with a single shared
+// arena per thread.
+VMEM_FUNC void* vmem_thread_arena_push(VMemAtomicArena* shared, VMemSize num_bytes, int align);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stack pool
+//
+
+typedef struct VMemStackPoolSlot {
+    // Index of the next free stack, or -1.
+    int next_free;
+    // 1 between acquire and release, catches double releases.
+    int in_use;
+    // Number of commited bytes at the top of the stack. 0 if the stack was never used.
+    VMemSize commited;
+} VMemStackPoolSlot;
+
+// Pool of stacks (e.g. for fibers or coroutines) in a single reservation: [slots][guard][stack][guard][stack]...
+// The whole reservation is `VMemProtect_NoAccess`, so the guard pages below each stack don't need any extra syscalls.
+// Stacks are commited when acquired, physical memory is only used for the pages the stack actually grows into.
+// Note: the whole `stack_size` is commited, on Windows that is charged against the commit limit even if the stack never
+// grows that deep. Keep `stack_size` close to the real worst case when using many stacks there.
+// Released stacks keep their top `keep_hot_bytes` commited and the deep part is decommited, so the next acquire of a
+// recycled stack is cheap. Not thread-safe.
+typedef struct VMemStackPool {
+    uint8_t* mem;
+    VMemSize size_bytes;
+    // Per-stack info, commited at init.
+    VMemStackPoolSlot* slots;
+    // First guard page.
+    uint8_t* stacks;
+    // Usable size of each stack. Multiple of page size.
+    VMemSize stack_size;
+    // Size of the guard region below each stack. Multiple of page size.
+    VMemSize guard_size;
+    // Number of bytes at the top of a released stack which stay commited. 4 pages by default.
+    VMemSize keep_hot_bytes;
+    int num_stacks;
+    int num_used;
+    // Number of stacks which were acquired at least once.
+    int head;
+    int first_free;
+} VMemStackPool;
+
+// Reserve memory for `num_stacks` stacks, each with `guard_size` bytes of guard pages below it.
+// `stack_size` and `guard_size` are rounded up to page size, `guard_size` is at least one page.
+// Use `vmem_stack_pool_deinit_dealloc` to free the memory.
+VMEM_FUNC VMemResult
+vmem_stack_pool_init_alloc(VMemStackPool* pool, int num_stacks, VMemSize stack_size, VMemSize guard_size);
+
+VMEM_FUNC VMemResult vmem_stack_pool_deinit_dealloc(VMemStackPool* pool);
+
+// Get a stack from the pool, recently released stacks are reused first.
+// Stacks grow downward, so the initial stack pointer is `result + pool->stack_size`.
+// @returns the lowest usable address of the stack, or 0 on error (e.g. when all stacks are in use).
+VMEM_FUNC void* vmem_stack_pool_acquire(VMemStackPool* pool);
+
+// Return a stack to the pool. Everything below the top `keep_hot_bytes` is decommited.
+// Releasing a stack which isn't currently acquired is an error.
+// @param stack: pointer returned by `vmem_stack_pool_acquire`.
+VMEM_FUNC VMemResult vmem_stack_pool_release(VMemStackPool* pool, void* stack);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reservation
+//
+
+// Max number of block size levels in a `VMemReservation`.
+#define VMEM_RESERVATION_MAX_LEVELS 48
+
+// One huge reservation of address space, which hands out power of 2 sized blocks with a buddy allocator.
+// Useful when there are thousands of arenas: creating and destroying them doesn't need any syscalls apart from
+// commit/decommit, and it avoids hitting `vm.max_map_count` on Linux and the 64KB allocation granularity on Windows.
+// The whole range is reserved as ReadWrite, blocks are aligned to their size.
+// The block metadata is stored in a separate allocation, 9 bytes per `min_block_size` of the reservation.
+// Not thread-safe.
+typedef struct VMemReservation {
+    // Aligned to `min_block_size`.
+    uint8_t* mem;
+    // Power of 2 multiple of `min_block_size`.
+    VMemSize size_bytes;
+    // Size of the smallest block. Power of 2 and multiple of page size.
+    VMemSize min_block_size;
+    // The actual allocation, a bit bigger than `size_bytes` for the alignment.
+    uint8_t* alloc_mem;
+    VMemSize alloc_size_bytes;
+    // Metadata per min block: free list links and the level of the block starting at that min block.
+    uint32_t* next;
+    uint32_t* prev;
+    uint8_t* levels;
+    VMemSize metadata_size_bytes;
+    // Level 0 are blocks of `min_block_size`, the top level is a single block of `size_bytes`.
+    int num_levels;
+    uint32_t free_heads[VMEM_RESERVATION_MAX_LEVELS];
+    // Number of bytes in acquired blocks.
+    VMemSize used_bytes;
+} VMemReservation;
+
+// Reserve `size_bytes` (rounded up to a power of 2 multiple of `min_block_size`) of address space.
+// @param min_block_size: rounded up to a power of 2 and page size. Use `vmem_get_allocation_granularity` if unsure.
+VMEM_FUNC VMemResult vmem_reservation_init_alloc(VMemReservation* res, VMemSize size_bytes, VMemSize min_block_size);
+
+// Free the whole reservation, including all blocks which weren't released.
+VMEM_FUNC VMemResult vmem_reservation_deinit_dealloc(VMemReservation* res);
+
+// Get a block of at least `num_bytes`, rounded up to a power of 2 multiple of `min_block_size`.
+// The block is aligned to its size. Doesn't make any syscalls, the memory needs to be commited before use.
+// @returns pointer to the block, or 0 when there isn't a big enough free block.
+VMEM_FUNC void* vmem_reservation_acquire(VMemReservation* res, VMemSize num_bytes);
+
+// Return a block to the reservation. Merges it with its free buddy blocks.
+// Note: this doesn't decommit the block, call `vmem_decommit` on the commited part first.
+// @param ptr: pointer returned by `vmem_reservation_acquire`.
+VMEM_FUNC VMemResult vmem_reservation_release(VMemReservation* res, void* ptr);
+
+// @returns size of a block returned by `vmem_reservation_acquire`, 0 on error.
+VMEM_FUNC VMemSize vmem_reservation_block_size(const VMemReservation* res, const void* ptr);
+
+// Initialize an arena on a block from the reservation. `arena.size_bytes` is the whole block size.
+// Use `vmem_arena_deinit_release` to return it.
+VMEM_FUNC VMemArena vmem_arena_init_from_reservation(VMemReservation* res, VMemSize size_bytes);
+
+// Decommit the arena memory and return its block to the reservation.
+VMEM_FUNC VMemResult vmem_arena_deinit_release(VMemArena* arena, VMemReservation* res);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory pressure
+//
+
+typedef uint8_t VMemPressureSource;
+
+typedef enum VMemPressureSource_ {
+    VMemPressureSource_None = 0,
+    // Linux PSI trigger on the cgroup `memory.pressure`, or on `/proc/pressure/memory` (Linux 5.2+).
+    VMemPressureSource_Psi,
+    // Linux cgroup v2 `memory.events`, signaled when the cgroup hits `memory.high` or `memory.max`.
+    VMemPressureSource_CgroupEvents,
+    // Windows `CreateMemoryResourceNotification` with `LowMemoryResourceNotification`.
+    VMemPressureSource_Win32,
+} VMemPressureSource_;
+
+// Event-driven notifications about memory pressure, so the application can give memory back before it's killed.
+// Waiting doesn't cost anything, unlike polling `vmem_query_usage_status`.
+typedef struct VMemPressureMonitor {
+    // File descriptor or HANDLE.
+    intptr_t handle;
+    VMemPressureSource source;
+} VMemPressureMonitor;
+
+// Start monitoring memory pressure. The sources are tried in the order of `VMemPressureSource_`.
+// @param stall_us: Linux PSI threshold, signal when tasks were stalled waiting for memory for this many microseconds
+//  within a 2 second window. E.g. 100000 (5%). Ignored with the other sources.
+VMEM_FUNC VMemResult vmem_pressure_monitor_init(VMemPressureMonitor* monitor, VMemSize stall_us);
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_deinit(VMemPressureMonitor* monitor);
+
+// Wait until memory pressure is signaled.
+// Note: on Windows the notification stays signaled for as long as the memory is low.
+// @param timeout_ms: 0 only polls, -1 waits forever.
+// @returns 1 when there is memory pressure, 0 on timeout or error.
+VMEM_FUNC VMemResult vmem_pressure_monitor_wait(VMemPressureMonitor* monitor, int timeout_ms);
+
+// Max number of callbacks registered with `vmem_register_trim_callback`.
+#if !defined(VMEM_MAX_TRIM_CALLBACKS)
+#define VMEM_MAX_TRIM_CALLBACKS 256
+#endif
+
+// Give unused memory back to the system.
+// @returns number of bytes which were decommited.
+typedef VMemSize (*VMemTrimCallback)(void* user);
+
+// Register a callback for `vmem_trim_all`. Thread-safe.
+// A callback can be registered multiple times with different `user` pointers.
+VMEM_FUNC VMemResult vmem_register_trim_callback(VMemTrimCallback callback, void* user);
+
+VMEM_FUNC VMemResult vmem_unregister_trim_callback(VMemTrimCallback callback, void* user);
+
+// Register an arena to be trimmed with `vmem_arena_trim` by `vmem_trim_all`. Unregister it before deinit.
+VMEM_FUNC VMemResult vmem_register_arena(VMemArena* arena);
+
+VMEM_FUNC VMemResult vmem_unregister_arena(VMemArena* arena);
+
+// Call all registered trim callbacks, e.g. when `vmem_pressure_monitor_wait` signals pressure.
+// The callbacks run on the calling thread, so arenas which aren't thread-safe must be trimmed from the thread which
+// uses them, e.g. by polling the monitor once a frame. The lock isn't held while the callbacks run, so other threads
+// can register callbacks meanwhile. `vmem_unregister_trim_callback` waits for running trims, so callbacks must not
+// unregister callbacks.
+// @returns total number of decommited bytes.
+VMEM_FUNC VMemSize vmem_trim_all(void);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Worker
+//
+
+// One queued operation of `VMemWorker`.
+typedef struct VMemWorkerSlot {
+    volatile VMemSize sequence;
+    VMemBatchEntry entry;
+} VMemWorkerSlot;
+
+// Queue of commits, decommits and protection changes which are applied later by one worker thread, with `vmem_batch`.
+// On Linux every mprotect and madvise takes the process-wide mmap lock, so many threads shrinking and growing memory
+// at the same time mostly wait on each other. With the worker, the hot threads only push to a lock-free queue, and
+// the worker applies the operations in batches, merging the adjacent ranges.
+// Useful for memory which won't be touched for a while, e.g. decommiting freed blocks or commiting (and populating
+// with `VMemCommitFlag_Populate`) memory ahead of time. Use `vmem_worker_flush` before touching it.
+// The library doesn't create any threads, run `vmem_worker_run` on a thread of your own.
+typedef struct VMemWorker {
+    // Ring buffer of `capacity` slots.
+    VMemWorkerSlot* slots;
+    VMemSize capacity;
+    // Flags passed to `vmem_batch`.
+    VMemCommitFlags flags;
+    uint8_t _pad0[64];
+    // Next slot to push to. Written by all threads.
+    volatile VMemSize head;
+    uint8_t _pad1[64];
+    // Next slot the worker reads. Only used by the worker.
+    VMemSize tail;
+    // Number of operations which were applied, all slots before this index are done.
+    volatile VMemSize num_done;
+    // Number of operations which failed, including the ones `vmem_worker_submit` applied itself.
+    volatile VMemSize num_failed;
+    // Number of operations which were applied right away by `vmem_worker_submit`, because the queue was full.
+    volatile VMemSize num_overflows;
+    // Non-zero when `vmem_worker_run` should return.
+    volatile VMemSize stop;
+} VMemWorker;
+
+// @param capacity: max number of queued operations, must be a power of 2. E.g. 4096.
+// @param flags: passed to `vmem_batch`, e.g. `VMemCommitFlag_KeepProtect` or `VMemCommitFlag_LazyDecommit`.
+VMEM_FUNC VMemResult vmem_worker_init(VMemWorker* worker, VMemSize capacity, VMemCommitFlags flags);
+
+// Free the queue. The worker thread must not be running anymore.
+VMEM_FUNC VMemResult vmem_worker_deinit(VMemWorker* worker);
+
+// Queue an operation, see `VMemBatchOp_`. Thread-safe and lock-free.
+// Note: adjacent operations are merged and reordered just like in `vmem_batch`, so ranges which are queued at the same
+// time shouldn't overlap unless they do the same thing.
+// When the queue is full, the operation is applied right away on the calling thread.
+VMEM_FUNC VMemResult
+vmem_worker_submit(VMemWorker* worker, void* ptr, VMemSize num_bytes, VMemBatchOp op, VMemProtect protect);
+
+// Apply all of the operations which are queued right now. Only one thread may call this at a time, usually it's
+// called by `vmem_worker_run`.
+// @returns number of applied operations.
+VMEM_FUNC VMemSize vmem_worker_process(VMemWorker* worker);
+
+// Worker thread loop. Processes the queue until `vmem_worker_stop`, yields and then sleeps for 1ms when it's idle.
+// Everything queued before the stop is still applied.
+VMEM_FUNC VMemResult vmem_worker_run(VMemWorker* worker);
+
+// Make `vmem_worker_run` return. Thread-safe.
+VMEM_FUNC void vmem_worker_stop(VMemWorker* worker);
+
+// Wait until all operations queued before this call are applied. The worker must be running.
+// @returns 0 if any of the operations failed since init.
+VMEM_FUNC VMemResult vmem_worker_flush(VMemWorker* worker);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Statistics
+//
+#if defined(VMEM_STATS)
+
+typedef uint8_t VMemEvent;
+
+typedef enum VMemEvent_ {
+    VMemEvent_Alloc = 0,
+    VMemEvent_Dealloc,
+    VMemEvent_Commit,
+    VMemEvent_Decommit,
+    VMemEvent_Protect,
+    VMemEvent_COUNT,
+} VMemEvent_;
+
+// Global counters of the calls into the system. All of them are cumulative, except for `reserved_bytes`.
+// Note: commits use the size passed by the caller, even when the pages were already commited.
+typedef struct VMemStats {
+    // Number of currently reserved bytes (allocs minus deallocs).
+    VMemSize reserved_bytes;
+    VMemSize commited_bytes;
+    VMemSize decommited_bytes;
+    // Number of successful calls of each `VMemEvent`.
+    VMemSize num_calls[VMemEvent_COUNT];
+    // Total time spent in the calls of each `VMemEvent`, in nanoseconds.
+    VMemSize total_ns[VMemEvent_COUNT];
+} VMemStats;
+
+// Called after every successful alloc, dealloc, commit, decommit and protect. Can be called from any thread.
+typedef void (*VMemEventCallback)(VMemEvent event, void* ptr, VMemSize num_bytes, void* user);
+
+// @returns snapshot of the global counters. Thread-safe.
+VMEM_FUNC VMemStats vmem_get_stats(void);
+
+VMEM_FUNC void vmem_reset_stats(void);
+
+// Set a callback for instrumentation and profilers, e.g. to plot commited memory. Pass null to remove it.
+// Not thread-safe, set it before other threads use the library.
+VMEM_FUNC void vmem_set_event_callback(VMemEventCallback callback, void* user);
+
+#endif // defined(VMEM_STATS)
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Virtual memory debug info
 //
@@ -293,16 +1081,49 @@ typedef struct VMemRangeInfo {
     void* ptr;
     // Number of bytes in the range. Multiple of page size.
     VMemSize size_bytes;
+    // Number of bytes in the range which are backed by physical memory right now.
+    VMemSize resident_bytes;
     uint8_t is_commited;
     VMemProtect protect;
 } VMemRangeInfo;
 
 // Query info about a state of pages in range [ptr...ptr+num_bytes].
+// On Linux the ranges come from `/proc/self/maps` and a range is considered commited when it isn't
+// `VMemProtect_NoAccess` (that's how `vmem_commit` works there). Ranges are clipped to the queried pages.
 // @param out_buf: array of `VmemRangeInfo` of size `buf_max_items`. This will contain the query results.
 // @param buf_max_items: `out_buf` array length.
 // @returns number of entries written to `out_buf`, or 0 on failure.
 VMEM_FUNC VMemSize vmem_query_range_info(void* ptr, VMemSize num_bytes, VMemRangeInfo* out_buf, VMemSize buf_max_items);
 
+// Number of bytes in range [ptr...ptr+num_bytes] which are resident in physical memory.
+// This is much cheaper than `vmem_query_range_info` and doesn't allocate any memory.
+// Uses `mincore` on Linux and `QueryWorkingSetEx` on Windows. The whole range must be allocated.
+// @returns number of resident bytes, or 0 on failure.
+VMEM_FUNC VMemSize vmem_query_resident_bytes(void* ptr, VMemSize num_bytes);
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Dirty page tracking
+//
+
+// Get the pages in [ptr...ptr+num_bytes] which were written since the allocation or the last reset, e.g. to only copy
+// the changed pages into an incremental snapshot. The memory must be allocated with `VMemAllocFlag_WriteWatch`.
+// Pages decommited with `vmem_decommit` aren't reported.
+// Uses `GetWriteWatch` on Windows, the `PAGEMAP_SCAN` ioctl or soft-dirty bits in `/proc/self/pagemap` on Linux.
+// @param out_pages: receives page aligned addresses of the dirty pages, in ascending order.
+// @param inout_num_pages: length of `out_pages`, set to the number of returned pages. When it's full, call again
+//  with the rest of the range.
+// @param reset: atomically reset the tracking of the returned pages, like `vmem_reset_dirty_pages`.
+//  Note: the soft-dirty fallback on Linux can only reset the whole process, and it doesn't reset anything when
+//  `out_pages` fills up.
+VMEM_FUNC VMemResult
+vmem_get_dirty_pages(void* ptr, VMemSize num_bytes, void** out_pages, VMemSize* inout_num_pages, int reset);
+
+// Mark all pages in [ptr...ptr+num_bytes] as not written.
+// Fails when the range isn't tracked, e.g. after `vmem_realloc` grew the block.
+// Note: the soft-dirty fallback on Linux (kernels without async userfaultfd write-protection) resets all memory of
+// the process, pages written outside of the range are reported as clean afterwards.
+VMEM_FUNC VMemResult vmem_reset_dirty_pages(void* ptr, VMemSize num_bytes);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
@@ -333,9 +1154,7 @@ VMEM_FUNC VMemSize vmem_query_range_info(void* ptr, VMemSize num_bytes, VMemRang
 #include <stdint.h>
 #include <stddef.h>
 
-#if !defined(VMEM_NO_ERROR_MESSAGES)
-#include <string.h> // strerror_s, ...
-#endif
+#include <string.h> // strerror_s, strstr, ...
 
 #if defined(VMEM_PLATFORM_WIN32)
 #define NOMINMAX
@@ -344,7 +1163,14 @@ VMEM_FUNC VMemSize vmem_query_range_info(void* ptr, VMemSize num_bytes, VMemRang
 #elif defined(VMEM_PLATFORM_LINUX)
 #include <unistd.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sched.h> // sched_yield
+#include <time.h>
 #endif
 
 #if !defined(VMEM_THREAD_LOCAL)
@@ -387,26 +1213,197 @@ VMEM_FUNC VMemSize vmem_query_range_info(void* ptr, VMemSize num_bytes, VMemRang
 #define VMEM_ERROR_IF(cond, write_message) // Ignore
 #endif
 
+// Atomics, used by the thread-safe parts of the library.
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+#if defined(_WIN64)
+#define VMEM__INTERLOCKED_ADD _InterlockedExchangeAdd64
+#define VMEM__INTERLOCKED_CAS _InterlockedCompareExchange64
+#define VMEM__INTERLOCKED_EXCHANGE _InterlockedExchange64
+typedef __int64 vmem__Atomic;
+#else
+#define VMEM__INTERLOCKED_ADD _InterlockedExchangeAdd
+#define VMEM__INTERLOCKED_CAS _InterlockedCompareExchange
+#define VMEM__INTERLOCKED_EXCHANGE _InterlockedExchange
+typedef long vmem__Atomic;
+#endif
+
+static VMEM_INLINE VMemSize vmem__atomic_load(volatile VMemSize* ptr) {
+    const VMemSize value = *ptr;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static VMEM_INLINE void vmem__atomic_store(volatile VMemSize* ptr, const VMemSize value) {
+    VMEM__INTERLOCKED_EXCHANGE((volatile vmem__Atomic*)ptr, (vmem__Atomic)value);
+}
+
+static VMEM_INLINE VMemSize vmem__atomic_fetch_add(volatile VMemSize* ptr, const VMemSize value) {
+    return (VMemSize)VMEM__INTERLOCKED_ADD((volatile vmem__Atomic*)ptr, (vmem__Atomic)value);
+}
+
+static VMEM_INLINE int vmem__atomic_cas(volatile VMemSize* ptr, const VMemSize expected, const VMemSize desired) {
+    return VMEM__INTERLOCKED_CAS((volatile vmem__Atomic*)ptr, (vmem__Atomic)desired, (vmem__Atomic)expected) ==
+           (vmem__Atomic)expected;
+}
+
+#define vmem__cpu_pause() _mm_pause()
+#else
+static VMEM_INLINE VMemSize vmem__atomic_load(volatile VMemSize* ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static VMEM_INLINE void vmem__atomic_store(volatile VMemSize* ptr, const VMemSize value) {
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static VMEM_INLINE VMemSize vmem__atomic_fetch_add(volatile VMemSize* ptr, const VMemSize value) {
+    return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static VMEM_INLINE int vmem__atomic_cas(volatile VMemSize* ptr, VMemSize expected, const VMemSize desired) {
+    return __atomic_compare_exchange_n(ptr, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define vmem__cpu_pause() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define vmem__cpu_pause() __asm__ __volatile__("yield")
+#else
+#define vmem__cpu_pause() // Ignore
+#endif
+#endif
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 
-// Cached global page size.
-static VMemSize vmem__g_page_size = 0;
-static VMemSize vmem__g_allocation_granularity = 0;
+// Cached global page size. Initialized lazily by `vmem_init`, the values are only read after `vmem__g_initialized`.
+static volatile VMemSize vmem__g_initialized = 0;
+static volatile VMemSize vmem__g_page_size = 0;
+static volatile VMemSize vmem__g_allocation_granularity = 0;
+static volatile VMemSize vmem__g_large_page_size = 0;
+
+#if defined(VMEM_STATS)
+static VMemStats vmem__g_stats = {0};
+static VMemEventCallback vmem__g_event_callback = 0;
+static void* vmem__g_event_callback_user = 0;
+
+static VMemSize vmem__stats_now_ns(void) {
+#if defined(VMEM_PLATFORM_WIN32)
+    static LARGE_INTEGER frequency = {0};
+    if(frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (VMemSize)((double)counter.QuadPart * (1e9 / (double)frequency.QuadPart));
+#elif defined(VMEM_PLATFORM_LINUX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (VMemSize)ts.tv_sec * 1000000000 + (VMemSize)ts.tv_nsec;
+#endif
+}
+
+static void vmem__stats_record(const VMemEvent event, void* ptr, const VMemSize num_bytes, const VMemSize start_ns) {
+    const VMemSize duration = vmem__stats_now_ns() - start_ns;
+    vmem__atomic_fetch_add(&vmem__g_stats.num_calls[event], 1);
+    vmem__atomic_fetch_add(&vmem__g_stats.total_ns[event], duration);
+    switch(event) {
+        case VMemEvent_Alloc: vmem__atomic_fetch_add(&vmem__g_stats.reserved_bytes, num_bytes); break;
+        case VMemEvent_Dealloc: vmem__atomic_fetch_add(&vmem__g_stats.reserved_bytes, (VMemSize)0 - num_bytes); break;
+        case VMemEvent_Commit: vmem__atomic_fetch_add(&vmem__g_stats.commited_bytes, num_bytes); break;
+        case VMemEvent_Decommit: vmem__atomic_fetch_add(&vmem__g_stats.decommited_bytes, num_bytes); break;
+        default: break;
+    }
+    if(vmem__g_event_callback) vmem__g_event_callback(event, ptr, num_bytes, vmem__g_event_callback_user);
+}
+
+VMEM_FUNC VMemStats vmem_get_stats(void) {
+    VMemStats result = {0};
+    result.reserved_bytes = vmem__atomic_load(&vmem__g_stats.reserved_bytes);
+    result.commited_bytes = vmem__atomic_load(&vmem__g_stats.commited_bytes);
+    result.decommited_bytes = vmem__atomic_load(&vmem__g_stats.decommited_bytes);
+    for(int i = 0; i < VMemEvent_COUNT; i++) {
+        result.num_calls[i] = vmem__atomic_load(&vmem__g_stats.num_calls[i]);
+        result.total_ns[i] = vmem__atomic_load(&vmem__g_stats.total_ns[i]);
+    }
+    return result;
+}
+
+VMEM_FUNC void vmem_reset_stats(void) {
+    // Keep the reserved bytes, they would underflow on the next dealloc.
+    const VMemSize reserved_bytes = vmem__atomic_load(&vmem__g_stats.reserved_bytes);
+    memset(&vmem__g_stats, 0, sizeof(vmem__g_stats));
+    vmem__atomic_store(&vmem__g_stats.reserved_bytes, reserved_bytes);
+}
+
+VMEM_FUNC void vmem_set_event_callback(VMemEventCallback callback, void* user) {
+    vmem__g_event_callback_user = user;
+    vmem__g_event_callback = callback;
+}
+
+#define VMEM__STATS_START() const VMemSize vmem__stats_start_ns = vmem__stats_now_ns()
+#define VMEM__STATS_RECORD(event, ptr, num_bytes) vmem__stats_record(event, ptr, num_bytes, vmem__stats_start_ns)
+#else
+#define VMEM__STATS_START()
+#define VMEM__STATS_RECORD(event, ptr, num_bytes)
+#endif
 
 VMEM_FUNC void vmem_init(void) {
-    // Note: this will be 2 syscalls on windows.
-    vmem__g_page_size = vmem_query_page_size();
-    vmem__g_allocation_granularity = vmem_query_allocation_granularity();
+    // Note: this will be 3 syscalls on windows.
+    // Threads which race here all store the same values, so there is no need for a lock.
+    vmem__atomic_store(&vmem__g_page_size, vmem_query_page_size());
+    vmem__atomic_store(&vmem__g_allocation_granularity, vmem_query_allocation_granularity());
+    vmem__atomic_store(&vmem__g_large_page_size, vmem_query_large_page_size());
+    vmem__atomic_store(&vmem__g_initialized, 1);
+}
+
+static VMEM_INLINE VMemSize vmem__get_cached(volatile VMemSize* value) {
+    if(!vmem__atomic_load(&vmem__g_initialized)) vmem_init();
+    return vmem__atomic_load(value);
 }
 
 VMEM_FUNC VMemSize vmem_get_page_size(void) {
-    return vmem__g_page_size;
+    return vmem__get_cached(&vmem__g_page_size);
 }
 
 VMEM_FUNC VMemSize vmem_get_allocation_granularity(void) {
-    return vmem__g_allocation_granularity;
+    return vmem__get_cached(&vmem__g_allocation_granularity);
+}
+
+VMEM_FUNC VMemSize vmem_get_large_page_size(void) {
+    return vmem__get_cached(&vmem__g_large_page_size);
+}
+
+VMEM_FUNC VMemSize vmem_get_page_size_for_flags(const VMemAllocFlags flags) {
+#if defined(VMEM_PLATFORM_LINUX)
+    if(flags & VMemAllocFlag_HugePages) return (VMemSize)1 << 30;
+    if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_TransparentLargePages)) return vmem_get_large_page_size();
+#else
+    if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) return vmem_get_large_page_size();
+#endif
+    return vmem_get_page_size();
+}
+
+VMEM_FUNC void* vmem_alloc_protect(const VMemSize num_bytes, const VMemProtect protect) {
+    return vmem_alloc_ex(num_bytes, protect, VMemAllocFlag_None);
+}
+
+VMEM_FUNC VMemResult vmem_commit_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
+    return vmem_commit_ex(ptr, num_bytes, protect, VMemCommitFlag_None);
+}
+
+// Fallback for populating pages when the system can't do it for us.
+static void vmem__touch_pages(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
+    const VMemSize page_size = vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, (int)page_size);
+    const uintptr_t end = (uintptr_t)ptr + num_bytes;
+    const int write = protect == VMemProtect_ReadWrite || protect == VMemProtect_ExecuteReadWrite;
+    for(uintptr_t p = begin; p < end; p += page_size) {
+        volatile uint8_t* page = (volatile uint8_t*)p;
+        const uint8_t value = *page;
+        if(write) *page = value;
+    }
 }
 
 #if !defined(VMEM_NO_ERROR_MESSAGES)
@@ -463,6 +1460,11 @@ VMEM_FUNC const char* vmem_get_protect_name(const VMemProtect protect) {
     return "<Unknown>";
 }
 
+static VMemResult vmem__is_readable(const VMemProtect protect) {
+    return protect == VMemProtect_Read || protect == VMemProtect_ReadWrite || protect == VMemProtect_ExecuteRead ||
+           protect == VMemProtect_ExecuteReadWrite;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Windows backend implementation
 //
@@ -511,15 +1513,54 @@ static void vmem__write_win32_error_message(void) {
         vmem__g_error_message[(int)result - 1] = '\0';
     }
 }
+#else
+#define vmem__write_win32_error_message() // Ignore
 #endif
 
-VMEM_FUNC void* vmem_alloc_protect(const VMemSize num_bytes, const VMemProtect protect) {
+// PrefetchVirtualMemory is only available since Windows 8, so it's loaded dynamically.
+typedef struct vmem__Win32MemoryRangeEntry {
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+} vmem__Win32MemoryRangeEntry;
+
+typedef BOOL(WINAPI* vmem__Win32PrefetchVirtualMemoryFunc)(HANDLE, ULONG_PTR, vmem__Win32MemoryRangeEntry*, ULONG);
+
+static BOOL vmem__win32_prefetch(void* ptr, const VMemSize num_bytes) {
+    static vmem__Win32PrefetchVirtualMemoryFunc prefetch_func = NULL;
+    if(prefetch_func == NULL) {
+        const HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+        if(kernel32) {
+            prefetch_func = (vmem__Win32PrefetchVirtualMemoryFunc)(void*)GetProcAddress(kernel32, "PrefetchVirtualMemory");
+        }
+        if(prefetch_func == NULL) return FALSE;
+    }
+    vmem__Win32MemoryRangeEntry entry;
+    entry.VirtualAddress = ptr;
+    entry.NumberOfBytes = (SIZE_T)num_bytes;
+    return prefetch_func(GetCurrentProcess(), 1, &entry, 0);
+}
+
+VMEM_FUNC void* vmem_alloc_ex(const VMemSize num_bytes, const VMemProtect protect, const VMemAllocFlags flags) {
     VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Cannot allocate memory block with size 0 bytes."));
 
+    DWORD type = MEM_RESERVE;
+    if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) {
+        const VMemSize large_page_size = vmem_get_large_page_size();
+        VMEM_ERROR_IF(large_page_size == 0, vmem__write_error_message("Large pages aren't supported."));
+        VMEM_ERROR_IF(
+            num_bytes % large_page_size != 0,
+            vmem__write_error_message("Size of a large page allocation must be a multiple of the large page size."));
+        // Large pages cannot be reserved and commited later, they are always commited and locked.
+        type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+    }
+    if(flags & VMemAllocFlag_WriteWatch) type |= MEM_WRITE_WATCH;
+
     const DWORD protect_win32 = vmem__win32_protect(protect);
     if(protect_win32) {
-        LPVOID address = VirtualAlloc(NULL, (SIZE_T)num_bytes, MEM_RESERVE, protect_win32);
+        VMEM__STATS_START();
+        LPVOID address = VirtualAlloc(NULL, (SIZE_T)num_bytes, type, protect_win32);
         VMEM_ERROR_IF(address == NULL, vmem__write_win32_error_message());
+        VMEM__STATS_RECORD(VMemEvent_Alloc, address, num_bytes);
         // Note: memory is initialized to zero.
         return address;
     }
@@ -533,82 +1574,866 @@ VMEM_FUNC VMemResult vmem_dealloc(void* ptr, const VMemSize num_allocated_bytes)
         num_allocated_bytes == 0,
         vmem__write_error_message("Cannot dealloc a memory block of size 0 (num_allocated_bytes is 0)."));
 
+    VMEM__STATS_START();
+    // Blocks grown in place by `vmem_realloc` consist of multiple reservations. The extensions are released first,
+    // while the whole range still belongs to this block. The last page tells if there are any, so regular blocks only
+    // pay for a single query.
+    uint8_t* end = (uint8_t*)ptr + num_allocated_bytes;
+    MEMORY_BASIC_INFORMATION info;
+    if(VirtualQuery(end - 1, &info, sizeof(info)) && info.AllocationBase != ptr) {
+        for(uint8_t* address = (uint8_t*)ptr; address < end;) {
+            if(VirtualQuery(address, &info, sizeof(info)) == 0) break;
+            if(info.State != MEM_FREE && info.AllocationBase != ptr && info.AllocationBase == info.BaseAddress) {
+                const BOOL extension_result = VirtualFree(address, 0, MEM_RELEASE);
+                VMEM_ERROR_IF(extension_result == 0, vmem__write_win32_error_message());
+            }
+            address = (uint8_t*)info.BaseAddress + info.RegionSize;
+        }
+    }
     const BOOL result = VirtualFree(ptr, 0, MEM_RELEASE);
     VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Dealloc, ptr, num_allocated_bytes);
     return VMemResult_Success;
 }
 
-VMEM_FUNC VMemResult vmem_commit_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
+VMEM_FUNC void* vmem_realloc(void* ptr, const VMemSize old_size, const VMemSize new_size) {
     VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(old_size == 0 || new_size == 0, vmem__write_error_message("Size cannot be 0."));
 
-    const LPVOID result = VirtualAlloc(ptr, num_bytes, MEM_COMMIT, vmem__win32_protect(protect));
-    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
-    return VMemResult_Success;
-}
+    VMEM__STATS_START();
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize old_pages = vmem_align_forward(old_size, (int)page_size);
+    const VMemSize new_pages = vmem_align_forward(new_size, (int)page_size);
+    if(new_pages <= old_pages) {
+        if(new_pages < old_pages && !vmem_decommit((uint8_t*)ptr + new_pages, old_pages - new_pages)) return 0;
+        return ptr;
+    }
 
-VMEM_FUNC VMemResult vmem_decommit(void* ptr, const VMemSize num_bytes) {
-    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    // Skip the rest of the original reservation, e.g. when the block was shrunk before.
+    uint8_t* end = (uint8_t*)ptr + new_pages;
+    uint8_t* address = (uint8_t*)ptr + old_pages;
+    MEMORY_BASIC_INFORMATION info;
+    while(address < end && VirtualQuery(address, &info, sizeof(info)) && info.AllocationBase == ptr) {
+        address = (uint8_t*)info.BaseAddress + info.RegionSize;
+    }
+    if(address >= end) return ptr;
+    // Grow in place with a new reservation right after the block. `vmem_dealloc` releases all of them.
+    if(vmem_is_aligned((uintptr_t)address, (int)vmem_get_allocation_granularity()) &&
+       VirtualAlloc(address, (SIZE_T)(end - address), MEM_RESERVE, PAGE_READWRITE)) {
+        VMEM__STATS_RECORD(VMemEvent_Alloc, address, (VMemSize)(end - address));
+        return ptr;
+    }
 
-    const BOOL result = VirtualFree(ptr, num_bytes, MEM_DECOMMIT);
-    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
-    return VMemResult_Success;
+    // Copy the commited ranges to a new block.
+    uint8_t* result = (uint8_t*)vmem_alloc_protect(new_size, VMemProtect_ReadWrite);
+    if(result == 0) return 0;
+    for(VMemSize offset = 0; offset < old_pages;) {
+        VMemRangeInfo ranges[32];
+        const VMemSize num_ranges = vmem_query_range_info((uint8_t*)ptr + offset, old_pages - offset, ranges, 32);
+        if(num_ranges == 0) {
+            vmem_dealloc(result, new_size);
+            return 0;
+        }
+        for(VMemSize i = 0; i < num_ranges; i++) {
+            const VMemSize range_offset = (VMemSize)((uint8_t*)ranges[i].ptr - (uint8_t*)ptr);
+            uint8_t* dst = result + range_offset;
+            if(ranges[i].is_commited) {
+                if(!vmem_commit_protect(dst, ranges[i].size_bytes, VMemProtect_ReadWrite)) {
+                    vmem_dealloc(result, new_size);
+                    return 0;
+                }
+                if(vmem__is_readable(ranges[i].protect)) memcpy(dst, ranges[i].ptr, ranges[i].size_bytes);
+                if(ranges[i].protect != VMemProtect_ReadWrite) {
+                    vmem_protect(dst, ranges[i].size_bytes, ranges[i].protect);
+                }
+            }
+            offset = range_offset + ranges[i].size_bytes;
+        }
+    }
+    vmem_dealloc(ptr, old_size);
+    return result;
 }
 
-VMEM_FUNC VMemResult vmem_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
-    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
-
-    DWORD old_protect = 0;
-    const BOOL result = VirtualProtect(ptr, num_bytes, vmem__win32_protect(protect), &old_protect);
-    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
-    return VMemResult_Success;
+// Placeholder APIs are only available since Windows 10 1803 (and in newer SDKs), so they're loaded dynamically.
+#define VMEM__MEM_PRESERVE_PLACEHOLDER 0x00000002
+#define VMEM__MEM_REPLACE_PLACEHOLDER 0x00004000
+#define VMEM__MEM_RESERVE_PLACEHOLDER 0x00040000
+
+typedef PVOID(WINAPI* vmem__Win32VirtualAlloc2Func)(HANDLE, PVOID, SIZE_T, ULONG, ULONG, void*, ULONG);
+typedef PVOID(WINAPI* vmem__Win32MapViewOfFile3Func)(
+    HANDLE, HANDLE, PVOID, ULONG64, SIZE_T, ULONG, ULONG, void*, ULONG);
+
+static vmem__Win32VirtualAlloc2Func vmem__g_virtual_alloc2 = NULL;
+static vmem__Win32MapViewOfFile3Func vmem__g_map_view_of_file3 = NULL;
+
+// @returns false when the functions aren't available, without reporting an error.
+static int vmem__win32_find_placeholder_funcs(void) {
+    if(vmem__g_virtual_alloc2 == NULL || vmem__g_map_view_of_file3 == NULL) {
+        const HMODULE kernelbase = GetModuleHandleA("kernelbase.dll");
+        if(kernelbase) {
+            vmem__g_virtual_alloc2 =
+                (vmem__Win32VirtualAlloc2Func)(void*)GetProcAddress(kernelbase, "VirtualAlloc2");
+            vmem__g_map_view_of_file3 =
+                (vmem__Win32MapViewOfFile3Func)(void*)GetProcAddress(kernelbase, "MapViewOfFile3");
+        }
+    }
+    return vmem__g_virtual_alloc2 != NULL && vmem__g_map_view_of_file3 != NULL;
 }
 
-VMEM_FUNC VMemSize vmem_query_page_size(void) {
-    SYSTEM_INFO system_info = {0};
-    GetSystemInfo(&system_info);
-    return system_info.dwPageSize;
+static VMemResult vmem__win32_load_placeholder_funcs(void) {
+    const int found = vmem__win32_find_placeholder_funcs();
+    VMEM_ERROR_IF(
+        !found,
+        vmem__write_error_message("Placeholders require VirtualAlloc2 and MapViewOfFile3 (Windows 10 1803)."));
+    return found ? VMemResult_Success : VMemResult_Error;
 }
 
-VMEM_FUNC VMemSize vmem_query_allocation_granularity(void) {
-    SYSTEM_INFO system_info = {0};
-    GetSystemInfo(&system_info);
-    return system_info.dwAllocationGranularity;
+VMEM_FUNC void* vmem_alloc_aligned(const VMemSize num_bytes, const VMemSize align, const VMemProtect protect) {
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Cannot allocate memory block with size 0 bytes."));
+    VMEM_ERROR_IF(
+        align == 0 || (align & (align - 1)) != 0,
+        vmem__write_error_message("Alignment must be a power of 2."));
+    // Reservations are always aligned to allocation granularity.
+    const VMemSize granularity = vmem_get_allocation_granularity();
+    if(align <= granularity) return vmem_alloc_protect(num_bytes, protect);
+    const DWORD protect_win32 = vmem__win32_protect(protect);
+    if(!protect_win32) return 0;
+
+    // Placeholders can only be split at allocation granularity.
+    const VMemSize size = vmem_align_forward(num_bytes, (int)granularity);
+    const VMemSize total = size + align - granularity;
+    VMEM_ERROR_IF(total < size, vmem__write_error_message("Size is too big for the alignment."));
+    VMEM__STATS_START();
+    uint8_t* result = NULL;
+    if(vmem__win32_find_placeholder_funcs()) {
+        // Reserve a placeholder big enough for any alignment, split off the head and tail and release them.
+        uint8_t* base = (uint8_t*)vmem__g_virtual_alloc2(
+            NULL, NULL, total, MEM_RESERVE | VMEM__MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+        VMEM_ERROR_IF(base == NULL, vmem__write_win32_error_message());
+        uint8_t* aligned = (uint8_t*)(((uintptr_t)base + (align - 1)) & ~(uintptr_t)(align - 1));
+        const VMemSize head = (VMemSize)(aligned - base);
+        const VMemSize tail = total - head - size;
+        const DWORD split = MEM_RELEASE | VMEM__MEM_PRESERVE_PLACEHOLDER;
+        // Each successful split adds a placeholder, on failure exactly those have to be released.
+        uint8_t* placeholders[3] = {base};
+        int num_placeholders = 1;
+        BOOL split_result = TRUE;
+        if(head) {
+            split_result = VirtualFree(base, head, split);
+            if(split_result) placeholders[num_placeholders++] = aligned;
+        }
+        if(split_result && tail) {
+            split_result = VirtualFree(aligned, size, split);
+            if(split_result) placeholders[num_placeholders++] = aligned + size;
+        }
+        if(!split_result) {
+            vmem__write_win32_error_message();
+            for(int i = 0; i < num_placeholders; i++) VirtualFree(placeholders[i], 0, MEM_RELEASE);
+            VMEM_ON_ERROR("Failed to split the placeholder.");
+            return 0;
+        }
+        if(head) VirtualFree(base, 0, MEM_RELEASE);
+        if(tail) VirtualFree(aligned + size, 0, MEM_RELEASE);
+        result = (uint8_t*)vmem__g_virtual_alloc2(
+            NULL, aligned, size, MEM_RESERVE | VMEM__MEM_REPLACE_PLACEHOLDER, protect_win32, NULL, 0);
+        if(result == NULL) {
+            vmem__write_win32_error_message();
+            VirtualFree(aligned, 0, MEM_RELEASE);
+            VMEM_ON_ERROR("Failed to reserve the aligned block.");
+            return 0;
+        }
+    } else {
+        // Find a big enough free range, release it and reserve the aligned part. Another thread can take the address
+        // in the meantime, in that case just try again.
+        for(int attempt = 0; attempt < 16 && result == NULL; attempt++) {
+            uint8_t* base = (uint8_t*)VirtualAlloc(NULL, (SIZE_T)total, MEM_RESERVE, PAGE_NOACCESS);
+            if(base == NULL) break;
+            VirtualFree(base, 0, MEM_RELEASE);
+            uint8_t* aligned = (uint8_t*)(((uintptr_t)base + (align - 1)) & ~(uintptr_t)(align - 1));
+            result = (uint8_t*)VirtualAlloc(aligned, (SIZE_T)size, MEM_RESERVE, protect_win32);
+        }
+        VMEM_ERROR_IF(result == NULL, vmem__write_win32_error_message());
+    }
+    VMEM__STATS_RECORD(VMemEvent_Alloc, result, size);
+    return result;
 }
 
-VMEM_FUNC VMemUsageStatus vmem_query_usage_status(void) {
-    MEMORYSTATUS status = {0};
-    GlobalMemoryStatus(&status);
+VMEM_FUNC void* vmem_alloc_ring_buffer(const VMemSize num_bytes) {
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(
+        num_bytes % vmem_get_allocation_granularity() != 0,
+        vmem__write_error_message("Ring buffer size must be a multiple of allocation granularity."));
+    if(!vmem__win32_load_placeholder_funcs()) return 0;
+    const vmem__Win32VirtualAlloc2Func virtual_alloc2 = vmem__g_virtual_alloc2;
+    const vmem__Win32MapViewOfFile3Func map_view_of_file3 = vmem__g_map_view_of_file3;
+
+    VMEM__STATS_START();
+    // Reserve both halves as a placeholder, then split it into two placeholders, one for each view.
+    uint8_t* placeholder = (uint8_t*)virtual_alloc2(
+        NULL, NULL, 2 * num_bytes, MEM_RESERVE | VMEM__MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+    VMEM_ERROR_IF(placeholder == NULL, vmem__write_win32_error_message());
+    if(!VirtualFree(placeholder, num_bytes, MEM_RELEASE | VMEM__MEM_PRESERVE_PLACEHOLDER)) {
+        vmem__write_win32_error_message();
+        VirtualFree(placeholder, 0, MEM_RELEASE);
+        return 0;
+    }
 
-    VMemUsageStatus usage_status = {0};
-    usage_status.total_physical_bytes = status.dwTotalPhys;
-    usage_status.avail_physical_bytes = status.dwAvailPhys;
+    const HANDLE section = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)num_bytes >> 32), (DWORD)num_bytes, NULL);
+    if(section == NULL) {
+        vmem__write_win32_error_message();
+        VirtualFree(placeholder, 0, MEM_RELEASE);
+        VirtualFree(placeholder + num_bytes, 0, MEM_RELEASE);
+        return 0;
+    }
 
-    return usage_status;
+    void* view0 = map_view_of_file3(
+        section, NULL, placeholder, 0, num_bytes, VMEM__MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+    void* view1 = map_view_of_file3(
+        section, NULL, placeholder + num_bytes, 0, num_bytes, VMEM__MEM_REPLACE_PLACEHOLDER, PAGE_READWRITE, NULL, 0);
+    // The views keep the section alive.
+    CloseHandle(section);
+
+    if(view0 == NULL || view1 == NULL) {
+        vmem__write_win32_error_message();
+        if(view0) {
+            UnmapViewOfFile(view0);
+        } else {
+            VirtualFree(placeholder, 0, MEM_RELEASE);
+        }
+        if(view1) {
+            UnmapViewOfFile(view1);
+        } else {
+            VirtualFree(placeholder + num_bytes, 0, MEM_RELEASE);
+        }
+        return 0;
+    }
+    VMEM__STATS_RECORD(VMemEvent_Alloc, placeholder, 2 * num_bytes);
+    return placeholder;
 }
 
-VMEM_FUNC VMemResult vmem_lock(void* ptr, const VMemSize num_bytes) {
+VMEM_FUNC VMemResult vmem_dealloc_ring_buffer(void* ptr, const VMemSize num_bytes) {
     VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
     VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
 
-    const BOOL result = VirtualLock(ptr, num_bytes);
-    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    VMEM__STATS_START();
+    const BOOL result0 = UnmapViewOfFile(ptr);
+    const BOOL result1 = UnmapViewOfFile((uint8_t*)ptr + num_bytes);
+    VMEM_ERROR_IF(result0 == 0 || result1 == 0, vmem__write_win32_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Dealloc, ptr, 2 * num_bytes);
     return VMemResult_Success;
 }
 
-VMEM_FUNC VMemResult vmem_unlock(void* ptr, const VMemSize num_bytes) {
-    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    if(num_bytes == 0) return 0;
+// Map [begin...end] of the file into the placeholder at the end of the reservation, the file must already be that big.
+static VMemResult vmem__win32_map_file_range(VMemMappedFile* file, const VMemSize begin, const VMemSize end) {
+    const DWORD protect = file->protect == VMemProtect_ReadWrite ? PAGE_READWRITE : PAGE_READONLY;
+    // The placeholder covers everything which isn't mapped yet, split off the part for the new view.
+    if(end < file->size_bytes) {
+        const BOOL result = VirtualFree(file->mem + begin, end - begin, MEM_RELEASE | VMEM__MEM_PRESERVE_PLACEHOLDER);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    }
+    const HANDLE section =
+        CreateFileMappingA((HANDLE)file->handle, NULL, protect, (DWORD)((uint64_t)end >> 32), (DWORD)end, NULL);
+    VMEM_ERROR_IF(section == NULL, vmem__write_win32_error_message());
+    void* view = vmem__g_map_view_of_file3(
+        section, NULL, file->mem + begin, begin, end - begin, VMEM__MEM_REPLACE_PLACEHOLDER, protect, NULL, 0);
+    // The view keeps the section alive.
+    CloseHandle(section);
+    VMEM_ERROR_IF(view == NULL, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
 
-    const BOOL result = VirtualUnlock(ptr, num_bytes);
+// Pagefile backed sections can't grow, so the whole size is reserved up-front and commited when the "file" grows.
+static VMemResult vmem__win32_map_anonymous(VMemMappedFile* file, const VMemSize size_bytes, const VMemMapFlags flags) {
+    VMemMappedFile result = {0};
+    result.protect = VMemProtect_ReadWrite;
+    result.flags = flags;
+    result.size_bytes = vmem_align_forward(size_bytes, (int)vmem_get_allocation_granularity());
+    const uint64_t size = (uint64_t)result.size_bytes;
+    const HANDLE section = CreateFileMappingA(
+        INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_RESERVE, (DWORD)(size >> 32), (DWORD)size, NULL);
+    VMEM_ERROR_IF(section == NULL, vmem__write_win32_error_message());
+    result.mem = (uint8_t*)MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, (SIZE_T)result.size_bytes);
+    if(result.mem == NULL) {
+        vmem__write_win32_error_message();
+        CloseHandle(section);
+        return VMemResult_Error;
+    }
+    result.handle = (intptr_t)section;
+    *file = result;
+    return VMemResult_Success;
+}
+
+static VMemResult vmem__win32_set_file_size(const HANDLE handle, const VMemSize file_size) {
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)file_size;
+    const BOOL result = SetFilePointerEx(handle, size, NULL, FILE_BEGIN) && SetEndOfFile(handle);
     VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
     return VMemResult_Success;
 }
 
-VMEM_FUNC VMemSize
-vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_buf, const VMemSize buf_max_items) {
+VMEM_FUNC VMemResult vmem_map_file(
+    VMemMappedFile* file,
+    const char* path,
+    const VMemSize size_bytes,
+    const VMemProtect protect,
+    const VMemMapFlags flags) {
+    VMEM_ERROR_IF(file == 0, vmem__write_error_message("File pointer is null."));
+    VMEM_ERROR_IF(path == 0 && !(flags & VMemMapFlag_Anonymous), vmem__write_error_message("Path is null."));
+    VMEM_ERROR_IF(
+        protect != VMemProtect_Read && protect != VMemProtect_ReadWrite,
+        vmem__write_error_message("Mapped files can only be Read or ReadWrite."));
+    const int writable = protect == VMemProtect_ReadWrite;
+    VMEM_ERROR_IF(writable && size_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    if(flags & VMemMapFlag_Anonymous) {
+        VMEM_ERROR_IF(!writable, vmem__write_error_message("Anonymous mappings have to be ReadWrite."));
+        return vmem__win32_map_anonymous(file, size_bytes, flags);
+    }
+    if(writable && !vmem__win32_load_placeholder_funcs()) return VMemResult_Error;
+
+    DWORD disposition = OPEN_EXISTING;
+    if(flags & VMemMapFlag_Create) disposition = (flags & VMemMapFlag_Truncate) ? CREATE_ALWAYS : OPEN_ALWAYS;
+    else if(flags & VMemMapFlag_Truncate) disposition = TRUNCATE_EXISTING;
+    const HANDLE handle = CreateFileA(
+        path,
+        writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        disposition,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    VMEM_ERROR_IF(handle == INVALID_HANDLE_VALUE, vmem__write_win32_error_message());
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(handle, &size)) {
+        vmem__write_win32_error_message();
+        CloseHandle(handle);
+        return VMemResult_Error;
+    }
+
+    VMemMappedFile result = {0};
+    result.protect = protect;
+    result.flags = flags;
+    result.handle = (intptr_t)handle;
+    result.file_size = (VMemSize)size.QuadPart;
+
+    if(!writable) {
+        // Read-only files can't grow, a regular view is enough.
+        result.size_bytes = size_bytes == 0 || size_bytes > result.file_size ? result.file_size : size_bytes;
+        const HANDLE section = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(section) {
+            result.mem = (uint8_t*)MapViewOfFile(section, FILE_MAP_READ, 0, 0, (SIZE_T)result.size_bytes);
+            CloseHandle(section);
+        }
+        if(result.mem == NULL) {
+            vmem__write_win32_error_message();
+            CloseHandle(handle);
+            return VMemResult_Error;
+        }
+        result.file_size = result.size_bytes;
+        *file = result;
+        return VMemResult_Success;
+    }
+
+    // Views start at allocation granularity, so the file is always a multiple of it.
+    const int granularity = (int)vmem_get_allocation_granularity();
+    result.size_bytes = vmem_align_forward(size_bytes, granularity);
+    const VMemSize mapped_size = vmem_align_forward(result.file_size, granularity);
+    if(mapped_size > result.size_bytes) {
+        vmem__write_error_message("File is bigger than the reservation.");
+        CloseHandle(handle);
+        return VMemResult_Error;
+    }
+    if(mapped_size != result.file_size && !vmem__win32_set_file_size(handle, mapped_size)) {
+        CloseHandle(handle);
+        return VMemResult_Error;
+    }
+
+    result.mem = (uint8_t*)vmem__g_virtual_alloc2(
+        NULL, NULL, result.size_bytes, MEM_RESERVE | VMEM__MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+    if(result.mem == NULL) {
+        vmem__write_win32_error_message();
+        CloseHandle(handle);
+        return VMemResult_Error;
+    }
+    result.file_size = 0;
+    if(mapped_size > 0) {
+        if(!vmem__win32_map_file_range(&result, 0, mapped_size)) {
+            VirtualFree(result.mem, 0, MEM_RELEASE);
+            CloseHandle(handle);
+            return VMemResult_Error;
+        }
+        result.file_size = mapped_size;
+    }
+    *file = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_unmap_file(VMemMappedFile* file) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    VMemResult result = VMemResult_Success;
+    if(file->protect != VMemProtect_ReadWrite || (file->flags & VMemMapFlag_Anonymous)) {
+        if(!UnmapViewOfFile(file->mem)) result = VMemResult_Error;
+    } else {
+        // Every grow mapped a separate view.
+        for(uint8_t* address = file->mem; address < file->mem + file->file_size;) {
+            MEMORY_BASIC_INFORMATION info;
+            if(VirtualQuery(address, &info, sizeof(info)) == 0) {
+                result = VMemResult_Error;
+                break;
+            }
+            uint8_t* next = (uint8_t*)info.BaseAddress + info.RegionSize;
+            if(info.Type == MEM_MAPPED && info.AllocationBase == info.BaseAddress) {
+                if(!UnmapViewOfFile(address)) result = VMemResult_Error;
+            }
+            address = next;
+        }
+        if(file->file_size < file->size_bytes && !VirtualFree(file->mem + file->file_size, 0, MEM_RELEASE)) {
+            result = VMemResult_Error;
+        }
+    }
+    if(!CloseHandle((HANDLE)file->handle)) result = VMemResult_Error;
+    file->mem = 0;
+    VMEM_ERROR_IF(result == VMemResult_Error, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_mapped_file_grow(VMemMappedFile* file, const VMemSize file_size) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    if(file_size <= file->file_size) return VMemResult_Success;
+    VMEM_ERROR_IF(file->protect != VMemProtect_ReadWrite, vmem__write_error_message("File is read-only."));
+    VMEM_ERROR_IF(file_size > file->size_bytes, vmem__write_error_message("File cannot grow past the reservation."));
+
+    const VMemSize new_size = vmem_align_forward(file_size, (int)vmem_get_allocation_granularity());
+    if(file->flags & VMemMapFlag_Anonymous) {
+        // Commiting pages of the section makes them visible in all views.
+        const SIZE_T num_bytes = (SIZE_T)(new_size - file->file_size);
+        void* result = VirtualAlloc(file->mem + file->file_size, num_bytes, MEM_COMMIT, PAGE_READWRITE);
+        VMEM_ERROR_IF(result == NULL, vmem__write_win32_error_message());
+        file->file_size = new_size;
+        return VMemResult_Success;
+    }
+    if(!vmem__win32_set_file_size((HANDLE)file->handle, new_size)) return VMemResult_Error;
+    if(!vmem__win32_map_file_range(file, file->file_size, new_size)) return VMemResult_Error;
+    file->file_size = new_size;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult
+vmem_mapped_file_flush(VMemMappedFile* file, const VMemSize offset, VMemSize num_bytes, const VMemFlushFlags flags) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    VMEM_ERROR_IF(offset > file->file_size, vmem__write_error_message("Offset is past the end of the file."));
+    if(num_bytes == 0 || offset + num_bytes > file->file_size) num_bytes = file->file_size - offset;
+    // There is no file to write to.
+    if(file->flags & VMemMapFlag_Anonymous) return VMemResult_Success;
+
+    // FlushViewOfFile only works within a single view.
+    uint8_t* end = file->mem + offset + num_bytes;
+    for(uint8_t* address = file->mem + offset; address < end;) {
+        MEMORY_BASIC_INFORMATION info;
+        if(VirtualQuery(address, &info, sizeof(info)) == 0) {
+            vmem__write_win32_error_message();
+            VMEM_ON_ERROR("Failed to query the view.");
+            return VMemResult_Error;
+        }
+        uint8_t* next = (uint8_t*)info.BaseAddress + info.RegionSize;
+        if(next > end) next = end;
+        const BOOL result = FlushViewOfFile(address, (SIZE_T)(next - address));
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+        address = next;
+    }
+    if(!(flags & VMemFlushFlag_Async) && file->protect == VMemProtect_ReadWrite) {
+        const BOOL result = FlushFileBuffers((HANDLE)file->handle);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    }
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemArena vmem_arena_clone_cow(const VMemArena* src) {
+    if(src == 0 || src->mem == 0 || src->file == 0) {
+        vmem__write_error_message("Only arenas on mapped files can be cloned.");
+        return (VMemArena){0};
+    }
+    if(!vmem__win32_load_placeholder_funcs()) return (VMemArena){0};
+    const VMemMappedFile* file = src->file;
+    // Placeholders are split at allocation granularity, writable files always grow in these steps.
+    const VMemSize cow_bytes = vmem_align_forward(src->commited, (int)vmem_get_allocation_granularity());
+
+    uint8_t* mem = (uint8_t*)vmem__g_virtual_alloc2(
+        NULL, NULL, src->size_bytes, MEM_RESERVE | VMEM__MEM_RESERVE_PLACEHOLDER, PAGE_NOACCESS, NULL, 0);
+    if(mem == NULL) {
+        vmem__write_win32_error_message();
+        return (VMemArena){0};
+    }
+    if(cow_bytes < src->size_bytes && !VirtualFree(mem, cow_bytes, MEM_RELEASE | VMEM__MEM_PRESERVE_PLACEHOLDER)) {
+        vmem__write_win32_error_message();
+        VirtualFree(mem, 0, MEM_RELEASE);
+        return (VMemArena){0};
+    }
+
+    void* view = cow_bytes > 0 ? NULL : mem;
+    if(cow_bytes > 0) {
+        // Anonymous mappings already are a section, files need a new one, with write-copy access.
+        HANDLE section = (HANDLE)file->handle;
+        if(!(file->flags & VMemMapFlag_Anonymous)) {
+            section = CreateFileMappingA((HANDLE)file->handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        }
+        if(section != NULL) {
+            view = vmem__g_map_view_of_file3(
+                section, NULL, mem, 0, cow_bytes, VMEM__MEM_REPLACE_PLACEHOLDER, PAGE_WRITECOPY, NULL, 0);
+            // The view keeps the section alive.
+            if(section != (HANDLE)file->handle) CloseHandle(section);
+        }
+    }
+    void* tail = mem + cow_bytes;
+    if(view != NULL && cow_bytes < src->size_bytes) {
+        tail = vmem__g_virtual_alloc2(
+            NULL,
+            mem + cow_bytes,
+            src->size_bytes - cow_bytes,
+            MEM_RESERVE | VMEM__MEM_REPLACE_PLACEHOLDER,
+            PAGE_READWRITE,
+            NULL,
+            0);
+    }
+    if(view == NULL || tail == NULL) {
+        vmem__write_win32_error_message();
+        if(view != NULL && cow_bytes > 0) UnmapViewOfFile(mem);
+        else if(cow_bytes > 0) VirtualFree(mem, 0, MEM_RELEASE);
+        if(cow_bytes < src->size_bytes) VirtualFree(mem + cow_bytes, 0, MEM_RELEASE);
+        VMEM_ON_ERROR("Failed to map the copy-on-write view.");
+        return (VMemArena){0};
+    }
+
+    VMemArena arena = *src;
+    arena.mem = mem;
+    arena.file = 0;
+    arena.cow_bytes = cow_bytes;
+    arena.commit_flags = VMemCommitFlag_KeepProtect;
+    return arena;
+}
+
+// The view and the rest of the reservation have to be released separately.
+static VMemResult vmem__win32_dealloc_clone(const VMemArena* arena) {
+    VMemResult result = VMemResult_Success;
+    if(!UnmapViewOfFile(arena->mem)) result = VMemResult_Error;
+    if(arena->cow_bytes < arena->size_bytes && !VirtualFree(arena->mem + arena->cow_bytes, 0, MEM_RELEASE)) {
+        result = VMemResult_Error;
+    }
+    VMEM_ERROR_IF(result == VMemResult_Error, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
+// Blocks grown in place by `vmem_realloc` consist of multiple reservations, but VirtualAlloc, VirtualFree and
+// VirtualProtect only work within a single one. This splits the range by reservations and calls `func` on each part.
+// Only used when the call on the whole range failed, so regular blocks don't pay for the extra queries.
+typedef BOOL (*vmem__Win32RangeFunc)(void* ptr, SIZE_T num_bytes, DWORD arg);
+
+static BOOL vmem__win32_commit_range(void* ptr, const SIZE_T num_bytes, const DWORD protect) {
+    return VirtualAlloc(ptr, num_bytes, MEM_COMMIT, protect) != NULL;
+}
+
+static BOOL vmem__win32_decommit_range(void* ptr, const SIZE_T num_bytes, const DWORD arg) {
+    VMEM_UNUSED(arg);
+    return VirtualFree(ptr, num_bytes, MEM_DECOMMIT);
+}
+
+static BOOL vmem__win32_protect_range(void* ptr, const SIZE_T num_bytes, const DWORD protect) {
+    DWORD old_protect = 0;
+    return VirtualProtect(ptr, num_bytes, protect, &old_protect);
+}
+
+static BOOL vmem__win32_split_by_reservation(
+    void* ptr,
+    const VMemSize num_bytes,
+    const vmem__Win32RangeFunc func,
+    const DWORD arg) {
+    uint8_t* end = (uint8_t*)ptr + num_bytes;
+    for(uint8_t* address = (uint8_t*)ptr; address < end;) {
+        MEMORY_BASIC_INFORMATION info;
+        if(VirtualQuery(address, &info, sizeof(info)) == 0 || info.State == MEM_FREE) return FALSE;
+        const PVOID reservation = info.AllocationBase;
+        uint8_t* next = (uint8_t*)info.BaseAddress + info.RegionSize;
+        while(next < end && VirtualQuery(next, &info, sizeof(info)) && info.AllocationBase == reservation) {
+            next = (uint8_t*)info.BaseAddress + info.RegionSize;
+        }
+        if(next > end) next = end;
+        // Only do more than one call when there actually are multiple reservations.
+        if(address == ptr && next == end) return FALSE;
+        if(!func(address, (SIZE_T)(next - address), arg)) return FALSE;
+        address = next;
+    }
+    return TRUE;
+}
+
+VMEM_FUNC VMemResult
+vmem_commit_ex(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    return vmem_commit_unchecked(ptr, num_bytes, protect, flags);
+}
+
+VMEM_FUNC VMemResult
+vmem_commit_unchecked(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const VMemCommitFlags flags) {
+    VMEM__STATS_START();
+    const DWORD protect_win32 = vmem__win32_protect(protect);
+    const int result = VirtualAlloc(ptr, num_bytes, MEM_COMMIT, protect_win32) != NULL ||
+                       vmem__win32_split_by_reservation(ptr, num_bytes, vmem__win32_commit_range, protect_win32);
+    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+
+    if((flags & VMemCommitFlag_Populate) && protect != VMemProtect_NoAccess) {
+        if(!vmem__win32_prefetch(ptr, num_bytes)) vmem__touch_pages(ptr, num_bytes, protect);
+    }
+    VMEM__STATS_RECORD(VMemEvent_Commit, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_decommit(void* ptr, const VMemSize num_bytes) {
+    return vmem_decommit_ex(ptr, num_bytes, VMemCommitFlag_None);
+}
+
+VMEM_FUNC VMemResult vmem_decommit_ex(void* ptr, const VMemSize num_bytes, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    return vmem_decommit_unchecked(ptr, num_bytes, flags);
+}
+
+VMEM_FUNC VMemResult vmem_decommit_unchecked(void* ptr, const VMemSize num_bytes, const VMemCommitFlags flags) {
+    VMEM__STATS_START();
+    if(flags & VMemCommitFlag_LazyDecommit) {
+        // The pages stay commited, but the system can discard them instead of writing them to the pagefile.
+        // Note: the protection argument is ignored with MEM_RESET, but it must be valid.
+        const LPVOID result = VirtualAlloc(ptr, num_bytes, MEM_RESET, PAGE_NOACCESS);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    } else {
+        const BOOL result = VirtualFree(ptr, num_bytes, MEM_DECOMMIT) ||
+                            vmem__win32_split_by_reservation(ptr, num_bytes, vmem__win32_decommit_range, 0);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    }
+    VMEM__STATS_RECORD(VMemEvent_Decommit, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    VMEM__STATS_START();
+    DWORD old_protect = 0;
+    const DWORD protect_win32 = vmem__win32_protect(protect);
+    const BOOL result = VirtualProtect(ptr, num_bytes, protect_win32, &old_protect) ||
+                        vmem__win32_split_by_reservation(ptr, num_bytes, vmem__win32_protect_range, protect_win32);
+    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Protect, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemSize vmem_query_page_size(void) {
+    SYSTEM_INFO system_info = {0};
+    GetSystemInfo(&system_info);
+    return system_info.dwPageSize;
+}
+
+VMEM_FUNC VMemSize vmem_query_allocation_granularity(void) {
+    SYSTEM_INFO system_info = {0};
+    GetSystemInfo(&system_info);
+    return system_info.dwAllocationGranularity;
+}
+
+VMEM_FUNC VMemSize vmem_query_large_page_size(void) {
+    return (VMemSize)GetLargePageMinimum();
+}
+
+VMEM_FUNC VMemUsageStatus vmem_query_usage_status(void) {
+    MEMORYSTATUS status = {0};
+    GlobalMemoryStatus(&status);
+
+    VMemUsageStatus usage_status = {0};
+    usage_status.total_physical_bytes = status.dwTotalPhys;
+    usage_status.avail_physical_bytes = status.dwAvailPhys;
+
+    // Limits of the job object the process belongs to, e.g. a container. Use the lower of the process and job limit.
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION job_info = {0};
+    if(QueryInformationJobObject(NULL, JobObjectExtendedLimitInformation, &job_info, sizeof(job_info), NULL)) {
+        const DWORD limit_flags = job_info.BasicLimitInformation.LimitFlags;
+        if(limit_flags & JOB_OBJECT_LIMIT_PROCESS_MEMORY) usage_status.limit_bytes = job_info.ProcessMemoryLimit;
+        if((limit_flags & JOB_OBJECT_LIMIT_JOB_MEMORY) &&
+           (usage_status.limit_bytes == 0 || job_info.JobMemoryLimit < usage_status.limit_bytes)) {
+            usage_status.limit_bytes = job_info.JobMemoryLimit;
+        }
+    }
+
+    return usage_status;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_init(VMemPressureMonitor* monitor, const VMemSize stall_us) {
+    VMEM_ERROR_IF(monitor == 0, vmem__write_error_message("Monitor pointer is null."));
+    VMEM_UNUSED(stall_us);
+    const HANDLE handle = CreateMemoryResourceNotification(LowMemoryResourceNotification);
+    VMEM_ERROR_IF(handle == NULL, vmem__write_win32_error_message());
+    monitor->handle = (intptr_t)handle;
+    monitor->source = VMemPressureSource_Win32;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_deinit(VMemPressureMonitor* monitor) {
+    VMEM_ERROR_IF(
+        monitor == 0 || monitor->source == VMemPressureSource_None,
+        vmem__write_error_message("Monitor isn't initialized."));
+    const BOOL result = CloseHandle((HANDLE)monitor->handle);
+    monitor->handle = 0;
+    monitor->source = VMemPressureSource_None;
+    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_wait(VMemPressureMonitor* monitor, const int timeout_ms) {
+    VMEM_ERROR_IF(
+        monitor == 0 || monitor->source == VMemPressureSource_None,
+        vmem__write_error_message("Monitor isn't initialized."));
+    const DWORD result = WaitForSingleObject((HANDLE)monitor->handle, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms);
+    VMEM_ERROR_IF(result == WAIT_FAILED, vmem__write_win32_error_message());
+    return result == WAIT_OBJECT_0;
+}
+
+VMEM_FUNC int vmem_query_numa_node_count(void) {
+    ULONG highest_node = 0;
+    if(!GetNumaHighestNodeNumber(&highest_node)) return 1;
+    return (int)highest_node + 1;
+}
+
+VMEM_FUNC VMemUsageStatus vmem_query_numa_node_usage_status(const int node) {
+    VMemUsageStatus usage_status = {0};
+    ULONGLONG avail_bytes = 0;
+    if(GetNumaAvailableMemoryNodeEx((USHORT)node, &avail_bytes)) {
+        usage_status.avail_physical_bytes = (VMemSize)avail_bytes;
+    } else {
+        vmem__write_win32_error_message();
+    }
+    return usage_status;
+}
+
+static DWORD vmem__win32_numa_node(const int node) {
+    return node < 0 ? NUMA_NO_PREFERRED_NODE : (DWORD)node;
+}
+
+VMEM_FUNC void* vmem_alloc_numa(const VMemSize num_bytes, const VMemProtect protect, const int node) {
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Cannot allocate memory block with size 0 bytes."));
+    const DWORD protect_win32 = vmem__win32_protect(protect);
+    if(protect_win32 == 0) return 0;
+
+    // The preferred node is stored with the reservation, later commits use it too.
+    void* address = VirtualAllocExNuma(
+        GetCurrentProcess(), NULL, (SIZE_T)num_bytes, MEM_RESERVE, protect_win32, vmem__win32_numa_node(node));
+    VMEM_ERROR_IF(address == NULL, vmem__write_win32_error_message());
+    return address;
+}
+
+VMEM_FUNC VMemResult vmem_commit_numa(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const int node) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    const DWORD protect_win32 = vmem__win32_protect(protect);
+    if(protect_win32 == 0) return VMemResult_Error;
+
+    const HANDLE process = GetCurrentProcess();
+    if(node != VMemNumaNode_Interleave) {
+        const LPVOID result =
+            VirtualAllocExNuma(process, ptr, (SIZE_T)num_bytes, MEM_COMMIT, protect_win32, vmem__win32_numa_node(node));
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+        return VMemResult_Success;
+    }
+
+    // Node numbers can have gaps, only interleave over the nodes which actually have processors.
+    USHORT nodes[64];
+    int num_nodes = 0;
+    const int highest_node = vmem_query_numa_node_count();
+    for(int i = 0; i < highest_node && num_nodes < (int)(sizeof(nodes) / sizeof(nodes[0])); i++) {
+        GROUP_AFFINITY affinity = {0};
+        if(!GetNumaNodeProcessorMaskEx((USHORT)i, &affinity) || affinity.Mask == 0) continue;
+        nodes[num_nodes++] = (USHORT)i;
+    }
+    if(num_nodes == 0) {
+        const LPVOID result = VirtualAlloc(ptr, (SIZE_T)num_bytes, MEM_COMMIT, protect_win32);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+        return VMemResult_Success;
+    }
+
+    const VMemSize chunk_size = 1024 * 1024;
+    // Chunks are aligned to the address, so committing adjacent ranges continues the same pattern.
+    for(uintptr_t address = (uintptr_t)ptr; address < (uintptr_t)ptr + num_bytes;) {
+        uintptr_t end = vmem_align_forward_fast(address + 1, (int)chunk_size);
+        if(end > (uintptr_t)ptr + num_bytes) end = (uintptr_t)ptr + num_bytes;
+        const DWORD chunk_node = nodes[(address / chunk_size) % (uintptr_t)num_nodes];
+        const LPVOID result =
+            VirtualAllocExNuma(process, (void*)address, (SIZE_T)(end - address), MEM_COMMIT, protect_win32, chunk_node);
+        VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+        address = end;
+    }
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_lock(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    const BOOL result = VirtualLock(ptr, num_bytes);
+    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_unlock(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    if(num_bytes == 0) return 0;
+
+    const BOOL result = VirtualUnlock(ptr, num_bytes);
+    VMEM_ERROR_IF(result == 0, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
+// QueryWorkingSetEx lives in psapi, but kernel32 exports it as K32QueryWorkingSetEx since Windows 7.
+// It's loaded dynamically so users don't have to link psapi.
+typedef struct vmem__Win32WorkingSetExInfo {
+    PVOID VirtualAddress;
+    ULONG_PTR VirtualAttributes; // Bit 0 is set when the page is valid (resident).
+} vmem__Win32WorkingSetExInfo;
+
+typedef BOOL(WINAPI* vmem__Win32QueryWorkingSetExFunc)(HANDLE, PVOID, DWORD);
+
+VMEM_FUNC VMemSize vmem_query_resident_bytes(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    static vmem__Win32QueryWorkingSetExFunc query_func = NULL;
+    if(query_func == NULL) {
+        const HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+        if(kernel32) {
+            query_func = (vmem__Win32QueryWorkingSetExFunc)(void*)GetProcAddress(kernel32, "K32QueryWorkingSetEx");
+        }
+        VMEM_ERROR_IF(query_func == NULL, vmem__write_error_message("QueryWorkingSetEx isn't available."));
+    }
+
+    const VMemSize page_size = vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, (int)page_size);
+    const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, (int)page_size);
+
+    vmem__Win32WorkingSetExInfo infos[256];
+    VMemSize result = 0;
+    for(uintptr_t address = begin; address < end;) {
+        DWORD num_infos = 0;
+        for(; num_infos < 256 && address < end; num_infos++, address += page_size) {
+            infos[num_infos].VirtualAddress = (PVOID)address;
+        }
+        const BOOL ok = query_func(GetCurrentProcess(), infos, num_infos * sizeof(infos[0]));
+        VMEM_ERROR_IF(ok == 0, vmem__write_win32_error_message());
+        for(DWORD i = 0; i < num_infos; i++) {
+            if(infos[i].VirtualAttributes & 1) result += page_size;
+        }
+    }
+    return result;
+}
+
+VMEM_FUNC VMemSize
+vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_buf, const VMemSize buf_max_items) {
     VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
     VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
     VMEM_ERROR_IF(out_buf == 0, vmem__write_error_message("Out buffer ptr cannot be null."));
@@ -630,6 +2455,9 @@ vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_bu
         result_info.size_bytes = info.RegionSize;
         result_info.protect = vmem__protect_from_win32(protect);
         result_info.is_commited = info.State == MEM_COMMIT;
+        if(result_info.is_commited) {
+            result_info.resident_bytes = vmem_query_resident_bytes(info.BaseAddress, info.RegionSize);
+        }
         out_buf[item_index] = result_info;
 
         i += info.RegionSize;
@@ -638,6 +2466,33 @@ vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_bu
     return item_index;
 }
 
+VMEM_FUNC VMemResult vmem_get_dirty_pages(
+    void* ptr,
+    const VMemSize num_bytes,
+    void** out_pages,
+    VMemSize* inout_num_pages,
+    const int reset) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(out_pages == 0 || inout_num_pages == 0, vmem__write_error_message("Out pages cannot be null."));
+
+    ULONG_PTR count = (ULONG_PTR)*inout_num_pages;
+    ULONG granularity = 0;
+    const UINT result =
+        GetWriteWatch(reset ? WRITE_WATCH_FLAG_RESET : 0, ptr, num_bytes, out_pages, &count, &granularity);
+    VMEM_ERROR_IF(result != 0, vmem__write_win32_error_message());
+    *inout_num_pages = (VMemSize)count;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_reset_dirty_pages(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    const UINT result = ResetWriteWatch(ptr, num_bytes);
+    VMEM_ERROR_IF(result != 0, vmem__write_win32_error_message());
+    return VMemResult_Success;
+}
+
 #endif // defined(VMEM_PLATFORM_WIN32)
 
 
@@ -646,6 +2501,146 @@ vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_bu
 // Linux backend implementation
 //
 #if defined(VMEM_PLATFORM_LINUX)
+#if defined(MAP_HUGE_SHIFT)
+#define VMEM__MAP_HUGE_SHIFT MAP_HUGE_SHIFT
+#else
+#define VMEM__MAP_HUGE_SHIFT 26
+#endif
+
+#if defined(MADV_POPULATE_READ)
+#define VMEM__MADV_POPULATE_READ MADV_POPULATE_READ
+#define VMEM__MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#else
+#define VMEM__MADV_POPULATE_READ 22
+#define VMEM__MADV_POPULATE_WRITE 23
+#endif
+
+#if defined(MADV_FREE)
+#define VMEM__MADV_FREE MADV_FREE
+#else
+#define VMEM__MADV_FREE 8
+#endif
+
+// userfaultfd and PAGEMAP_SCAN definitions, most system headers don't have the new features yet.
+#define VMEM__UFFD_API 0xAA
+#define VMEM__UFFD_USER_MODE_ONLY 1
+#define VMEM__UFFD_FEATURE_WP_ASYNC (1 << 15)
+#define VMEM__UFFDIO_REGISTER_MODE_WP (1 << 1)
+#define VMEM__UFFDIO_WRITEPROTECT_MODE_WP (1 << 0)
+#define VMEM__PM_SCAN_WP_MATCHING (1 << 0)
+#define VMEM__PM_SCAN_CHECK_WPASYNC (1 << 1)
+#define VMEM__PAGE_IS_WRITTEN (1 << 1)
+
+typedef struct vmem__LinuxUffdioApi {
+    uint64_t api;
+    uint64_t features;
+    uint64_t ioctls;
+} vmem__LinuxUffdioApi;
+
+typedef struct vmem__LinuxUffdioRange {
+    uint64_t start;
+    uint64_t len;
+} vmem__LinuxUffdioRange;
+
+typedef struct vmem__LinuxUffdioRegister {
+    vmem__LinuxUffdioRange range;
+    uint64_t mode;
+    uint64_t ioctls;
+} vmem__LinuxUffdioRegister;
+
+typedef struct vmem__LinuxUffdioWriteProtect {
+    vmem__LinuxUffdioRange range;
+    uint64_t mode;
+} vmem__LinuxUffdioWriteProtect;
+
+typedef struct vmem__LinuxPageRegion {
+    uint64_t start;
+    uint64_t end;
+    uint64_t categories;
+} vmem__LinuxPageRegion;
+
+typedef struct vmem__LinuxPmScanArg {
+    uint64_t size;
+    uint64_t flags;
+    uint64_t start;
+    uint64_t end;
+    uint64_t walk_end;
+    uint64_t vec;
+    uint64_t vec_len;
+    uint64_t max_pages;
+    uint64_t category_inverted;
+    uint64_t category_mask;
+    uint64_t category_anyof_mask;
+    uint64_t return_mask;
+} vmem__LinuxPmScanArg;
+
+#define VMEM__UFFDIO_API _IOWR(VMEM__UFFD_API, 0x3F, vmem__LinuxUffdioApi)
+#define VMEM__UFFDIO_REGISTER _IOWR(VMEM__UFFD_API, 0x00, vmem__LinuxUffdioRegister)
+#define VMEM__UFFDIO_WRITEPROTECT _IOWR(VMEM__UFFD_API, 0x06, vmem__LinuxUffdioWriteProtect)
+#define VMEM__PAGEMAP_SCAN _IOWR('f', 16, vmem__LinuxPmScanArg)
+
+// File descriptor + 1 of the userfaultfd shared by all `VMemAllocFlag_WriteWatch` allocations, `(VMemSize)-1` when
+// async write-protection isn't supported.
+static volatile VMemSize vmem__g_linux_uffd = 0;
+
+// @returns the shared userfaultfd, or -1 when it isn't supported.
+static int vmem__linux_get_uffd(void) {
+    VMemSize value = vmem__atomic_load(&vmem__g_linux_uffd);
+    if(value == 0) {
+        int fd = -1;
+#if defined(SYS_userfaultfd)
+        int uffd_flags = O_NONBLOCK;
+#if defined(O_CLOEXEC)
+        uffd_flags |= O_CLOEXEC;
+#endif
+        // User mode only faults are allowed for unprivileged processes (vm.unprivileged_userfaultfd = 0).
+        fd = (int)syscall(SYS_userfaultfd, uffd_flags | VMEM__UFFD_USER_MODE_ONLY);
+        if(fd < 0) fd = (int)syscall(SYS_userfaultfd, uffd_flags);
+        if(fd >= 0) {
+            // With WP_ASYNC the kernel resolves the write-protect faults on its own, no handler thread is needed.
+            vmem__LinuxUffdioApi api = {0};
+            api.api = VMEM__UFFD_API;
+            api.features = VMEM__UFFD_FEATURE_WP_ASYNC;
+            if(ioctl(fd, VMEM__UFFDIO_API, &api) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+        const VMemSize new_value = fd >= 0 ? (VMemSize)fd + 1 : (VMemSize)-1;
+        if(vmem__atomic_cas(&vmem__g_linux_uffd, 0, new_value)) {
+            value = new_value;
+        } else {
+            // Another thread was faster.
+            if(fd >= 0) close(fd);
+            value = vmem__atomic_load(&vmem__g_linux_uffd);
+        }
+    }
+    return value == (VMemSize)-1 ? -1 : (int)(value - 1);
+}
+
+static int vmem__linux_write_protect(const int uffd, const uintptr_t begin, const uintptr_t end) {
+    vmem__LinuxUffdioWriteProtect write_protect = {{0}};
+    write_protect.range.start = begin;
+    write_protect.range.len = end - begin;
+    write_protect.mode = VMEM__UFFDIO_WRITEPROTECT_MODE_WP;
+    return ioctl(uffd, VMEM__UFFDIO_WRITEPROTECT, &write_protect) == 0;
+}
+
+// Register a new allocation for async write-protection. Pages which were never touched don't need to be protected,
+// their first write faults in a page which is reported as written.
+// When userfaultfd isn't supported this does nothing and the soft-dirty bits are used instead.
+// @returns 0 when the registration failed.
+static int vmem__linux_write_watch_register(void* ptr, const VMemSize num_bytes) {
+    const int uffd = vmem__linux_get_uffd();
+    if(uffd < 0) return 1;
+    vmem__LinuxUffdioRegister reg = {{0}};
+    reg.range.start = (uint64_t)(uintptr_t)ptr;
+    reg.range.len = vmem_align_forward_fast(num_bytes, (int)vmem_get_page_size());
+    reg.mode = VMEM__UFFDIO_REGISTER_MODE_WP;
+    return ioctl(uffd, VMEM__UFFDIO_REGISTER, &reg) == 0;
+}
+
 static int vmem__linux_protect(const VMemProtect protect) {
     switch(protect) {
         case VMemProtect_NoAccess: return PROT_NONE;
@@ -656,7 +2651,8 @@ static int vmem__linux_protect(const VMemProtect protect) {
         case VMemProtect_ExecuteReadWrite: return PROT_EXEC | PROT_READ | PROT_WRITE;
     }
     vmem__write_error_message("Invalid protect mode.");
-    return VMemResult_Error;
+    // PROT_NONE is 0, so the error has to be a different value.
+    return -1;
 }
 
 #if !defined(VMEM_NO_ERROR_MESSAGES)
@@ -672,17 +2668,58 @@ static void vmem__write_linux_error_message(void) {
     }
 #endif
 }
+#else
+#define vmem__write_linux_error_message() // Ignore
 #endif
 
-VMEM_FUNC void* vmem_alloc_protect(const VMemSize num_bytes, const VMemProtect protect) {
+VMEM_FUNC void* vmem_alloc_ex(const VMemSize num_bytes, const VMemProtect protect, const VMemAllocFlags flags) {
     VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
 
+    const VMemSize page_size = vmem_get_page_size_for_flags(flags);
+    if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) {
+        VMEM_ERROR_IF(page_size == 0, vmem__write_error_message("Large pages aren't supported."));
+        VMEM_ERROR_IF(
+            num_bytes % page_size != 0,
+            vmem__write_error_message("Size of a large page allocation must be a multiple of the large page size."));
+    }
+
     const int prot = vmem__linux_protect(protect);
-    if(prot) {
-        const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
-        // Note: memory is always initialized to zero when using MAP_ANONYMOUS.
-        void* result = mmap(0, num_bytes, prot, flags, -1, 0);
-        VMEM_ERROR_IF(result == MAP_FAILED, vmem__write_linux_error_message());
+    if(prot != -1) {
+        VMEM__STATS_START();
+        const int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void* result = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+        if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) {
+            // Explicit hugetlb pages are only available when the system has some reserved (vm.nr_hugepages),
+            // otherwise this fails and we fall back to transparent huge pages below.
+            // MAP_HUGE_* encodes log2 of the page size, so the queried size is used instead of assuming 2MB.
+            int page_shift = 0;
+            while(((VMemSize)1 << page_shift) < page_size) page_shift++;
+            const int huge_flags = MAP_HUGETLB | (page_shift << VMEM__MAP_HUGE_SHIFT);
+            result = mmap(0, num_bytes, prot, mmap_flags | huge_flags, -1, 0);
+        }
+#endif
+
+        if(result == MAP_FAILED) {
+            // Note: memory is always initialized to zero when using MAP_ANONYMOUS.
+            result = mmap(0, num_bytes, prot, mmap_flags, -1, 0);
+            VMEM_ERROR_IF(result == MAP_FAILED, vmem__write_linux_error_message());
+
+#if defined(MADV_HUGEPAGE)
+            if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages | VMemAllocFlag_TransparentLargePages)) {
+                // This is only a hint, THP can be disabled on the system. So the error is ignored.
+                madvise(result, num_bytes, MADV_HUGEPAGE);
+            }
+#endif
+        }
+        if((flags & VMemAllocFlag_WriteWatch) && !vmem__linux_write_watch_register(result, num_bytes)) {
+            vmem__write_linux_error_message();
+            munmap(result, num_bytes);
+            VMEM_ON_ERROR("Failed to register the memory for write tracking.");
+            return 0;
+        }
+        VMEM__STATS_RECORD(VMemEvent_Alloc, result, num_bytes);
         return result;
     }
     return 0; // VMemResult_Error
@@ -694,40 +2731,399 @@ VMEM_FUNC VMemResult vmem_dealloc(void* ptr, const VMemSize num_allocated_bytes)
         num_allocated_bytes == 0,
         vmem__write_error_message("Cannot dealloc a memory block of size 0 (num_allocated_bytes is 0)."));
 
+    VMEM__STATS_START();
     const int result = munmap(ptr, num_allocated_bytes);
     VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Dealloc, ptr, num_allocated_bytes);
     return VMemResult_Success;
 }
 
-VMEM_FUNC VMemResult vmem_commit_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
-    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+#define VMEM__MREMAP_MAYMOVE 1
+#define VMEM__MREMAP_FIXED 2
 
-    // On linux the pages are created in a reserved state and automatically commited on the first write, so we don't
-    // need to commit anything.
-    // But for compatibility with other platforms, we have to set the protection level.
-    vmem_protect(ptr, num_bytes, protect);
-    return VMemResult_Success;
+// mremap is called through syscall, glibc only declares it with _GNU_SOURCE.
+static void*
+vmem__linux_mremap(void* ptr, const VMemSize old_size, const VMemSize new_size, const int flags, void* dst) {
+    return (void*)syscall(SYS_mremap, ptr, (size_t)old_size, (size_t)new_size, flags, dst);
 }
 
-VMEM_FUNC VMemResult vmem_decommit(void* ptr, const VMemSize num_bytes) {
+VMEM_FUNC void* vmem_realloc(void* ptr, const VMemSize old_size, const VMemSize new_size) {
     VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(old_size == 0 || new_size == 0, vmem__write_error_message("Size cannot be 0."));
 
-    const int result = madvise(ptr, num_bytes, MADV_DONTNEED);
-    VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
-    return VMemResult_Success;
-}
+    VMEM__STATS_START();
+    const VMemSize page_size = vmem_get_page_size();
+    const VMemSize old_pages = vmem_align_forward(old_size, (int)page_size);
+    const VMemSize new_pages = vmem_align_forward(new_size, (int)page_size);
+    if(new_pages == old_pages) return ptr;
+    if(new_pages < old_pages) {
+        const int unmap_result = munmap((uint8_t*)ptr + new_pages, old_pages - new_pages);
+        VMEM_ERROR_IF(unmap_result != 0, vmem__write_linux_error_message());
+        VMEM__STATS_RECORD(VMemEvent_Dealloc, (uint8_t*)ptr + new_pages, old_pages - new_pages);
+        return ptr;
+    }
 
-VMEM_FUNC VMemResult vmem_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
-    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
-    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    void* result = vmem__linux_mremap(ptr, old_pages, new_pages, VMEM__MREMAP_MAYMOVE, 0);
+    if(result != MAP_FAILED) {
+        VMEM__STATS_RECORD(VMemEvent_Alloc, result, new_pages - old_pages);
+        return result;
+    }
+    // mremap can only grow a single mapping. Blocks with pages of different protection consist of multiple mappings,
+    // move them one by one into a new block.
+    VMEM_ERROR_IF(errno != EFAULT, vmem__write_linux_error_message());
+
+    VMemRangeInfo last_page = {0};
+    uint8_t* last_page_ptr = (uint8_t*)ptr + old_pages - page_size;
+    const VMemSize num_last_ranges = vmem_query_range_info(last_page_ptr, page_size, &last_page, 1);
+    VMEM_ERROR_IF(num_last_ranges != 1, vmem__write_error_message("Failed to query the protection of the block."));
+
+    // Query all of the ranges before anything is moved, so the old block stays intact when a query fails.
+    VMemSize max_ranges = 64;
+    VMemSize num_ranges = 0;
+    VMemRangeInfo* ranges = 0;
+    for(;;) {
+        ranges = (VMemRangeInfo*)vmem_alloc_commited(max_ranges * sizeof(VMemRangeInfo));
+        if(ranges == 0) return 0;
+        num_ranges = vmem_query_range_info(ptr, old_pages, ranges, max_ranges);
+        if(num_ranges == 0) {
+            vmem_dealloc(ranges, max_ranges * sizeof(VMemRangeInfo));
+            return 0;
+        }
+        const VMemRangeInfo last = ranges[num_ranges - 1];
+        if((uint8_t*)last.ptr + last.size_bytes >= (uint8_t*)ptr + old_pages) break;
+        vmem_dealloc(ranges, max_ranges * sizeof(VMemRangeInfo));
+        max_ranges *= 4;
+    }
 
-    const int result = mprotect(ptr, num_bytes, vmem__linux_protect(protect));
+    uint8_t* dst = (uint8_t*)vmem_alloc_protect(new_pages, last_page.protect);
+    if(dst == 0) {
+        vmem_dealloc(ranges, max_ranges * sizeof(VMemRangeInfo));
+        return 0;
+    }
+    for(VMemSize i = 0; i < num_ranges; i++) {
+        const VMemRangeInfo range = ranges[i];
+        const VMemSize range_offset = (VMemSize)((uint8_t*)range.ptr - (uint8_t*)ptr);
+        const int moved = vmem__linux_mremap(
+                              range.ptr,
+                              range.size_bytes,
+                              range.size_bytes,
+                              VMEM__MREMAP_MAYMOVE | VMEM__MREMAP_FIXED,
+                              dst + range_offset) != MAP_FAILED;
+        if(!moved) {
+            // Adjacent mappings with the same protection which the kernel didn't merge.
+            mprotect(dst + range_offset, range.size_bytes, PROT_READ | PROT_WRITE);
+            if(vmem__is_readable(range.protect)) memcpy(dst + range_offset, range.ptr, range.size_bytes);
+            mprotect(dst + range_offset, range.size_bytes, vmem__linux_protect(range.protect));
+        }
+    }
+    vmem_dealloc(ranges, max_ranges * sizeof(VMemRangeInfo));
+    // Unmaps whatever wasn't moved.
+    vmem_dealloc(ptr, old_pages);
+    return dst;
+}
+
+// Anonymous file in memory which can be mapped multiple times.
+// memfd_create is called through syscall, so it works without _GNU_SOURCE and on older glibc.
+// @returns file descriptor, or -1 on failure.
+static int vmem__linux_memfd_create(const char* name, const VMemSize num_bytes) {
+#if defined(SYS_memfd_create)
+    const unsigned int mfd_cloexec = 1; // MFD_CLOEXEC
+    const int fd = (int)syscall(SYS_memfd_create, name, mfd_cloexec);
+    if(fd < 0) return -1;
+    if(ftruncate(fd, (off_t)num_bytes) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    VMEM_UNUSED(name);
+    VMEM_UNUSED(num_bytes);
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+VMEM_FUNC void* vmem_alloc_ring_buffer(const VMemSize num_bytes) {
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(
+        num_bytes % vmem_get_allocation_granularity() != 0,
+        vmem__write_error_message("Ring buffer size must be a multiple of allocation granularity."));
+
+    VMEM__STATS_START();
+    const int fd = vmem__linux_memfd_create("vmem_ring_buffer", num_bytes);
+    VMEM_ERROR_IF(fd < 0, vmem__write_linux_error_message());
+
+    // Reserve space for both halves first, so the fixed mappings can't clobber anything else.
+    uint8_t* base = (uint8_t*)mmap(0, 2 * num_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        vmem__write_linux_error_message();
+        close(fd);
+        return 0;
+    }
+
+    const int prot = PROT_READ | PROT_WRITE;
+    void* view0 = mmap(base, num_bytes, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+    void* view1 = MAP_FAILED;
+    if(view0 != MAP_FAILED) view1 = mmap(base + num_bytes, num_bytes, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+    // The mappings keep the file alive.
+    close(fd);
+    if(view0 == MAP_FAILED || view1 == MAP_FAILED) {
+        vmem__write_linux_error_message();
+        munmap(base, 2 * num_bytes);
+        return 0;
+    }
+    VMEM__STATS_RECORD(VMemEvent_Alloc, base, 2 * num_bytes);
+    return base;
+}
+
+VMEM_FUNC VMemResult vmem_dealloc_ring_buffer(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    VMEM__STATS_START();
+    const int result = munmap(ptr, 2 * num_bytes);
+    VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Dealloc, ptr, 2 * num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC void* vmem_alloc_aligned(const VMemSize num_bytes, const VMemSize align, const VMemProtect protect) {
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(
+        align == 0 || (align & (align - 1)) != 0,
+        vmem__write_error_message("Alignment must be a power of 2."));
+    const VMemSize page_size = vmem_get_page_size();
+    if(align <= page_size) return vmem_alloc_protect(num_bytes, protect);
+    const int prot = vmem__linux_protect(protect);
+    if(prot == -1) return 0;
+
+    const VMemSize size = vmem_align_forward(num_bytes, (int)page_size);
+    const VMemSize total = size + align - page_size;
+    VMEM_ERROR_IF(total < size, vmem__write_error_message("Size is too big for the alignment."));
+    VMEM__STATS_START();
+    // Over-reserve, so an aligned block always fits, then unmap everything around it.
+    uint8_t* base = (uint8_t*)mmap(0, total, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    VMEM_ERROR_IF(base == MAP_FAILED, vmem__write_linux_error_message());
+    uint8_t* result = (uint8_t*)(((uintptr_t)base + (align - 1)) & ~(uintptr_t)(align - 1));
+    const VMemSize head = (VMemSize)(result - base);
+    const VMemSize tail = total - head - size;
+    if((head && munmap(base, head) != 0) || (tail && munmap(result + size, tail) != 0)) {
+        vmem__write_linux_error_message();
+        // Unmapping a range which is partially unmapped already is fine.
+        munmap(base, total);
+        VMEM_ON_ERROR("Failed to unmap the unaligned parts.");
+        return 0;
+    }
+    VMEM__STATS_RECORD(VMemEvent_Alloc, result, size);
+    return result;
+}
+
+VMEM_FUNC VMemResult vmem_map_file(
+    VMemMappedFile* file,
+    const char* path,
+    const VMemSize size_bytes,
+    const VMemProtect protect,
+    const VMemMapFlags flags) {
+    VMEM_ERROR_IF(file == 0, vmem__write_error_message("File pointer is null."));
+    VMEM_ERROR_IF(path == 0 && !(flags & VMemMapFlag_Anonymous), vmem__write_error_message("Path is null."));
+    VMEM_ERROR_IF(
+        protect != VMemProtect_Read && protect != VMemProtect_ReadWrite,
+        vmem__write_error_message("Mapped files can only be Read or ReadWrite."));
+    const int writable = protect == VMemProtect_ReadWrite;
+    VMEM_ERROR_IF(writable && size_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    VMEM_ERROR_IF(
+        (flags & VMemMapFlag_Anonymous) && !writable,
+        vmem__write_error_message("Anonymous mappings have to be ReadWrite."));
+
+    int fd = -1;
+    if(flags & VMemMapFlag_Anonymous) {
+        // The memfd behaves just like a regular file, it starts empty and grows with `ftruncate`.
+        fd = vmem__linux_memfd_create("vmem_anonymous", 0);
+    } else {
+        int open_flags = writable ? O_RDWR : O_RDONLY;
+        if(flags & VMemMapFlag_Create) open_flags |= O_CREAT;
+        if(flags & VMemMapFlag_Truncate) open_flags |= O_TRUNC;
+#if defined(O_CLOEXEC)
+        open_flags |= O_CLOEXEC;
+#endif
+        fd = open(path, open_flags, 0644);
+    }
+    VMEM_ERROR_IF(fd < 0, vmem__write_linux_error_message());
+
+    VMemMappedFile result = {0};
+    result.protect = protect;
+    result.flags = flags;
+    result.handle = fd;
+    const off_t file_size = lseek(fd, 0, SEEK_END);
+    if(file_size < 0) {
+        vmem__write_linux_error_message();
+        close(fd);
+        return VMemResult_Error;
+    }
+    result.file_size = (VMemSize)file_size;
+    result.size_bytes = vmem_align_forward(size_bytes, (int)vmem_get_page_size());
+    if(!writable && (size_bytes == 0 || size_bytes > result.file_size)) result.size_bytes = result.file_size;
+    if(result.file_size > result.size_bytes) {
+        // Read-only maps can just map a prefix of the file.
+        if(!writable) {
+            result.file_size = result.size_bytes;
+        } else {
+            vmem__write_error_message("File is bigger than the reservation.");
+            close(fd);
+            return VMemResult_Error;
+        }
+    }
+    if(result.size_bytes == 0) {
+        vmem__write_error_message("Cannot map an empty read-only file.");
+        close(fd);
+        return VMemResult_Error;
+    }
+
+    // Mapping past the end of the file is fine, `ftruncate` makes the pages valid later.
+    void* mem = mmap(0, result.size_bytes, vmem__linux_protect(protect), MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED) {
+        vmem__write_linux_error_message();
+        close(fd);
+        return VMemResult_Error;
+    }
+    result.mem = (uint8_t*)mem;
+    *file = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_unmap_file(VMemMappedFile* file) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    const int unmap_result = munmap(file->mem, file->size_bytes);
+    const int close_result = close((int)file->handle);
+    file->mem = 0;
+    VMEM_ERROR_IF(unmap_result != 0 || close_result != 0, vmem__write_linux_error_message());
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_mapped_file_grow(VMemMappedFile* file, const VMemSize file_size) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    if(file_size <= file->file_size) return VMemResult_Success;
+    VMEM_ERROR_IF(file->protect != VMemProtect_ReadWrite, vmem__write_error_message("File is read-only."));
+    VMEM_ERROR_IF(file_size > file->size_bytes, vmem__write_error_message("File cannot grow past the reservation."));
+
+    const VMemSize new_size = vmem_align_forward(file_size, (int)vmem_get_page_size());
+    const int result = ftruncate((int)file->handle, (off_t)new_size);
+    VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    file->file_size = new_size;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult
+vmem_mapped_file_flush(VMemMappedFile* file, const VMemSize offset, VMemSize num_bytes, const VMemFlushFlags flags) {
+    VMEM_ERROR_IF(file == 0 || file->mem == 0, vmem__write_error_message("File isn't mapped."));
+    VMEM_ERROR_IF(offset > file->file_size, vmem__write_error_message("Offset is past the end of the file."));
+    if(num_bytes == 0 || offset + num_bytes > file->file_size) num_bytes = file->file_size - offset;
+    if(num_bytes == 0) return VMemResult_Success;
+
+    // msync needs a page aligned address.
+    const int page_size = (int)vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)file->mem + offset, page_size);
+    const uintptr_t end = (uintptr_t)file->mem + offset + num_bytes;
+    const int result = msync((void*)begin, end - begin, (flags & VMemFlushFlag_Async) ? MS_ASYNC : MS_SYNC);
     VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
     return VMemResult_Success;
 }
 
+VMEM_FUNC VMemArena vmem_arena_clone_cow(const VMemArena* src) {
+    if(src == 0 || src->mem == 0 || src->file == 0) {
+        vmem__write_error_message("Only arenas on mapped files can be cloned.");
+        return (VMemArena){0};
+    }
+    // The clone is a regular reservation, with a private mapping of the file over the commited part.
+    uint8_t* mem = (uint8_t*)vmem_alloc_ex(src->size_bytes, VMemProtect_ReadWrite, VMemAllocFlag_None);
+    if(mem == 0) return (VMemArena){0};
+    const VMemSize cow_bytes = vmem_align_forward(src->commited, (int)vmem_get_page_size());
+    if(cow_bytes > 0) {
+        const int prot = PROT_READ | PROT_WRITE;
+        void* view = mmap(mem, cow_bytes, prot, MAP_PRIVATE | MAP_FIXED, (int)src->file->handle, 0);
+        if(view == MAP_FAILED) {
+            vmem__write_linux_error_message();
+            vmem_dealloc(mem, src->size_bytes);
+            VMEM_ON_ERROR("Failed to map the copy-on-write view.");
+            return (VMemArena){0};
+        }
+    }
+    VMemArena arena = *src;
+    arena.mem = mem;
+    arena.file = 0;
+    arena.cow_bytes = cow_bytes;
+    arena.commit_flags = VMemCommitFlag_KeepProtect;
+    return arena;
+}
+
+VMEM_FUNC VMemResult
+vmem_commit_ex(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    return vmem_commit_unchecked(ptr, num_bytes, protect, flags);
+}
+
+VMEM_FUNC VMemResult
+vmem_commit_unchecked(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const VMemCommitFlags flags) {
+    // On linux the pages are created in a reserved state and automatically commited on the first write, so we don't
+    // need to commit anything.
+    // But for compatibility with other platforms, we have to set the protection level. Unless the caller knows the
+    // pages already have the right protection, then this is free.
+    VMEM__STATS_START();
+    if(!(flags & VMemCommitFlag_KeepProtect)) {
+        // Not `vmem_protect`, the stats only count the commit.
+        const int result = mprotect(ptr, num_bytes, vmem__linux_protect(protect));
+        VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    }
+
+    if((flags & VMemCommitFlag_Populate) && protect != VMemProtect_NoAccess) {
+        const int write = protect == VMemProtect_ReadWrite || protect == VMemProtect_ExecuteReadWrite;
+        const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, (int)vmem_get_page_size());
+        const size_t len = (size_t)((uintptr_t)ptr + num_bytes - begin);
+        // This requires Linux 5.14, older kernels return EINVAL.
+        if(madvise((void*)begin, len, write ? VMEM__MADV_POPULATE_WRITE : VMEM__MADV_POPULATE_READ) != 0) {
+            vmem__touch_pages(ptr, num_bytes, protect);
+        }
+    }
+    VMEM__STATS_RECORD(VMemEvent_Commit, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_decommit(void* ptr, const VMemSize num_bytes) {
+    return vmem_decommit_ex(ptr, num_bytes, VMemCommitFlag_None);
+}
+
+VMEM_FUNC VMemResult vmem_decommit_ex(void* ptr, const VMemSize num_bytes, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    return vmem_decommit_unchecked(ptr, num_bytes, flags);
+}
+
+VMEM_FUNC VMemResult vmem_decommit_unchecked(void* ptr, const VMemSize num_bytes, const VMemCommitFlags flags) {
+    VMEM__STATS_START();
+    // The kernel only frees lazily decommited pages under memory pressure, until then writes just cancel the free.
+    // MADV_FREE is only supported since 4.5, and not for all kinds of mappings (e.g. shared ones).
+    if(!(flags & VMemCommitFlag_LazyDecommit) || madvise(ptr, num_bytes, VMEM__MADV_FREE) != 0) {
+        VMEM_ERROR_IF((flags & VMemCommitFlag_LazyDecommit) && errno != EINVAL, vmem__write_linux_error_message());
+        const int result = madvise(ptr, num_bytes, MADV_DONTNEED);
+        VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    }
+    VMEM__STATS_RECORD(VMemEvent_Decommit, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_protect(void* ptr, const VMemSize num_bytes, const VMemProtect protect) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    VMEM__STATS_START();
+    const int result = mprotect(ptr, num_bytes, vmem__linux_protect(protect));
+    VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    VMEM__STATS_RECORD(VMemEvent_Protect, ptr, num_bytes);
+    return VMemResult_Success;
+}
+
 VMEM_FUNC VMemSize vmem_query_page_size(void) {
     return (VMemSize)sysconf(_SC_PAGESIZE);
 }
@@ -736,14 +3132,348 @@ VMEM_FUNC VMemSize vmem_query_allocation_granularity(void) {
     return (VMemSize)sysconf(_SC_PAGESIZE);
 }
 
+VMEM_FUNC VMemSize vmem_query_large_page_size(void) {
+    // The default hugetlb page size is in /proc/meminfo, e.g. "Hugepagesize:       2048 kB"
+    const VMemSize default_size = 2 * 1024 * 1024;
+    const int fd = open("/proc/meminfo", O_RDONLY);
+    if(fd < 0) return default_size;
+
+    char buf[4096];
+    const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(len <= 0) return default_size;
+    buf[len] = 0;
+
+    const char* key = strstr(buf, "Hugepagesize:");
+    if(key == 0) return default_size;
+
+    VMemSize size_kb = 0;
+    for(const char* c = key + sizeof("Hugepagesize:") - 1; *c != 0 && *c != '\n'; c++) {
+        if(*c >= '0' && *c <= '9') size_kb = size_kb * 10 + (VMemSize)(*c - '0');
+    }
+    return size_kb ? size_kb * 1024 : default_size;
+}
+
+// Read a small file (e.g. from /proc or /sys) into a zero terminated buffer.
+// @returns number of bytes read, 0 on failure.
+static int vmem__linux_read_file(const char* path, char* buf, const int buf_size) {
+    const int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    const ssize_t len = read(fd, buf, (size_t)buf_size - 1);
+    close(fd);
+    if(len <= 0) return 0;
+    buf[len] = 0;
+    return (int)len;
+}
+
+// Parse the first decimal number after `key`.
+static VMemSize vmem__linux_parse_number_after(const char* str, const char* key) {
+    const char* c = strstr(str, key);
+    if(c == 0) return 0;
+    c += strlen(key);
+    while(*c == ' ' || *c == ':' || *c == '\t') c++;
+    VMemSize result = 0;
+    for(; *c >= '0' && *c <= '9'; c++) {
+        result = result * 10 + (VMemSize)(*c - '0');
+    }
+    return result;
+}
+
+// Write a decimal number, without the zero terminator.
+// @returns end of the written number.
+static char* vmem__linux_write_number(char* out, VMemSize value) {
+    char digits[24];
+    int num_digits = 0;
+    do {
+        digits[num_digits++] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value);
+    while(num_digits) *out++ = digits[--num_digits];
+    return out;
+}
+
+// Directory of the cgroup v2 of the process, e.g. "/sys/fs/cgroup/user.slice".
+// @returns 0 when the process isn't in a cgroup v2.
+static int vmem__linux_query_cgroup_dir(char* dir, const int dir_size) {
+    char buf[1024];
+    if(!vmem__linux_read_file("/proc/self/cgroup", buf, sizeof(buf))) return 0;
+    // The cgroup v2 line is "0::<path>", cgroup v1 lines have a controller name between the colons.
+    const char* line = buf;
+    while(strncmp(line, "0::", 3) != 0) {
+        line = strchr(line, '\n');
+        if(line == 0) return 0;
+        line++;
+    }
+    line += 3;
+    const char* line_end = strchr(line, '\n');
+    const int len = line_end ? (int)(line_end - line) : (int)strlen(line);
+    const int prefix_len = (int)sizeof("/sys/fs/cgroup") - 1;
+    if(prefix_len + len + 1 > dir_size) return 0;
+    memcpy(dir, "/sys/fs/cgroup", (size_t)prefix_len);
+    memcpy(dir + prefix_len, line, (size_t)len);
+    dir[prefix_len + len] = 0;
+    return 1;
+}
+
+// Cached result of `vmem__linux_query_cgroup_dir`, so polling the usage status doesn't read /proc/self/cgroup.
+// Note: moving the process to another cgroup later isn't noticed.
+static char vmem__g_linux_cgroup_dir[512];
+// 0 means not queried yet, 1 is being written, 2 valid, 3 not in a cgroup v2.
+static volatile VMemSize vmem__g_linux_cgroup_state = 0;
+
+// Build the path of a file in the cgroup v2 of the process, e.g. "/sys/fs/cgroup/user.slice/memory.max".
+// @returns 0 when the process isn't in a cgroup v2.
+static int vmem__linux_cgroup_file_path(const char* file, char* path, const int path_size) {
+    char local_dir[sizeof(vmem__g_linux_cgroup_dir)];
+    const char* dir = vmem__g_linux_cgroup_dir;
+    const VMemSize state = vmem__atomic_load(&vmem__g_linux_cgroup_state);
+    if(state == 3) return 0;
+    if(state != 2) {
+        // Threads which race here query it on their own, only the first one publishes the result.
+        const int found = vmem__linux_query_cgroup_dir(local_dir, sizeof(local_dir));
+        if(vmem__atomic_cas(&vmem__g_linux_cgroup_state, 0, found ? 1 : 3) && found) {
+            memcpy(vmem__g_linux_cgroup_dir, local_dir, sizeof(local_dir));
+            vmem__atomic_store(&vmem__g_linux_cgroup_state, 2);
+        }
+        if(!found) return 0;
+        dir = local_dir;
+    }
+    const int dir_len = (int)strlen(dir);
+    const int file_len = (int)strlen(file);
+    if(dir_len + 1 + file_len + 1 > path_size) return 0;
+    memcpy(path, dir, (size_t)dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, file, (size_t)file_len + 1);
+    return 1;
+}
+
 VMEM_FUNC VMemUsageStatus vmem_query_usage_status(void) {
     VMemUsageStatus usage_status = {0};
     const VMemSize page_size = vmem_get_page_size();
     usage_status.total_physical_bytes = (VMemSize)sysconf(_SC_PHYS_PAGES) * page_size;
     usage_status.avail_physical_bytes = (VMemSize)sysconf(_SC_AVPHYS_PAGES) * page_size;
+
+    // Container limits. `memory.max` is "max" when there is no limit, which parses as 0.
+    char path[512];
+    char buf[64];
+    if(vmem__linux_cgroup_file_path("memory.max", path, sizeof(path)) &&
+       vmem__linux_read_file(path, buf, sizeof(buf))) {
+        usage_status.limit_bytes = vmem__linux_parse_number_after(buf, "");
+    }
+    if(vmem__linux_cgroup_file_path("memory.current", path, sizeof(path)) &&
+       vmem__linux_read_file(path, buf, sizeof(buf))) {
+        usage_status.limit_used_bytes = vmem__linux_parse_number_after(buf, "");
+    }
     return usage_status;
 }
 
+// Open a PSI file and register a trigger on it.
+// @returns file descriptor, or -1 on failure.
+static int vmem__linux_psi_trigger(const char* path, const VMemSize stall_us) {
+    int open_flags = O_RDWR | O_NONBLOCK;
+#if defined(O_CLOEXEC)
+    open_flags |= O_CLOEXEC;
+#endif
+    const int fd = open(path, open_flags);
+    if(fd < 0) return -1;
+    // "some <threshold us> <window us>", unprivileged processes need the window to be a multiple of 2 seconds.
+    char trigger[64] = "some ";
+    char* c = vmem__linux_write_number(trigger + 5, stall_us);
+    memcpy(c, " 2000000", sizeof(" 2000000"));
+    if(write(fd, trigger, strlen(trigger) + 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_init(VMemPressureMonitor* monitor, VMemSize stall_us) {
+    VMEM_ERROR_IF(monitor == 0, vmem__write_error_message("Monitor pointer is null."));
+    // The threshold has to be within the window.
+    if(stall_us == 0) stall_us = 1;
+    if(stall_us > 2000000) stall_us = 2000000;
+
+    // Prefer the cgroup of the process, so the pressure of a container is tracked, not of the whole system.
+    char path[512];
+    int fd = -1;
+    if(vmem__linux_cgroup_file_path("memory.pressure", path, sizeof(path))) {
+        fd = vmem__linux_psi_trigger(path, stall_us);
+    }
+    if(fd < 0) fd = vmem__linux_psi_trigger("/proc/pressure/memory", stall_us);
+    if(fd >= 0) {
+        monitor->handle = fd;
+        monitor->source = VMemPressureSource_Psi;
+        return VMemResult_Success;
+    }
+
+    // Without PSI (kernel without CONFIG_PSI), get notified when the cgroup hits its limits.
+    if(vmem__linux_cgroup_file_path("memory.events", path, sizeof(path))) {
+        int open_flags = O_RDONLY;
+#if defined(O_CLOEXEC)
+        open_flags |= O_CLOEXEC;
+#endif
+        fd = open(path, open_flags);
+    }
+    VMEM_ERROR_IF(fd < 0, vmem__write_error_message("Memory pressure notifications aren't supported."));
+    // The file has to be read once, only changes after the last read are signaled.
+    char buf[512];
+    const ssize_t len = read(fd, buf, sizeof(buf));
+    if(len < 0) {
+        vmem__write_linux_error_message();
+        close(fd);
+        VMEM_ON_ERROR("Failed to read memory.events.");
+        return VMemResult_Error;
+    }
+    monitor->handle = fd;
+    monitor->source = VMemPressureSource_CgroupEvents;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_deinit(VMemPressureMonitor* monitor) {
+    VMEM_ERROR_IF(
+        monitor == 0 || monitor->source == VMemPressureSource_None,
+        vmem__write_error_message("Monitor isn't initialized."));
+    const int result = close((int)monitor->handle);
+    monitor->handle = -1;
+    monitor->source = VMemPressureSource_None;
+    VMEM_ERROR_IF(result != 0, vmem__write_linux_error_message());
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_pressure_monitor_wait(VMemPressureMonitor* monitor, const int timeout_ms) {
+    VMEM_ERROR_IF(
+        monitor == 0 || monitor->source == VMemPressureSource_None,
+        vmem__write_error_message("Monitor isn't initialized."));
+    struct pollfd poll_fd;
+    poll_fd.fd = (int)monitor->handle;
+    poll_fd.events = POLLPRI;
+    poll_fd.revents = 0;
+    const int result = poll(&poll_fd, 1, timeout_ms < 0 ? -1 : timeout_ms);
+    if(result < 0 && errno == EINTR) return 0;
+    VMEM_ERROR_IF(result < 0, vmem__write_linux_error_message());
+    if(result == 0 || !(poll_fd.revents & POLLPRI)) return 0;
+
+    if(monitor->source == VMemPressureSource_Psi) {
+        // The trigger is gone, e.g. the cgroup was removed.
+        VMEM_ERROR_IF(poll_fd.revents & POLLERR, vmem__write_error_message("PSI trigger was destroyed."));
+    } else {
+        // Re-read the events, otherwise poll keeps returning the same change.
+        char buf[512];
+        lseek(poll_fd.fd, 0, SEEK_SET);
+        const ssize_t len = read(poll_fd.fd, buf, sizeof(buf));
+        VMEM_UNUSED(len);
+        VMEM_ERROR_IF(len < 0, vmem__write_linux_error_message());
+    }
+    return VMemResult_Success;
+}
+
+// Max supported number of nodes in `vmem__linux_mbind` masks.
+#define VMEM__MAX_NUMA_NODES 1024
+
+VMEM_FUNC int vmem_query_numa_node_count(void) {
+    // Comma separated list of ranges, e.g. "0-1" or "0,2-3".
+    char buf[256];
+    if(!vmem__linux_read_file("/sys/devices/system/node/online", buf, sizeof(buf))) return 1;
+    int highest_node = 0;
+    int value = 0;
+    for(const char* c = buf; *c; c++) {
+        if(*c >= '0' && *c <= '9') {
+            value = value * 10 + (*c - '0');
+            if(value > highest_node) highest_node = value;
+        } else {
+            value = 0;
+        }
+    }
+    return highest_node < VMEM__MAX_NUMA_NODES ? highest_node + 1 : VMEM__MAX_NUMA_NODES;
+}
+
+VMEM_FUNC VMemUsageStatus vmem_query_numa_node_usage_status(const int node) {
+    VMemUsageStatus usage_status = {0};
+    if(node < 0 || node >= VMEM__MAX_NUMA_NODES) {
+        vmem__write_error_message("Invalid NUMA node.");
+        VMEM_ON_ERROR("Invalid NUMA node.");
+        return usage_status;
+    }
+
+    // Build "/sys/devices/system/node/node<N>/meminfo" without printf.
+    char path[96] = "/sys/devices/system/node/node";
+    char* c = vmem__linux_write_number(path + strlen(path), (VMemSize)node);
+    memcpy(c, "/meminfo", sizeof("/meminfo"));
+
+    // e.g. "Node 0 MemTotal:       32772872 kB"
+    char buf[4096];
+    if(!vmem__linux_read_file(path, buf, sizeof(buf))) {
+        // Not a NUMA system, everything is on node 0.
+        if(node == 0) return vmem_query_usage_status();
+        vmem__write_linux_error_message();
+        VMEM_ON_ERROR("Failed to read NUMA node meminfo.");
+        return usage_status;
+    }
+    usage_status.total_physical_bytes = vmem__linux_parse_number_after(buf, "MemTotal") * 1024;
+    usage_status.avail_physical_bytes = vmem__linux_parse_number_after(buf, "MemFree") * 1024;
+    return usage_status;
+}
+
+// Set the NUMA policy of a page aligned range.
+// Keeps the default placement when there is nothing to choose from or the kernel doesn't let us choose.
+static int vmem__linux_mbind(void* ptr, const VMemSize num_bytes, const int node) {
+    if(node != VMemNumaNode_Interleave && (node < 0 || node >= VMEM__MAX_NUMA_NODES)) {
+        errno = EINVAL;
+        return 0;
+    }
+    const int num_nodes = vmem_query_numa_node_count();
+    if(num_nodes <= 1) return 1;
+#if defined(SYS_mbind)
+    const int mpol_preferred = 1;
+    const int mpol_interleave = 3;
+    unsigned long mask[VMEM__MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+    const int bits_per_word = 8 * (int)sizeof(unsigned long);
+    int mode = mpol_preferred;
+    if(node == VMemNumaNode_Interleave) {
+        mode = mpol_interleave;
+        for(int i = 0; i < num_nodes; i++) {
+            mask[i / bits_per_word] |= 1ul << (i % bits_per_word);
+        }
+    } else {
+        mask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+    }
+    const unsigned long max_node = VMEM__MAX_NUMA_NODES + 1;
+    if(syscall(SYS_mbind, ptr, (unsigned long)num_bytes, mode, mask, max_node, 0) == 0) return 1;
+    // ENOSYS: kernel built without CONFIG_NUMA. EPERM: blocked by seccomp (e.g. default Docker profile).
+    return errno == ENOSYS || errno == EPERM;
+#else
+    VMEM_UNUSED(ptr);
+    VMEM_UNUSED(num_bytes);
+    return 1;
+#endif
+}
+
+VMEM_FUNC void* vmem_alloc_numa(const VMemSize num_bytes, const VMemProtect protect, const int node) {
+    void* result = vmem_alloc_ex(num_bytes, protect, VMemAllocFlag_None);
+    if(result == 0 || node == VMemNumaNode_Default) return result;
+    if(!vmem__linux_mbind(result, num_bytes, node)) {
+        vmem__write_linux_error_message();
+        vmem_dealloc(result, num_bytes);
+        return 0;
+    }
+    return result;
+}
+
+VMEM_FUNC VMemResult vmem_commit_numa(void* ptr, const VMemSize num_bytes, const VMemProtect protect, const int node) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    if(node != VMemNumaNode_Default) {
+        // The policy only affects pages faulted in later, so set it before the pages are touched.
+        const int page_size = (int)vmem_get_page_size();
+        const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, page_size);
+        const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, page_size);
+        const int result = vmem__linux_mbind((void*)begin, end - begin, node);
+        VMEM_ERROR_IF(!result, vmem__write_linux_error_message());
+    }
+    return vmem_commit_protect(ptr, num_bytes, protect);
+}
+
 VMEM_FUNC VMemResult vmem_lock(void* ptr, const VMemSize num_bytes) {
     VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
     VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
@@ -762,16 +3492,491 @@ VMEM_FUNC VMemResult vmem_unlock(void* ptr, const VMemSize num_bytes) {
     return VMemResult_Success;
 }
 
+// Count resident bytes in page aligned range [begin...end] with mincore.
+// @returns 0 if any page in the range isn't mapped.
+static int vmem__linux_resident_bytes(const uintptr_t begin, const uintptr_t end, VMemSize* out_resident_bytes) {
+    const VMemSize page_size = vmem_get_page_size();
+    // One byte per page, so the stack buffer covers 16MB with 4KB pages per mincore call.
+    unsigned char vec[4096];
+    VMemSize result = 0;
+    for(uintptr_t address = begin; address < end;) {
+        VMemSize size = end - address;
+        if(size > sizeof(vec) * page_size) size = sizeof(vec) * page_size;
+        if(mincore((void*)address, size, vec) != 0) return 0;
+        const VMemSize num_pages = size / page_size;
+        for(VMemSize i = 0; i < num_pages; i++) {
+            if(vec[i] & 1) result += page_size;
+        }
+        address += size;
+    }
+    *out_resident_bytes = result;
+    return 1;
+}
+
+VMEM_FUNC VMemSize vmem_query_resident_bytes(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    const VMemSize page_size = vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, (int)page_size);
+    const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, (int)page_size);
+    VMemSize result = 0;
+    const int success = vmem__linux_resident_bytes(begin, end, &result);
+    VMEM_ERROR_IF(!success, vmem__write_linux_error_message());
+    return result;
+}
+
+static VMemProtect vmem__protect_from_linux_perms(const char perms[3]) {
+    const int read = perms[0] == 'r';
+    const int write = perms[1] == 'w';
+    const int execute = perms[2] == 'x';
+    if(execute) return write ? VMemProtect_ExecuteReadWrite : (read ? VMemProtect_ExecuteRead : VMemProtect_Execute);
+    if(write) return VMemProtect_ReadWrite;
+    if(read) return VMemProtect_Read;
+    return VMemProtect_NoAccess;
+}
+
+// Add a range to the query results, merge it with the previous one if they have the same state.
+static int vmem__range_info_append(
+    VMemRangeInfo* out_buf,
+    VMemSize* num_items,
+    const VMemSize buf_max_items,
+    const uintptr_t begin,
+    const uintptr_t end,
+    const VMemProtect protect,
+    const int is_mapped) {
+    VMemSize resident_bytes = 0;
+    if(is_mapped) vmem__linux_resident_bytes(begin, end, &resident_bytes);
+    if(*num_items > 0) {
+        VMemRangeInfo* last = &out_buf[*num_items - 1];
+        if(last->protect == protect && (uintptr_t)last->ptr + last->size_bytes == begin) {
+            last->size_bytes += end - begin;
+            last->resident_bytes += resident_bytes;
+            return 1;
+        }
+    }
+    if(*num_items >= buf_max_items) return 0;
+    VMemRangeInfo info = {0};
+    info.ptr = (void*)begin;
+    info.size_bytes = end - begin;
+    info.resident_bytes = resident_bytes;
+    info.protect = protect;
+    info.is_commited = protect != VMemProtect_NoAccess;
+    out_buf[*num_items] = info;
+    (*num_items)++;
+    return 1;
+}
+
 VMEM_FUNC VMemSize
-vmem_query_range_info(void* ptr, VMemSize num_bytes, VMemRangeInfo* out_buf, VMemSize buf_max_items) {
-    vmem__write_error_message("Currently not supported on Linux.");
+vmem_query_range_info(void* ptr, const VMemSize num_bytes, VMemRangeInfo* out_buf, const VMemSize buf_max_items) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(out_buf == 0, vmem__write_error_message("Out buffer ptr cannot be null."));
+    VMEM_ERROR_IF(buf_max_items == 0, vmem__write_error_message("Out buffer size cannot be 0."));
+
+    const VMemSize page_size = vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, (int)page_size);
+    const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, (int)page_size);
+
+    const int fd = open("/proc/self/maps", O_RDONLY);
+    VMEM_ERROR_IF(fd < 0, vmem__write_linux_error_message());
+
+    // Each line looks like "7f0000000000-7f0000100000 rw-p 00000000 00:00 0   [path]".
+    // Parse it byte by byte with a small state machine, so lines can cross the read buffer boundary.
+    enum { State_Start, State_End, State_Perms, State_Skip };
+    int state = State_Start;
+    uintptr_t map_begin = 0;
+    uintptr_t map_end = 0;
+    char perms[3] = {0};
+    int perms_len = 0;
+    uintptr_t pos = begin; // Everything before `pos` is already in the output.
+    VMemSize num_items = 0;
+    int full = 0;
+
+    char buf[4096];
+    ssize_t len = 0;
+    while(!full && pos < end && (len = read(fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t i = 0; i < len && !full && pos < end; i++) {
+            const char c = buf[i];
+            switch(state) {
+                case State_Start:
+                case State_End: {
+                    uintptr_t* value = state == State_Start ? &map_begin : &map_end;
+                    if(c >= '0' && c <= '9') {
+                        *value = (*value << 4) | (uintptr_t)(c - '0');
+                    } else if(c >= 'a' && c <= 'f') {
+                        *value = (*value << 4) | (uintptr_t)(c - 'a' + 10);
+                    } else {
+                        state++;
+                    }
+                } break;
+                case State_Perms: {
+                    if(perms_len < 3) perms[perms_len++] = c;
+                    if(perms_len == 3) {
+                        state = State_Skip;
+                        // The maps are sorted by address.
+                        if(map_end > pos && map_begin < end) {
+                            if(map_begin > pos) {
+                                // Gap between mappings, the memory isn't allocated at all.
+                                full = !vmem__range_info_append(
+                                    out_buf, &num_items, buf_max_items, pos, map_begin, VMemProtect_NoAccess, 0);
+                                pos = map_begin;
+                            }
+                            const uintptr_t range_end = map_end < end ? map_end : end;
+                            if(!full) {
+                                full = !vmem__range_info_append(
+                                    out_buf,
+                                    &num_items,
+                                    buf_max_items,
+                                    pos,
+                                    range_end,
+                                    vmem__protect_from_linux_perms(perms),
+                                    1);
+                                pos = range_end;
+                            }
+                        }
+                    }
+                } break;
+                case State_Skip: {
+                    if(c == '\n') {
+                        state = State_Start;
+                        map_begin = 0;
+                        map_end = 0;
+                        perms_len = 0;
+                    }
+                } break;
+            }
+        }
+    }
+    close(fd);
+    VMEM_ERROR_IF(len < 0, vmem__write_linux_error_message());
+
+    if(!full && pos < end) {
+        vmem__range_info_append(out_buf, &num_items, buf_max_items, pos, end, VMemProtect_NoAccess, 0);
+    }
+    return num_items;
+}
+
+// pidfd of this process for `process_madvise`. 0 means not initialized yet, -1 unsupported, otherwise fd + 1.
+static volatile VMemSize vmem__g_linux_pidfd = 0;
+
+// @returns the pidfd, or -1 when `process_madvise` can't be used for MADV_DONTNEED.
+static int vmem__linux_get_pidfd(void) {
+    VMemSize value = vmem__atomic_load(&vmem__g_linux_pidfd);
+    if(value == 0) {
+        int fd = -1;
+#if defined(SYS_process_madvise) && defined(SYS_pidfd_open)
+        fd = (int)syscall(SYS_pidfd_open, getpid(), 0);
+        if(fd >= 0) {
+            // Older kernels only allow a few advices, an empty call checks the advice without touching any memory.
+            struct iovec iov = {0, 0};
+            if(syscall(SYS_process_madvise, fd, &iov, (size_t)0, MADV_DONTNEED, 0) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+#endif
+        const VMemSize new_value = fd >= 0 ? (VMemSize)fd + 1 : (VMemSize)-1;
+        if(vmem__atomic_cas(&vmem__g_linux_pidfd, 0, new_value)) {
+            value = new_value;
+        } else {
+            // Another thread was faster.
+            if(fd >= 0) close(fd);
+            value = vmem__atomic_load(&vmem__g_linux_pidfd);
+        }
+    }
+    return value == (VMemSize)-1 ? -1 : (int)(value - 1);
+}
+
+// Decommit many ranges with a single `process_madvise` call (Linux 5.10+).
+// @returns 1 if all of the ranges were handled, 0 means the caller has to use madvise for each range.
+static int vmem__linux_batch_decommit(struct iovec* iov, const int num_iov) {
+#if defined(SYS_process_madvise)
+    if(num_iov <= 1) return 0;
+    const int pidfd = vmem__linux_get_pidfd();
+    if(pidfd < 0) return 0;
+
+    VMemSize total = 0;
+    for(int i = 0; i < num_iov; i++) {
+        total += (VMemSize)iov[i].iov_len;
+    }
+    VMEM__STATS_START();
+    const ssize_t result = (ssize_t)syscall(SYS_process_madvise, pidfd, iov, (size_t)num_iov, MADV_DONTNEED, 0);
+    if(result < 0 || (VMemSize)result != total) return 0;
+    // One event for the whole syscall.
+    VMEM__STATS_RECORD(VMemEvent_Decommit, iov[0].iov_base, total);
+    return 1;
+#else
+    VMEM_UNUSED(iov);
+    VMEM_UNUSED(num_iov);
     return 0;
+#endif
+}
+
+// Collect the written pages of memory registered with `vmem__linux_write_watch_register`.
+// @returns 0 when the range isn't registered or PAGEMAP_SCAN isn't supported.
+static int vmem__linux_scan_written_pages(
+    const int pagemap_fd,
+    uintptr_t begin,
+    const uintptr_t end,
+    void** out_pages,
+    const VMemSize max_pages,
+    VMemSize* num_pages,
+    const int reset) {
+    const VMemSize page_size = vmem_get_page_size();
+    vmem__LinuxPageRegion regions[64];
+    while(begin < end && *num_pages < max_pages) {
+        vmem__LinuxPmScanArg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.size = sizeof(arg);
+        // Fails unless the whole range is registered with async write-protection.
+        arg.flags = VMEM__PM_SCAN_CHECK_WPASYNC | (reset ? VMEM__PM_SCAN_WP_MATCHING : 0);
+        arg.start = begin;
+        arg.end = end;
+        arg.vec = (uint64_t)(uintptr_t)regions;
+        arg.vec_len = sizeof(regions) / sizeof(regions[0]);
+        arg.max_pages = max_pages - *num_pages;
+        arg.category_mask = VMEM__PAGE_IS_WRITTEN;
+        arg.return_mask = VMEM__PAGE_IS_WRITTEN;
+        const int num_regions = ioctl(pagemap_fd, VMEM__PAGEMAP_SCAN, &arg);
+        if(num_regions < 0) {
+            *num_pages = 0;
+            return 0;
+        }
+        for(int i = 0; i < num_regions; i++) {
+            for(uintptr_t page = (uintptr_t)regions[i].start; page < (uintptr_t)regions[i].end; page += page_size) {
+                out_pages[(*num_pages)++] = (void*)page;
+            }
+        }
+        if(arg.walk_end <= begin) break;
+        begin = (uintptr_t)arg.walk_end;
+    }
+    return 1;
+}
+
+// Collect the pages with the soft-dirty bit from `/proc/self/pagemap`, 8 bytes per page.
+static int vmem__linux_scan_soft_dirty_pages(
+    const int pagemap_fd,
+    uintptr_t begin,
+    const uintptr_t end,
+    void** out_pages,
+    const VMemSize max_pages,
+    VMemSize* num_pages) {
+    const VMemSize page_size = vmem_get_page_size();
+    uint64_t entries[512];
+    while(begin < end && *num_pages < max_pages) {
+        VMemSize count = (end - begin) / page_size;
+        if(count > sizeof(entries) / sizeof(entries[0])) count = sizeof(entries) / sizeof(entries[0]);
+        const ssize_t len = pread(pagemap_fd, entries, count * sizeof(uint64_t), (off_t)(begin / page_size * 8));
+        if(len <= 0) return 0;
+        count = (VMemSize)len / sizeof(uint64_t);
+        for(VMemSize i = 0; i < count && *num_pages < max_pages; i++, begin += page_size) {
+            // Bit 55 is soft-dirty, bits 63 and 62 mean the page is present or swapped out.
+            if(((entries[i] >> 55) & 1) && (entries[i] >> 62)) out_pages[(*num_pages)++] = (void*)begin;
+        }
+    }
+    return 1;
+}
+
+static int vmem__linux_clear_soft_dirty(void) {
+    int open_flags = O_WRONLY;
+#if defined(O_CLOEXEC)
+    open_flags |= O_CLOEXEC;
+#endif
+    const int fd = open("/proc/self/clear_refs", open_flags);
+    if(fd < 0) return 0;
+    const int result = write(fd, "4", 1) == 1;
+    close(fd);
+    return result;
+}
+
+VMEM_FUNC VMemResult vmem_get_dirty_pages(
+    void* ptr,
+    const VMemSize num_bytes,
+    void** out_pages,
+    VMemSize* inout_num_pages,
+    const int reset) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(out_pages == 0 || inout_num_pages == 0, vmem__write_error_message("Out pages cannot be null."));
+
+    const int page_size = (int)vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, page_size);
+    const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, page_size);
+    const VMemSize max_pages = *inout_num_pages;
+    VMemSize num_pages = 0;
+
+    int open_flags = O_RDONLY;
+#if defined(O_CLOEXEC)
+    open_flags |= O_CLOEXEC;
+#endif
+    const int pagemap_fd = open("/proc/self/pagemap", open_flags);
+    VMEM_ERROR_IF(pagemap_fd < 0, vmem__write_linux_error_message());
+    int result = vmem__linux_scan_written_pages(pagemap_fd, begin, end, out_pages, max_pages, &num_pages, reset);
+    if(!result) {
+        result = vmem__linux_scan_soft_dirty_pages(pagemap_fd, begin, end, out_pages, max_pages, &num_pages);
+        // Don't lose the pages which didn't fit.
+        if(result && reset && num_pages < max_pages) result = vmem__linux_clear_soft_dirty();
+    }
+    if(!result) {
+        vmem__write_linux_error_message();
+        close(pagemap_fd);
+        VMEM_ON_ERROR("Failed to read the dirty pages.");
+        return VMemResult_Error;
+    }
+    close(pagemap_fd);
+    *inout_num_pages = num_pages;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_reset_dirty_pages(void* ptr, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    const int page_size = (int)vmem_get_page_size();
+    const uintptr_t begin = vmem_align_backward_fast((uintptr_t)ptr, page_size);
+    const uintptr_t end = vmem_align_forward_fast((uintptr_t)ptr + num_bytes, page_size);
+    const int uffd = vmem__linux_get_uffd();
+    if(uffd >= 0) {
+        // Every `VMemAllocFlag_WriteWatch` allocation is registered when userfaultfd works, so this only fails for
+        // ranges which aren't tracked. Don't hide that by resetting the whole process.
+        const int result = vmem__linux_write_protect(uffd, begin, end);
+        VMEM_ERROR_IF(!result, vmem__write_linux_error_message());
+        return VMemResult_Success;
+    }
+    const int result = vmem__linux_clear_soft_dirty();
+    VMEM_ERROR_IF(!result, vmem__write_linux_error_message());
+    return VMemResult_Success;
 }
 
 #endif // defined(VMEM_PLATFORM_LINUX)
 
 
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch operations implementation
+//
+
+// Number of entries which are sorted and merged together. Bigger batches are split.
+#define VMEM__BATCH_CHUNK 256
+
+static int vmem__batch_entry_less(const VMemBatchEntry* a, const VMemBatchEntry* b) {
+    // Decommits go first, so they form one prefix which can be done with a single syscall.
+    if(a->op != b->op) {
+        if(a->op == VMemBatchOp_Decommit || b->op == VMemBatchOp_Decommit) return a->op == VMemBatchOp_Decommit;
+        return a->op < b->op;
+    }
+    if(a->op != VMemBatchOp_Decommit && a->protect != b->protect) return a->protect < b->protect;
+    return (uintptr_t)a->ptr < (uintptr_t)b->ptr;
+}
+
+static VMemResult vmem__batch_apply(
+    void* ptr,
+    const VMemSize num_bytes,
+    const VMemBatchOp op,
+    const VMemProtect protect,
+    const VMemCommitFlags flags) {
+    switch(op) {
+        case VMemBatchOp_Commit: return vmem_commit_ex(ptr, num_bytes, protect, flags);
+        case VMemBatchOp_Decommit: return vmem_decommit_ex(ptr, num_bytes, flags);
+        case VMemBatchOp_Protect: return vmem_protect(ptr, num_bytes, protect);
+    }
+    vmem__write_error_message("Invalid batch operation.");
+    return VMemResult_Error;
+}
+
+VMEM_FUNC VMemSize vmem_batch(VMemBatchEntry* entries, const VMemSize num_entries, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(entries == 0, vmem__write_error_message("Entries pointer is null."));
+
+    const uintptr_t page_size = (uintptr_t)vmem_get_page_size();
+    VMemSize num_succeeded = 0;
+    for(VMemSize chunk_start = 0; chunk_start < num_entries; chunk_start += VMEM__BATCH_CHUNK) {
+        VMemSize chunk_len = num_entries - chunk_start;
+        if(chunk_len > VMEM__BATCH_CHUNK) chunk_len = VMEM__BATCH_CHUNK;
+        VMemBatchEntry* chunk = entries + chunk_start;
+
+        // Sort indices instead of the entries, insertion sort is fine for small batches.
+        uint16_t order[VMEM__BATCH_CHUNK];
+        for(VMemSize i = 0; i < chunk_len; i++) {
+            const uint16_t index = (uint16_t)i;
+            VMemSize j = i;
+            while(j > 0 && vmem__batch_entry_less(&chunk[index], &chunk[order[j - 1]])) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = index;
+        }
+
+        // Merge runs of touching ranges with the same operation.
+        uintptr_t run_begin[VMEM__BATCH_CHUNK];
+        uintptr_t run_end[VMEM__BATCH_CHUNK];
+        VMemSize run_first[VMEM__BATCH_CHUNK + 1]; // Index into `order`.
+        VMemSize num_runs = 0;
+        for(VMemSize i = 0; i < chunk_len; i++) {
+            VMemBatchEntry* entry = &chunk[order[i]];
+            entry->result = VMemResult_Error;
+            const uintptr_t begin = vmem_align_backward_fast((uintptr_t)entry->ptr, (int)page_size);
+            const uintptr_t end = vmem_align_forward_fast((uintptr_t)entry->ptr + entry->num_bytes, (int)page_size);
+            const VMemBatchEntry* prev = i > 0 ? &chunk[order[i - 1]] : 0;
+            const int same_op = prev && prev->op == entry->op &&
+                                (entry->op == VMemBatchOp_Decommit || prev->protect == entry->protect);
+            if(same_op && begin <= run_end[num_runs - 1]) {
+                if(end > run_end[num_runs - 1]) run_end[num_runs - 1] = end;
+                continue;
+            }
+            run_begin[num_runs] = begin;
+            run_end[num_runs] = end;
+            run_first[num_runs] = i;
+            num_runs++;
+        }
+        run_first[num_runs] = chunk_len;
+
+        VMemSize first_run = 0;
+#if defined(VMEM_PLATFORM_LINUX)
+        // All decommits are sorted first, try to do them in one syscall.
+        if(!(flags & VMemCommitFlag_LazyDecommit)) {
+            struct iovec iov[VMEM__BATCH_CHUNK];
+            int num_iov = 0;
+            while(num_iov < (int)num_runs && chunk[order[run_first[num_iov]]].op == VMemBatchOp_Decommit) {
+                iov[num_iov].iov_base = (void*)run_begin[num_iov];
+                iov[num_iov].iov_len = (size_t)(run_end[num_iov] - run_begin[num_iov]);
+                num_iov++;
+            }
+            if(vmem__linux_batch_decommit(iov, num_iov)) {
+                for(VMemSize i = 0; i < run_first[num_iov]; i++) {
+                    chunk[order[i]].result = VMemResult_Success;
+                }
+                first_run = (VMemSize)num_iov;
+            }
+        }
+#endif
+
+        for(VMemSize run = first_run; run < num_runs; run++) {
+            const VMemBatchEntry* first = &chunk[order[run_first[run]]];
+            const VMemResult result = vmem__batch_apply(
+                (void*)run_begin[run],
+                (VMemSize)(run_end[run] - run_begin[run]),
+                first->op,
+                first->protect,
+                flags);
+            for(VMemSize i = run_first[run]; i < run_first[run + 1]; i++) {
+                VMemBatchEntry* entry = &chunk[order[i]];
+                entry->result = result;
+                if(!result) {
+                    entry->result = vmem__batch_apply(entry->ptr, entry->num_bytes, entry->op, entry->protect, flags);
+                }
+            }
+        }
+
+        for(VMemSize i = 0; i < chunk_len; i++) {
+            if(chunk[i].result) num_succeeded++;
+        }
+    }
+    return num_succeeded;
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Arena implementation
 //
@@ -788,62 +3993,970 @@ VMEM_FUNC VMemArena vmem_arena_init(void* mem, const VMemSize size_bytes) {
     VMemArena arena = {0};
     arena.mem = (uint8_t*)mem;
     arena.size_bytes = size_bytes;
+    arena.commit_granularity = VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY;
     return arena;
 }
 
 VMEM_FUNC VMemArena vmem_arena_init_alloc(VMemSize size_bytes) {
+    return vmem_arena_init_alloc_ex(size_bytes, VMemAllocFlag_None);
+}
+
+VMEM_FUNC VMemArena vmem_arena_init_alloc_ex(VMemSize size_bytes, const VMemAllocFlags flags) {
     if(size_bytes == 0) {
         vmem__write_error_message("Arena size cannot be zero.");
         return (VMemArena){0};
     }
     VMemArena arena = {0};
-    arena.mem = (uint8_t*)vmem_alloc(size_bytes);
+    arena.mem = (uint8_t*)vmem_alloc_ex(size_bytes, VMemProtect_ReadWrite, flags);
     arena.size_bytes = size_bytes;
+    arena.flags = flags;
+    arena.commit_granularity = VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY;
+    arena.commit_flags = VMemCommitFlag_KeepProtect;
+    return arena;
+}
+
+VMEM_FUNC VMemArena vmem_arena_init_mapped_file(VMemMappedFile* file) {
+    if(file == 0 || file->mem == 0) {
+        vmem__write_error_message("File isn't mapped.");
+        return (VMemArena){0};
+    }
+    VMemArena arena = vmem_arena_init(file->mem, file->size_bytes);
+    arena.file = file;
+    arena.commited = file->file_size;
+    arena.peak_commited = file->file_size;
     return arena;
 }
 
 VMEM_FUNC VMemResult vmem_arena_deinit_dealloc(VMemArena* arena) {
     VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+#if defined(VMEM_PLATFORM_WIN32)
+    const VMemResult result =
+        arena->cow_bytes ? vmem__win32_dealloc_clone(arena) : vmem_dealloc(arena->mem, arena->size_bytes);
+#else
     const VMemResult result = vmem_dealloc(arena->mem, arena->size_bytes);
+#endif
     arena->mem = 0;
     return result;
 }
 
 VMEM_FUNC VMemResult
 vmem_partially_commit_region(void* ptr, VMemSize num_bytes, VMemSize prev_commited, VMemSize commited) {
+    return vmem_partially_commit_region_ex(
+        ptr,
+        num_bytes,
+        prev_commited,
+        commited,
+        VMemAllocFlag_None,
+        VMemCommitFlag_None);
+}
+
+VMEM_FUNC VMemResult vmem_partially_commit_region_ex(
+    void* ptr,
+    VMemSize num_bytes,
+    VMemSize prev_commited,
+    VMemSize commited,
+    const VMemAllocFlags flags,
+    const VMemCommitFlags commit_flags) {
     if(commited == prev_commited) return VMemResult_Success;
 
     // If you hit this, you likely either didn't alloc enough space up-front,
     // or have a leak that is allocating too many elements
     VMEM_ERROR_IF(commited > num_bytes, vmem__write_error_message("Cannot commit more memory than is available."));
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+
+#if defined(VMEM_PLATFORM_WIN32)
+    // Large pages are commited for the whole lifetime of the allocation.
+    if(flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) return VMemResult_Success;
+#endif
 
-    const VMemSize new_commited_bytes = vmem_arena_calc_bytes_used_for_size(commited);
-    const VMemSize current_commited_bytes = vmem_arena_calc_bytes_used_for_size(prev_commited);
+    // Everything is validated here, the commits below use the unchecked versions.
+    const VMemSize page_size = vmem_get_page_size_for_flags(flags);
+    VMEM_ERROR_IF(page_size == 0, vmem__write_error_message("Large pages aren't supported."));
+    // Large page steps can go past the end of the region, in that case only commit up to the last page.
+    const VMemSize max_commited_bytes = vmem_arena_calc_bytes_used_for_size(num_bytes);
+    VMemSize new_commited_bytes = vmem_arena_calc_bytes_used_for_size_ex(commited, page_size);
+    VMemSize current_commited_bytes = vmem_arena_calc_bytes_used_for_size_ex(prev_commited, page_size);
+    if(new_commited_bytes > max_commited_bytes) new_commited_bytes = max_commited_bytes;
+    if(current_commited_bytes > max_commited_bytes) current_commited_bytes = max_commited_bytes;
 
     if(new_commited_bytes == current_commited_bytes) return VMemResult_Success;
 
     // Shrink
     if(new_commited_bytes < current_commited_bytes) {
         const VMemSize bytes_to_decommit = (VMemSize)((intptr_t)current_commited_bytes - (intptr_t)new_commited_bytes);
-        return vmem_decommit((void*)((uintptr_t)ptr + new_commited_bytes), bytes_to_decommit);
+        return vmem_decommit_unchecked((void*)((uintptr_t)ptr + new_commited_bytes), bytes_to_decommit, commit_flags);
     }
-    // Expand
+    // Expand, only the new pages need to be commited.
     if(new_commited_bytes > current_commited_bytes) {
-        return vmem_commit(ptr, new_commited_bytes);
+        const VMemSize bytes_to_commit = new_commited_bytes - current_commited_bytes;
+        return vmem_commit_unchecked(
+            (void*)((uintptr_t)ptr + current_commited_bytes),
+            bytes_to_commit,
+            VMemProtect_ReadWrite,
+            commit_flags);
     }
 
     return VMemResult_Success;
 }
 
-VMEM_FUNC VMemResult vmem_arena_set_commited(VMemArena* arena, const VMemSize commited) {
+VMEM_FUNC VMemResult vmem_arena_set_commited(VMemArena* arena, VMemSize commited) {
     VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
-    if(vmem_partially_commit_region(arena->mem, arena->size_bytes, arena->commited, commited) == VMemResult_Success) {
+
+    if(arena->file) {
+        // The whole file is always mapped, only growing past the end of the file has to do anything.
+        VMEM_ERROR_IF(
+            commited > arena->size_bytes,
+            vmem__write_error_message("Cannot commit more memory than is available."));
+        if(commited > arena->file->file_size && !vmem_mapped_file_grow(arena->file, commited)) return VMemResult_Error;
+        arena->commited = commited;
+        if(arena->pos > commited) arena->pos = commited;
+        if(commited > arena->peak_commited) arena->peak_commited = commited;
+        return VMemResult_Success;
+    }
+
+    const VMemCommitPolicy policy = arena->commit_policy;
+    const VMemSize prev_requested = arena->requested_commited;
+    arena->requested_commited = commited;
+    if(arena->pos > commited) arena->pos = commited;
+
+    if(policy.low_water_percent || policy.shrink_delay || policy.min_commited) {
+        if(commited > prev_requested && commited <= arena->commited) {
+            // Growing back into memory the policy kept.
+            arena->num_avoided_commits++;
+            return VMemResult_Success;
+        }
+        if(commited < arena->commited) {
+            if(commited < policy.min_commited) commited = policy.min_commited;
+            const int is_low = policy.low_water_percent == 0 ||
+                               commited * 100 < (VMemSize)policy.low_water_percent * arena->commited;
+            arena->num_low_shrinks = is_low ? arena->num_low_shrinks + 1 : 0;
+            if(commited >= arena->commited || !is_low || arena->num_low_shrinks < policy.shrink_delay) {
+                arena->num_avoided_decommits++;
+                return VMemResult_Success;
+            }
+            arena->num_low_shrinks = 0;
+        }
+    }
+
+    // The copy-on-write view of a clone stays mapped, only the memory past it is commited and decommited.
+    VMemSize prev_commited = arena->commited;
+    VMemSize new_commited = commited;
+    if(prev_commited < arena->cow_bytes) prev_commited = arena->cow_bytes;
+    if(new_commited < arena->cow_bytes) new_commited = arena->cow_bytes;
+    const VMemResult result = vmem_partially_commit_region_ex(
+        arena->mem,
+        arena->size_bytes,
+        prev_commited,
+        new_commited,
+        arena->flags,
+        arena->commit_flags);
+    if(result == VMemResult_Success) {
         arena->commited = commited;
+        if(arena->pos > commited) arena->pos = commited;
+        if(commited > arena->peak_commited) arena->peak_commited = commited;
         return VMemResult_Success;
     }
     return VMemResult_Error;
 }
 
+VMEM_FUNC void* vmem_arena_push(VMemArena* arena, const VMemSize num_bytes, const int align) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(align <= 0, vmem__write_error_message("Alignment must be greater than zero."));
+    VMEM_ERROR_IF((align & (align - 1)) != 0, vmem__write_error_message("Alignment has to be a power of 2."));
+
+    const uintptr_t base = (uintptr_t)arena->mem;
+    const VMemSize start = (VMemSize)(vmem_align_forward_fast(base + arena->pos, align) - base);
+    const VMemSize end = start + num_bytes;
+
+    // Slow path, commit more memory.
+    if(end > arena->commited) {
+        VMEM_ERROR_IF(
+            end > arena->size_bytes || end < start,
+            vmem__write_error_message("Arena doesn't have enough memory for the allocation."));
+
+        VMemSize granularity = arena->commit_granularity;
+        const VMemSize page_size = vmem_get_page_size_for_flags(arena->flags);
+        if(granularity < page_size) granularity = page_size;
+        VMEM_ERROR_IF(
+            (granularity & (granularity - 1)) != 0,
+            vmem__write_error_message("Arena commit granularity has to be a power of 2."));
+
+        VMemSize commited = (end + granularity - 1) & ~(granularity - 1);
+        if(commited > arena->size_bytes) commited = arena->size_bytes;
+        if(!vmem_arena_set_commited(arena, commited)) return 0;
+    }
+
+    arena->pos = end;
+    return arena->mem + start;
+}
+
+VMEM_FUNC VMemResult vmem_arena_pop(VMemArena* arena, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(
+        num_bytes > arena->pos,
+        vmem__write_error_message("Cannot pop more bytes than were pushed onto the arena."));
+    arena->pos -= num_bytes;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_arena_reset(VMemArena* arena, const VMemSize keep_commited_bytes) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    arena->pos = 0;
+    // Compare whole pages, shrinking within the last page wouldn't decommit anything.
+    const VMemSize page_size = vmem_get_page_size_for_flags(arena->flags);
+    if(vmem_arena_calc_bytes_used_for_size_ex(keep_commited_bytes, page_size) >=
+       vmem_arena_calc_bytes_used_for_size_ex(arena->commited, page_size)) {
+        return VMemResult_Success;
+    }
+    return vmem_arena_set_commited(arena, keep_commited_bytes);
+}
+
+VMEM_FUNC VMemSize vmem_arena_trim(VMemArena* arena) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    // Mapped files never shrink.
+    if(arena->file) return 0;
+#if defined(VMEM_PLATFORM_WIN32)
+    // Large pages are commited for the whole lifetime of the allocation.
+    if(arena->flags & (VMemAllocFlag_LargePages | VMemAllocFlag_HugePages)) return 0;
+#endif
+    const VMemSize page_size = vmem_get_page_size_for_flags(arena->flags);
+    VMemSize commited_bytes = vmem_arena_calc_bytes_used_for_size_ex(arena->commited, page_size);
+    const VMemSize max_commited_bytes = vmem_arena_calc_bytes_used_for_size(arena->size_bytes);
+    if(commited_bytes > max_commited_bytes) commited_bytes = max_commited_bytes;
+    VMemSize keep_bytes = vmem_arena_calc_bytes_used_for_size_ex(arena->pos, page_size);
+    if(keep_bytes < arena->cow_bytes) keep_bytes = arena->cow_bytes;
+    if(keep_bytes >= commited_bytes) return 0;
+
+    // Under pressure the memory should really be given back, not just marked as reclaimable.
+    const VMemCommitFlags commit_flags = arena->commit_flags & ~(VMemCommitFlags)VMemCommitFlag_LazyDecommit;
+    if(!vmem_decommit_ex(arena->mem + keep_bytes, commited_bytes - keep_bytes, commit_flags)) return 0;
+    arena->commited = arena->pos;
+    arena->requested_commited = arena->pos;
+    return commited_bytes - keep_bytes;
+}
+
+VMEM_FUNC VMemResult vmem_frame_arena_init_alloc(
+    VMemFrameArena* frame_arena,
+    const VMemSize size_bytes,
+    const VMemSize keep_commited_bytes) {
+    VMEM_ERROR_IF(frame_arena == 0, vmem__write_error_message("Frame arena pointer is null."));
+    VMemFrameArena result = {0};
+    for(int i = 0; i < 2; i++) {
+        result.arenas[i] = vmem_arena_init_alloc(size_bytes);
+        if(!vmem_arena_is_valid(&result.arenas[i])) {
+            if(i == 1) vmem_arena_deinit_dealloc(&result.arenas[0]);
+            return VMemResult_Error;
+        }
+        result.arenas[i].commit_flags |= VMemCommitFlag_LazyDecommit;
+    }
+    result.keep_commited_bytes = keep_commited_bytes;
+    *frame_arena = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_frame_arena_deinit_dealloc(VMemFrameArena* frame_arena) {
+    VMEM_ERROR_IF(frame_arena == 0, vmem__write_error_message("Frame arena pointer is null."));
+    const VMemResult result0 = vmem_arena_deinit_dealloc(&frame_arena->arenas[0]);
+    const VMemResult result1 = vmem_arena_deinit_dealloc(&frame_arena->arenas[1]);
+    return result0 && result1;
+}
+
+VMEM_FUNC VMemResult vmem_frame_arena_swap(VMemFrameArena* frame_arena) {
+    VMEM_ERROR_IF(frame_arena == 0, vmem__write_error_message("Frame arena pointer is null."));
+    frame_arena->current ^= 1;
+    return vmem_arena_reset(&frame_arena->arenas[frame_arena->current], frame_arena->keep_commited_bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Atomic arena implementation
+//
+
+static volatile VMemSize vmem__g_atomic_arena_next_id = 0;
+
+static VMemSize vmem__atomic_arena_new_id(void) {
+    return vmem__atomic_fetch_add(&vmem__g_atomic_arena_next_id, 1) + 1;
+}
+
+VMEM_FUNC VMemResult vmem_atomic_arena_init(VMemAtomicArena* arena, void* mem, const VMemSize size_bytes) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(mem == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(size_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(
+        !vmem_is_aligned((uintptr_t)mem, (int)vmem_get_page_size()),
+        vmem__write_error_message("Arena must be aligned to page size."));
+
+    VMemAtomicArena result = {0};
+    result.mem = (uint8_t*)mem;
+    result.size_bytes = size_bytes;
+    result.commit_granularity = VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY;
+    result.id = vmem__atomic_arena_new_id();
+    *arena = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult
+vmem_atomic_arena_init_alloc(VMemAtomicArena* arena, const VMemSize size_bytes, const VMemAllocFlags flags) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(size_bytes == 0, vmem__write_error_message("Arena size cannot be zero."));
+
+    void* mem = vmem_alloc_ex(size_bytes, VMemProtect_ReadWrite, flags);
+    if(mem == 0) return VMemResult_Error;
+
+    VMemAtomicArena result = {0};
+    result.mem = (uint8_t*)mem;
+    result.size_bytes = size_bytes;
+    result.flags = flags;
+    result.commit_flags = VMemCommitFlag_KeepProtect;
+    result.commit_granularity = VMEM_ARENA_DEFAULT_COMMIT_GRANULARITY;
+    result.id = vmem__atomic_arena_new_id();
+    *arena = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_atomic_arena_deinit_dealloc(VMemAtomicArena* arena) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    const VMemResult result = vmem_dealloc(arena->mem, arena->size_bytes);
+    arena->mem = 0;
+    return result;
+}
+
+// Slow path of `vmem_atomic_arena_push`, wait until the memory up to `end` is commited.
+static VMemResult vmem__atomic_arena_commit(VMemAtomicArena* arena, const VMemSize end) {
+    while(vmem__atomic_load(&arena->commited) < end) {
+        if(!vmem__atomic_cas(&arena->commit_lock, 0, 1)) {
+            vmem__cpu_pause();
+            continue;
+        }
+
+        // Re-check, some other thread could have commited the memory in the meantime.
+        const VMemSize commited = vmem__atomic_load(&arena->commited);
+        if(commited < end) {
+            VMemSize granularity = arena->commit_granularity;
+            const VMemSize page_size = vmem_get_page_size_for_flags(arena->flags);
+            if(granularity < page_size) granularity = page_size;
+
+            // Commit enough memory for all the pushes which are in flight right now, not just this one.
+            VMemSize target = vmem__atomic_load(&arena->pos);
+            if(target < end) target = end;
+            target = (target + granularity - 1) & ~(granularity - 1);
+            if(target > arena->size_bytes) target = arena->size_bytes;
+
+            const VMemResult result = vmem_partially_commit_region_ex(
+                arena->mem,
+                arena->size_bytes,
+                commited,
+                target,
+                arena->flags,
+                arena->commit_flags);
+            if(!result) {
+                vmem__atomic_store(&arena->commit_lock, 0);
+                return VMemResult_Error;
+            }
+            vmem__atomic_store(&arena->commited, target);
+        }
+        vmem__atomic_store(&arena->commit_lock, 0);
+    }
+    return VMemResult_Success;
+}
+
+VMEM_FUNC void* vmem_atomic_arena_push(VMemAtomicArena* arena, const VMemSize num_bytes, const int align) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(align <= 0, vmem__write_error_message("Alignment must be greater than zero."));
+    VMEM_ERROR_IF((align & (align - 1)) != 0, vmem__write_error_message("Alignment has to be a power of 2."));
+
+    const VMemSize total = num_bytes + (VMemSize)(align - 1);
+    const VMemSize prev_pos = vmem__atomic_fetch_add(&arena->pos, total);
+    VMEM_ERROR_IF(
+        prev_pos + total > arena->size_bytes || prev_pos + total < prev_pos,
+        vmem__write_error_message("Arena doesn't have enough memory for the allocation."));
+
+    const uintptr_t base = (uintptr_t)arena->mem;
+    const VMemSize start = (VMemSize)(vmem_align_forward_fast(base + prev_pos, align) - base);
+    const VMemSize end = start + num_bytes;
+
+    if(end > vmem__atomic_load(&arena->commited)) {
+        if(!vmem__atomic_arena_commit(arena, end)) return 0;
+    }
+    return arena->mem + start;
+}
+
+VMEM_FUNC VMemResult vmem_atomic_arena_reset(VMemAtomicArena* arena) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    vmem__atomic_store(&arena->pos, 0);
+    vmem__atomic_fetch_add(&arena->reset_count, 1);
+    return VMemResult_Success;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Thread cache implementation
+//
+
+VMEM_FUNC void*
+vmem_thread_cache_push(VMemThreadCache* cache, VMemAtomicArena* shared, const VMemSize num_bytes, const int align) {
+    VMEM_ERROR_IF(cache == 0, vmem__write_error_message("Thread cache pointer is null."));
+    VMEM_ERROR_IF(shared == 0, vmem__write_error_message("Arena pointer is null."));
+    VMEM_ERROR_IF(align <= 0, vmem__write_error_message("Alignment must be greater than zero."));
+    VMEM_ERROR_IF((align & (align - 1)) != 0, vmem__write_error_message("Alignment has to be a power of 2."));
+
+    // The chunk is gone when the shared arena was reset, reinitialized or the cache is now used with a different arena.
+    const VMemSize reset_count = vmem__atomic_load(&shared->reset_count);
+    if(cache->shared != shared || cache->shared_id != shared->id || cache->reset_count != reset_count) {
+        cache->shared = shared;
+        cache->shared_id = shared->id;
+        cache->reset_count = reset_count;
+        cache->chunk = 0;
+        cache->chunk_size = 0;
+        cache->pos = 0;
+    }
+
+    const uintptr_t base = (uintptr_t)cache->chunk;
+    const VMemSize start = (VMemSize)(vmem_align_forward_fast(base + cache->pos, align) - base);
+    if(cache->chunk && start + num_bytes <= cache->chunk_size) {
+        cache->pos = start + num_bytes;
+        return cache->chunk + start;
+    }
+
+    // Big allocations would waste most of a chunk.
+    if(num_bytes > VMEM_THREAD_CACHE_CHUNK_SIZE / 2) return vmem_atomic_arena_push(shared, num_bytes, align);
+
+    // Slow path, grab a new chunk. The rest of the current chunk is wasted.
+    // Chunks are aligned to cache lines so neighboring threads don't write to the same ones.
+    uint8_t* chunk = (uint8_t*)vmem_atomic_arena_push(shared, VMEM_THREAD_CACHE_CHUNK_SIZE, 64);
+    if(chunk == 0) return 0;
+    cache->chunk = chunk;
+    cache->chunk_size = VMEM_THREAD_CACHE_CHUNK_SIZE;
+
+    const VMemSize chunk_start = (VMemSize)(vmem_align_forward_fast((uintptr_t)chunk, align) - (uintptr_t)chunk);
+    VMEM_ERROR_IF(
+        chunk_start + num_bytes > cache->chunk_size,
+        vmem__write_error_message("Alignment is too big for the thread cache chunk size."));
+    cache->pos = chunk_start + num_bytes;
+    return chunk + chunk_start;
+}
+
+static VMEM_THREAD_LOCAL VMemThreadCache vmem__g_thread_cache = {0};
+
+VMEM_FUNC void* vmem_thread_arena_push(VMemAtomicArena* shared, const VMemSize num_bytes, const int align) {
+    return vmem_thread_cache_push(&vmem__g_thread_cache, shared, num_bytes, align);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Stack pool implementation
+//
+
+VMEM_FUNC VMemResult vmem_stack_pool_init_alloc(
+    VMemStackPool* pool,
+    const int num_stacks,
+    const VMemSize stack_size,
+    const VMemSize guard_size) {
+    VMEM_ERROR_IF(pool == 0, vmem__write_error_message("Stack pool pointer is null."));
+    VMEM_ERROR_IF(num_stacks <= 0, vmem__write_error_message("Number of stacks must be greater than zero."));
+    VMEM_ERROR_IF(stack_size == 0, vmem__write_error_message("Stack size cannot be zero."));
+
+    const VMemSize page_size = vmem_get_page_size();
+    VMemStackPool result = {0};
+    result.stack_size = vmem_align_forward(stack_size, page_size);
+    result.guard_size = guard_size == 0 ? page_size : vmem_align_forward(guard_size, page_size);
+    result.keep_hot_bytes = 4 * page_size;
+    result.num_stacks = num_stacks;
+    result.first_free = -1;
+
+    const VMemSize slots_bytes = vmem_align_forward((VMemSize)num_stacks * sizeof(VMemStackPoolSlot), page_size);
+    result.size_bytes = slots_bytes + (VMemSize)num_stacks * (result.guard_size + result.stack_size);
+    result.mem = (uint8_t*)vmem_alloc_protect(result.size_bytes, VMemProtect_NoAccess);
+    if(result.mem == 0) return VMemResult_Error;
+
+    if(!vmem_partially_commit_region(result.mem, slots_bytes, 0, slots_bytes)) {
+        vmem_dealloc(result.mem, result.size_bytes);
+        return VMemResult_Error;
+    }
+    result.slots = (VMemStackPoolSlot*)result.mem;
+    result.stacks = result.mem + slots_bytes;
+    *pool = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_stack_pool_deinit_dealloc(VMemStackPool* pool) {
+    VMEM_ERROR_IF(pool == 0, vmem__write_error_message("Stack pool pointer is null."));
+    const VMemResult result = vmem_dealloc(pool->mem, pool->size_bytes);
+    pool->mem = 0;
+    return result;
+}
+
+VMEM_FUNC void* vmem_stack_pool_acquire(VMemStackPool* pool) {
+    VMEM_ERROR_IF(pool == 0, vmem__write_error_message("Stack pool pointer is null."));
+
+    int index = pool->first_free;
+    if(index != -1) {
+        pool->first_free = pool->slots[index].next_free;
+    } else {
+        VMEM_ERROR_IF(pool->head >= pool->num_stacks, vmem__write_error_message("All stacks are in use."));
+        index = pool->head;
+        pool->head++;
+    }
+
+    VMemStackPoolSlot* slot = &pool->slots[index];
+    uint8_t* stack = pool->stacks + (VMemSize)index * (pool->guard_size + pool->stack_size) + pool->guard_size;
+    if(slot->commited < pool->stack_size) {
+        // The first commit has to change the protection. After that the decommited pages keep it on Linux,
+        // so recommiting the deep part of a recycled stack doesn't need a syscall there.
+        const VMemCommitFlags flags = slot->commited == 0 ? VMemCommitFlag_None : VMemCommitFlag_KeepProtect;
+        if(!vmem_commit_ex(stack, pool->stack_size - slot->commited, VMemProtect_ReadWrite, flags)) {
+            slot->next_free = pool->first_free;
+            pool->first_free = index;
+            return 0;
+        }
+        slot->commited = pool->stack_size;
+    }
+    slot->in_use = 1;
+    pool->num_used++;
+    return stack;
+}
+
+VMEM_FUNC VMemResult vmem_stack_pool_release(VMemStackPool* pool, void* stack) {
+    VMEM_ERROR_IF(pool == 0, vmem__write_error_message("Stack pool pointer is null."));
+    VMEM_ERROR_IF(stack == 0, vmem__write_error_message("Stack pointer is null."));
+
+    const VMemSize slot_size = pool->guard_size + pool->stack_size;
+    const VMemSize offset = (VMemSize)((uint8_t*)stack - pool->stacks) - pool->guard_size;
+    VMEM_ERROR_IF(
+        (uint8_t*)stack < pool->stacks || offset % slot_size != 0 || offset / slot_size >= (VMemSize)pool->head,
+        vmem__write_error_message("Stack doesn't belong to the pool."));
+
+    const int index = (int)(offset / slot_size);
+    VMemStackPoolSlot* slot = &pool->slots[index];
+    VMEM_ERROR_IF(!slot->in_use, vmem__write_error_message("Stack was already released."));
+    VMemSize keep = vmem_align_forward(pool->keep_hot_bytes, vmem_get_page_size());
+    if(keep > pool->stack_size) keep = pool->stack_size;
+    if(keep == 0) keep = vmem_get_page_size(); // 0 means never commited.
+
+    VMemResult result = VMemResult_Success;
+    if(slot->commited > keep) {
+        // Stacks grow downward, the top is at the end.
+        result = vmem_decommit(stack, slot->commited - keep);
+        if(result) slot->commited = keep;
+    }
+    slot->in_use = 0;
+    slot->next_free = pool->first_free;
+    pool->first_free = index;
+    pool->num_used--;
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reservation implementation
+//
+
+#define VMEM__RESERVATION_NIL 0xffffffffu
+#define VMEM__RESERVATION_FREE 0x80
+
+// `levels` value of a block head is `level + 1`, with `VMEM__RESERVATION_FREE` set when the block is free.
+// Everything else is 0.
+
+static void vmem__reservation_push(VMemReservation* res, const uint32_t index, const int level) {
+    const uint32_t head = res->free_heads[level];
+    res->next[index] = head;
+    res->prev[index] = VMEM__RESERVATION_NIL;
+    if(head != VMEM__RESERVATION_NIL) res->prev[head] = index;
+    res->free_heads[level] = index;
+    res->levels[index] = (uint8_t)(VMEM__RESERVATION_FREE | (level + 1));
+}
+
+static void vmem__reservation_remove(VMemReservation* res, const uint32_t index, const int level) {
+    const uint32_t next = res->next[index];
+    const uint32_t prev = res->prev[index];
+    if(prev != VMEM__RESERVATION_NIL) {
+        res->next[prev] = next;
+    } else {
+        res->free_heads[level] = next;
+    }
+    if(next != VMEM__RESERVATION_NIL) res->prev[next] = prev;
+    res->levels[index] = 0;
+}
+
+// @returns index of the min block at `ptr` if it's an acquired block, otherwise NIL.
+static uint32_t vmem__reservation_block_index(const VMemReservation* res, const void* ptr) {
+    const uintptr_t offset = (uintptr_t)ptr - (uintptr_t)res->mem;
+    if((uint8_t*)ptr < res->mem || offset >= res->size_bytes || offset % res->min_block_size != 0) {
+        return VMEM__RESERVATION_NIL;
+    }
+    const uint32_t index = (uint32_t)(offset / res->min_block_size);
+    const uint8_t level = res->levels[index];
+    if(level == 0 || (level & VMEM__RESERVATION_FREE)) return VMEM__RESERVATION_NIL;
+    return index;
+}
+
+VMEM_FUNC VMemResult
+vmem_reservation_init_alloc(VMemReservation* res, const VMemSize size_bytes, const VMemSize min_block_size) {
+    VMEM_ERROR_IF(res == 0, vmem__write_error_message("Reservation pointer is null."));
+    VMEM_ERROR_IF(size_bytes == 0, vmem__write_error_message("Reservation size cannot be zero."));
+
+    VMemReservation result = {0};
+    result.min_block_size = vmem_get_page_size();
+    while(result.min_block_size < min_block_size) result.min_block_size *= 2;
+    result.num_levels = 1;
+    result.size_bytes = result.min_block_size;
+    while(result.size_bytes < size_bytes) {
+        result.size_bytes *= 2;
+        result.num_levels++;
+    }
+    VMEM_ERROR_IF(
+        result.num_levels > VMEM_RESERVATION_MAX_LEVELS || result.size_bytes / result.min_block_size > 0x80000000u,
+        vmem__write_error_message("Too many blocks in the reservation, use a bigger min block size."));
+
+    // Over-reserve, so the blocks can be aligned to their size. The alignment padding is never touched.
+    result.alloc_size_bytes = result.size_bytes + result.min_block_size;
+    result.alloc_mem = (uint8_t*)vmem_alloc_protect(result.alloc_size_bytes, VMemProtect_ReadWrite);
+    if(result.alloc_mem == 0) return VMemResult_Error;
+    result.mem = (uint8_t*)vmem_align_forward((uintptr_t)result.alloc_mem, (int)result.min_block_size);
+
+    const VMemSize num_blocks = result.size_bytes / result.min_block_size;
+    result.metadata_size_bytes = vmem_align_forward(num_blocks * (2 * sizeof(uint32_t) + 1), vmem_get_page_size());
+    uint8_t* metadata = (uint8_t*)vmem_alloc_protect(result.metadata_size_bytes, VMemProtect_ReadWrite);
+    // On Linux this doesn't fault anything in, only the metadata of used blocks ever gets touched.
+    if(metadata == 0 || !vmem_commit_ex(
+                            metadata,
+                            result.metadata_size_bytes,
+                            VMemProtect_ReadWrite,
+                            VMemCommitFlag_KeepProtect)) {
+        if(metadata) vmem_dealloc(metadata, result.metadata_size_bytes);
+        vmem_dealloc(result.alloc_mem, result.alloc_size_bytes);
+        return VMemResult_Error;
+    }
+    result.next = (uint32_t*)metadata;
+    result.prev = result.next + num_blocks;
+    result.levels = (uint8_t*)(result.prev + num_blocks);
+
+    for(int i = 0; i < VMEM_RESERVATION_MAX_LEVELS; i++) result.free_heads[i] = VMEM__RESERVATION_NIL;
+    vmem__reservation_push(&result, 0, result.num_levels - 1);
+    *res = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_reservation_deinit_dealloc(VMemReservation* res) {
+    VMEM_ERROR_IF(res == 0, vmem__write_error_message("Reservation pointer is null."));
+    const VMemResult metadata_result = vmem_dealloc(res->next, res->metadata_size_bytes);
+    const VMemResult result = vmem_dealloc(res->alloc_mem, res->alloc_size_bytes);
+    res->mem = 0;
+    res->alloc_mem = 0;
+    res->next = 0;
+    return metadata_result && result;
+}
+
+VMEM_FUNC void* vmem_reservation_acquire(VMemReservation* res, const VMemSize num_bytes) {
+    VMEM_ERROR_IF(res == 0, vmem__write_error_message("Reservation pointer is null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+    VMEM_ERROR_IF(num_bytes > res->size_bytes, vmem__write_error_message("Size is bigger than the reservation."));
+
+    int level = 0;
+    while((res->min_block_size << level) < num_bytes) level++;
+
+    int free_level = level;
+    while(free_level < res->num_levels && res->free_heads[free_level] == VMEM__RESERVATION_NIL) free_level++;
+    VMEM_ERROR_IF(free_level >= res->num_levels, vmem__write_error_message("No free block is big enough."));
+
+    const uint32_t index = res->free_heads[free_level];
+    vmem__reservation_remove(res, index, free_level);
+    // Split the block, the upper halves become free buddies.
+    while(free_level > level) {
+        free_level--;
+        vmem__reservation_push(res, index + (1u << free_level), free_level);
+    }
+    res->levels[index] = (uint8_t)(level + 1);
+    res->used_bytes += res->min_block_size << level;
+    return res->mem + (VMemSize)index * res->min_block_size;
+}
+
+VMEM_FUNC VMemResult vmem_reservation_release(VMemReservation* res, void* ptr) {
+    VMEM_ERROR_IF(res == 0, vmem__write_error_message("Reservation pointer is null."));
+    uint32_t index = vmem__reservation_block_index(res, ptr);
+    VMEM_ERROR_IF(
+        index == VMEM__RESERVATION_NIL,
+        vmem__write_error_message("Pointer isn't an acquired block of the reservation."));
+
+    int level = res->levels[index] - 1;
+    res->levels[index] = 0;
+    res->used_bytes -= res->min_block_size << level;
+    while(level < res->num_levels - 1) {
+        const uint32_t buddy = index ^ (1u << level);
+        if(res->levels[buddy] != (uint8_t)(VMEM__RESERVATION_FREE | (level + 1))) break;
+        vmem__reservation_remove(res, buddy, level);
+        if(buddy < index) index = buddy;
+        level++;
+    }
+    vmem__reservation_push(res, index, level);
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemSize vmem_reservation_block_size(const VMemReservation* res, const void* ptr) {
+    VMEM_ERROR_IF(res == 0, vmem__write_error_message("Reservation pointer is null."));
+    const uint32_t index = vmem__reservation_block_index(res, ptr);
+    VMEM_ERROR_IF(
+        index == VMEM__RESERVATION_NIL,
+        vmem__write_error_message("Pointer isn't an acquired block of the reservation."));
+    return res->min_block_size << (res->levels[index] - 1);
+}
+
+VMEM_FUNC VMemArena vmem_arena_init_from_reservation(VMemReservation* res, const VMemSize size_bytes) {
+    VMemArena arena = {0};
+    void* mem = vmem_reservation_acquire(res, size_bytes);
+    if(mem == 0) return arena;
+    arena = vmem_arena_init(mem, vmem_reservation_block_size(res, mem));
+    // The reservation is ReadWrite.
+    arena.commit_flags = VMemCommitFlag_KeepProtect;
+    return arena;
+}
+
+VMEM_FUNC VMemResult vmem_arena_deinit_release(VMemArena* arena, VMemReservation* res) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    VMemResult result = VMemResult_Success;
+    // Decommit directly, `arena.commit_policy` could keep the pages.
+    if(arena->commited > 0) {
+        result = vmem_decommit(arena->mem, vmem_arena_calc_bytes_used_for_size(arena->commited));
+    }
+    if(!vmem_reservation_release(res, arena->mem)) return VMemResult_Error;
+    arena->mem = 0;
+    arena->commited = 0;
+    return result;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory pressure implementation
+//
+
+typedef struct vmem__TrimEntry {
+    VMemTrimCallback callback;
+    void* user;
+} vmem__TrimEntry;
+
+static vmem__TrimEntry vmem__g_trim_entries[VMEM_MAX_TRIM_CALLBACKS];
+static int vmem__g_num_trim_entries = 0;
+static volatile VMemSize vmem__g_trim_lock = 0;
+// Number of `vmem_trim_all` calls which are running the callbacks.
+static volatile VMemSize vmem__g_num_running_trims = 0;
+
+static void vmem__trim_lock(void) {
+    while(!vmem__atomic_cas(&vmem__g_trim_lock, 0, 1)) vmem__cpu_pause();
+}
+
+static void vmem__trim_unlock(void) {
+    vmem__atomic_store(&vmem__g_trim_lock, 0);
+}
+
+VMEM_FUNC VMemResult vmem_register_trim_callback(const VMemTrimCallback callback, void* user) {
+    VMEM_ERROR_IF(callback == 0, vmem__write_error_message("Callback is null."));
+    vmem__trim_lock();
+    const int is_full = vmem__g_num_trim_entries >= VMEM_MAX_TRIM_CALLBACKS;
+    if(!is_full) {
+        vmem__g_trim_entries[vmem__g_num_trim_entries].callback = callback;
+        vmem__g_trim_entries[vmem__g_num_trim_entries].user = user;
+        vmem__g_num_trim_entries++;
+    }
+    vmem__trim_unlock();
+    VMEM_ERROR_IF(is_full, vmem__write_error_message("Too many trim callbacks, increase VMEM_MAX_TRIM_CALLBACKS."));
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_unregister_trim_callback(const VMemTrimCallback callback, void* user) {
+    int found = 0;
+    vmem__trim_lock();
+    for(int i = 0; i < vmem__g_num_trim_entries; i++) {
+        if(vmem__g_trim_entries[i].callback == callback && vmem__g_trim_entries[i].user == user) {
+            vmem__g_trim_entries[i] = vmem__g_trim_entries[--vmem__g_num_trim_entries];
+            found = 1;
+            break;
+        }
+    }
+    vmem__trim_unlock();
+    VMEM_UNUSED(found);
+    VMEM_ERROR_IF(!found, vmem__write_error_message("Trim callback isn't registered."));
+    // The callback can still be running if `vmem_trim_all` copied the list before it was removed.
+    while(vmem__atomic_load(&vmem__g_num_running_trims) != 0) vmem__cpu_pause();
+    return VMemResult_Success;
+}
+
+static VMemSize vmem__arena_trim_callback(void* user) {
+    return vmem_arena_trim((VMemArena*)user);
+}
+
+VMEM_FUNC VMemResult vmem_register_arena(VMemArena* arena) {
+    VMEM_ERROR_IF(arena == 0, vmem__write_error_message("Arena pointer is null."));
+    return vmem_register_trim_callback(vmem__arena_trim_callback, arena);
+}
+
+VMEM_FUNC VMemResult vmem_unregister_arena(VMemArena* arena) {
+    return vmem_unregister_trim_callback(vmem__arena_trim_callback, arena);
+}
+
+VMEM_FUNC VMemSize vmem_trim_all(void) {
+    // Callbacks can take a while, so they run on a copy of the list, without holding the lock.
+    vmem__TrimEntry entries[VMEM_MAX_TRIM_CALLBACKS];
+    vmem__trim_lock();
+    const int num_entries = vmem__g_num_trim_entries;
+    memcpy(entries, vmem__g_trim_entries, (size_t)num_entries * sizeof(vmem__TrimEntry));
+    vmem__atomic_fetch_add(&vmem__g_num_running_trims, 1);
+    vmem__trim_unlock();
+
+    VMemSize total = 0;
+    for(int i = 0; i < num_entries; i++) {
+        total += entries[i].callback(entries[i].user);
+    }
+    vmem__atomic_fetch_add(&vmem__g_num_running_trims, (VMemSize)0 - 1);
+    return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Worker implementation
+//
+
+// Max number of operations the worker gives to one `vmem_batch` call.
+#define VMEM__WORKER_BATCH_SIZE 64
+
+static void vmem__thread_yield(const int sleep) {
+#if defined(VMEM_PLATFORM_WIN32)
+    Sleep(sleep ? 1 : 0);
+#elif defined(VMEM_PLATFORM_LINUX)
+    if(sleep) {
+        struct timespec duration = {0, 1000000};
+        nanosleep(&duration, NULL);
+    } else {
+        sched_yield();
+    }
+#endif
+}
+
+VMEM_FUNC VMemResult vmem_worker_init(VMemWorker* worker, const VMemSize capacity, const VMemCommitFlags flags) {
+    VMEM_ERROR_IF(worker == 0, vmem__write_error_message("Worker pointer is null."));
+    VMEM_ERROR_IF(
+        capacity == 0 || (capacity & (capacity - 1)) != 0,
+        vmem__write_error_message("Worker queue capacity has to be a power of 2."));
+    VMemWorker result = {0};
+    result.slots = (VMemWorkerSlot*)vmem_alloc_commited(capacity * sizeof(VMemWorkerSlot));
+    if(result.slots == 0) return VMemResult_Error;
+    // A slot is free for position `pos` when its sequence is `pos`, and ready to read when it's `pos + 1`.
+    for(VMemSize i = 0; i < capacity; i++) result.slots[i].sequence = i;
+    result.capacity = capacity;
+    result.flags = flags;
+    *worker = result;
+    return VMemResult_Success;
+}
+
+VMEM_FUNC VMemResult vmem_worker_deinit(VMemWorker* worker) {
+    VMEM_ERROR_IF(worker == 0 || worker->slots == 0, vmem__write_error_message("Worker isn't initialized."));
+    const VMemResult result = vmem_dealloc(worker->slots, worker->capacity * sizeof(VMemWorkerSlot));
+    worker->slots = 0;
+    return result;
+}
+
+VMEM_FUNC VMemResult vmem_worker_submit(
+    VMemWorker* worker,
+    void* ptr,
+    const VMemSize num_bytes,
+    const VMemBatchOp op,
+    const VMemProtect protect) {
+    VMEM_ERROR_IF(worker == 0 || worker->slots == 0, vmem__write_error_message("Worker isn't initialized."));
+    VMEM_ERROR_IF(ptr == 0, vmem__write_error_message("Ptr cannot be null."));
+    VMEM_ERROR_IF(num_bytes == 0, vmem__write_error_message("Size cannot be 0."));
+
+    const VMemSize mask = worker->capacity - 1;
+    VMemSize pos = vmem__atomic_load(&worker->head);
+    for(;;) {
+        VMemWorkerSlot* slot = &worker->slots[pos & mask];
+        const VMemSize sequence = vmem__atomic_load(&slot->sequence);
+        if(sequence == pos) {
+            if(vmem__atomic_cas(&worker->head, pos, pos + 1)) {
+                slot->entry.ptr = ptr;
+                slot->entry.num_bytes = num_bytes;
+                slot->entry.op = op;
+                slot->entry.protect = protect;
+                slot->entry.result = VMemResult_Error;
+                vmem__atomic_store(&slot->sequence, pos + 1);
+                return VMemResult_Success;
+            }
+        } else if((intptr_t)(sequence - pos) < 0) {
+            // The worker didn't read this slot yet, the queue is full.
+            break;
+        }
+        pos = vmem__atomic_load(&worker->head);
+    }
+
+    // Don't wait for the worker, just do it on this thread.
+    vmem__atomic_fetch_add(&worker->num_overflows, 1);
+    VMemBatchEntry entry;
+    entry.ptr = ptr;
+    entry.num_bytes = num_bytes;
+    entry.op = op;
+    entry.protect = protect;
+    entry.result = VMemResult_Error;
+    if(vmem_batch(&entry, 1, worker->flags) == 1) return VMemResult_Success;
+    // Counted like a failure on the worker, so `vmem_worker_flush` reports it too.
+    vmem__atomic_fetch_add(&worker->num_failed, 1);
+    return VMemResult_Error;
+}
+
+VMEM_FUNC VMemSize vmem_worker_process(VMemWorker* worker) {
+    VMEM_ERROR_IF(worker == 0 || worker->slots == 0, vmem__write_error_message("Worker isn't initialized."));
+    const VMemSize mask = worker->capacity - 1;
+    // Operations queued while processing wait for the next call, so this can't run forever.
+    const VMemSize end = vmem__atomic_load(&worker->head);
+    VMemSize total = 0;
+    while(worker->tail != end) {
+        VMemBatchEntry entries[VMEM__WORKER_BATCH_SIZE];
+        VMemSize num_entries = 0;
+        VMemSize pos = worker->tail;
+        while(pos != end && num_entries < VMEM__WORKER_BATCH_SIZE) {
+            VMemWorkerSlot* slot = &worker->slots[pos & mask];
+            // The slot is reserved, but the producer didn't finish writing it yet.
+            if(vmem__atomic_load(&slot->sequence) != pos + 1) break;
+            entries[num_entries++] = slot->entry;
+            vmem__atomic_store(&slot->sequence, pos + worker->capacity);
+            pos++;
+        }
+        if(num_entries == 0) break;
+        worker->tail = pos;
+        const VMemSize num_succeeded = vmem_batch(entries, num_entries, worker->flags);
+        if(num_succeeded != num_entries) vmem__atomic_fetch_add(&worker->num_failed, num_entries - num_succeeded);
+        vmem__atomic_store(&worker->num_done, pos);
+        total += num_entries;
+    }
+    return total;
+}
+
+VMEM_FUNC VMemResult vmem_worker_run(VMemWorker* worker) {
+    VMEM_ERROR_IF(worker == 0 || worker->slots == 0, vmem__write_error_message("Worker isn't initialized."));
+    int num_idle = 0;
+    while(!vmem__atomic_load(&worker->stop)) {
+        if(vmem_worker_process(worker) != 0) {
+            num_idle = 0;
+        } else {
+            // Stay responsive for a while after a burst, then stop burning the CPU.
+            vmem__thread_yield(num_idle >= 100);
+            if(num_idle < 100) num_idle++;
+        }
+    }
+    // The producers could still be writing the last slots.
+    while(worker->tail != vmem__atomic_load(&worker->head)) {
+        if(vmem_worker_process(worker) == 0) vmem__thread_yield(0);
+    }
+    return VMemResult_Success;
+}
+
+VMEM_FUNC void vmem_worker_stop(VMemWorker* worker) {
+    if(worker) vmem__atomic_store(&worker->stop, 1);
+}
+
+VMEM_FUNC VMemResult vmem_worker_flush(VMemWorker* worker) {
+    VMEM_ERROR_IF(worker == 0 || worker->slots == 0, vmem__write_error_message("Worker isn't initialized."));
+    const VMemSize target = vmem__atomic_load(&worker->head);
+    while(vmem__atomic_load(&worker->num_done) < target) vmem__thread_yield(0);
+    VMEM_ERROR_IF(
+        vmem__atomic_load(&worker->num_failed) != 0,
+        vmem__write_error_message("Some of the worker operations failed."));
+    return VMemResult_Success;
+}
+
 #if defined(__cplusplus)
 }
 #endif